@@ -9,6 +9,7 @@ See www.cartotype.com for more information.
 #include <cartotype_color.h>
 #include <cartotype_errors.h>
 #include <cartotype_stream.h>
+#include <cartotype_simd.h>
 
 namespace CartoTypeCore
 {
@@ -99,6 +100,132 @@ class BitmapView
     using TColorFunction = Color(*)(const BitmapView& aBitmap,uint32_t aX,uint32_t aY);
     
     TColorFunction ColorFunction() const;
+
+    /**
+    Converts aCount pixels of type aSourceType starting at aSource to aDestType, writing them to aDest.
+    The palette aPalette is used if the source type is P8. Returns false, doing nothing, if the conversion is not supported.
+
+    Conversions to RGBA32 are supported from A8, RGB16, RGB24, RGBA32 and P8.
+    A8 pixels are converted to opaque grey levels, RGB16 levels are expanded to eight bits by repeating their high bits,
+    and RGB24 pixels are made opaque. P8 indexes not in the palette give transparent black.
+    These are the conversions used by ReadRow; they are not guaranteed to give the same values as the color function.
+    */
+    static bool ConvertRow(BitmapType aSourceType,const uint8_t* aSource,BitmapType aDestType,uint8_t* aDest,size_t aCount,const CartoTypeCore::Palette* aPalette = nullptr)
+        {
+        if (aDestType != BitmapType::RGBA32)
+            return false;
+        uint32_t* dest = (uint32_t*)aDest;
+        size_t i = 0;
+        switch (aSourceType)
+            {
+            case BitmapType::A8:
+#ifdef CARTOTYPE_SSE2
+                for (; i + 16 <= aCount; i += 16)
+                    {
+                    __m128i opaque = _mm_set1_epi32(int(0xFF000000));
+                    __m128i x = _mm_loadu_si128((const __m128i*)(aSource + i));
+                    __m128i lo = _mm_unpacklo_epi8(x,x);
+                    __m128i hi = _mm_unpackhi_epi8(x,x);
+                    _mm_storeu_si128((__m128i*)(dest + i),_mm_or_si128(_mm_unpacklo_epi16(lo,lo),opaque));
+                    _mm_storeu_si128((__m128i*)(dest + i + 4),_mm_or_si128(_mm_unpackhi_epi16(lo,lo),opaque));
+                    _mm_storeu_si128((__m128i*)(dest + i + 8),_mm_or_si128(_mm_unpacklo_epi16(hi,hi),opaque));
+                    _mm_storeu_si128((__m128i*)(dest + i + 12),_mm_or_si128(_mm_unpackhi_epi16(hi,hi),opaque));
+                    }
+#endif
+                for (; i < aCount; i++)
+                    dest[i] = 0xFF000000 | (aSource[i] * 0x010101U);
+                return true;
+
+            case BitmapType::RGB16:
+                {
+                const uint16_t* source = (const uint16_t*)aSource;
+#ifdef CARTOTYPE_SSE2
+                for (; i + 8 <= aCount; i += 8)
+                    {
+                    __m128i p = _mm_loadu_si128((const __m128i*)(source + i));
+                    __m128i r = _mm_srli_epi16(p,11);
+                    __m128i g = _mm_and_si128(_mm_srli_epi16(p,5),_mm_set1_epi16(63));
+                    __m128i b = _mm_and_si128(p,_mm_set1_epi16(31));
+                    r = _mm_or_si128(_mm_slli_epi16(r,3),_mm_srli_epi16(r,2));
+                    g = _mm_or_si128(_mm_slli_epi16(g,2),_mm_srli_epi16(g,4));
+                    b = _mm_or_si128(_mm_slli_epi16(b,3),_mm_srli_epi16(b,2));
+                    __m128i rg = _mm_or_si128(r,_mm_slli_epi16(g,8));
+                    __m128i ba = _mm_or_si128(b,_mm_set1_epi16(short(0xFF00)));
+                    _mm_storeu_si128((__m128i*)(dest + i),_mm_unpacklo_epi16(rg,ba));
+                    _mm_storeu_si128((__m128i*)(dest + i + 4),_mm_unpackhi_epi16(rg,ba));
+                    }
+#endif
+                for (; i < aCount; i++)
+                    {
+                    uint32_t p = source[i];
+                    uint32_t r = p >> 11, g = (p >> 5) & 63, b = p & 31;
+                    dest[i] = 0xFF000000 | (((b << 3) | (b >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((r << 3) | (r >> 2));
+                    }
+                return true;
+                }
+
+            case BitmapType::RGB24:
+                for (; i < aCount; i++, aSource += 3)
+                    dest[i] = 0xFF000000 | (uint32_t(aSource[0]) << 16) | (uint32_t(aSource[1]) << 8) | aSource[2];
+                return true;
+
+            case BitmapType::RGBA32:
+                memmove(dest,aSource,aCount * 4);
+                return true;
+
+            case BitmapType::P8:
+                {
+                if (!aPalette)
+                    return false;
+                // Copy the palette into a full table so that the loop needs no range check.
+                uint32_t table[256] = { };
+                size_t colors = std::min(aPalette->ColorCount(),size_t(256));
+                for (size_t j = 0; j < colors; j++)
+                    table[j] = aPalette->Color()[j].Value;
+                for (; i < aCount; i++)
+                    dest[i] = table[aSource[i]];
+                return true;
+                }
+
+            default:
+                return false;
+            }
+        }
+
+    /** Converts aCount premultiplied RGBA32 pixels at aPixel to straight alpha, as required by PNG, in place. */
+    static void Unpremultiply(uint32_t* aPixel,size_t aCount)
+        {
+        for (size_t i = 0; i < aCount; i++)
+            {
+            uint32_t p = aPixel[i];
+            uint32_t a = p >> 24;
+            if (a == 0xFF)
+                continue;
+            if (a == 0)
+                {
+                aPixel[i] = 0;
+                continue;
+                }
+            uint32_t r = std::min(((p & 0xFF) * 255 + a / 2) / a,255U);
+            uint32_t g = std::min((((p >> 8) & 0xFF) * 255 + a / 2) / a,255U);
+            uint32_t b = std::min((((p >> 16) & 0xFF) * 255 + a / 2) / a,255U);
+            aPixel[i] = (a << 24) | (b << 16) | (g << 8) | r;
+            }
+        }
+
+    /**
+    Converts the row aY to RGBA32, writing Width() pixels to aDest. Uses ConvertRow if the conversion is supported,
+    otherwise calls the color function for each pixel.
+    */
+    void ReadRow(uint32_t aY,uint32_t* aDest) const
+        {
+        const uint8_t* row = iData + size_t(aY) * iRowBytes;
+        if (ConvertRow(iType,row,BitmapType::RGBA32,(uint8_t*)aDest,iWidth,iPalette.get()))
+            return;
+        TColorFunction color_function = ColorFunction();
+        for (uint32_t x = 0; x < iWidth; x++)
+            aDest[x] = color_function(*this,x,aY).Value;
+        }
     Bitmap Copy(int32_t aExpansion = 0) const;
     Bitmap Blur(bool aGaussian,double aWidth) const;
     Bitmap Palettize() const;
@@ -136,6 +263,69 @@ class BitmapView
     void Clear() { memset(iData,0,size_t(iHeight * iRowBytes)); }
     /** Clear the pixel data to ones (normally white). */
     void ClearToWhite() { memset(iData,0xFF,size_t(iHeight * iRowBytes)); }
+    /**
+    Returns a view of the rectangle aRect, which is clipped to the bounds of this bitmap.
+    No data is copied: the view refers to the same pixels as this bitmap, using the same row bytes.
+    Returns an empty view if the left edge of the rectangle does not start on a byte boundary.
+    */
+    BitmapView View(Rect aRect)
+        {
+        aRect.Intersection(Rect(0,0,iWidth,iHeight));
+        size_t left_bits = size_t(aRect.MinX()) * BitsPerPixel();
+        if (aRect.IsEmpty() || left_bits % 8)
+            return BitmapView(iType,nullptr,0,0,0,iPalette);
+        return BitmapView(iType,iData + size_t(aRect.MinY()) * iRowBytes + left_bits / 8,aRect.Width(),aRect.Height(),iRowBytes,iPalette);
+        }
+
+    /**
+    Moves the pixels aDx pixels to the right and aDy pixels down, in place, as when the map is panned.
+    Pixels moved outside the bitmap are discarded. The rectangles uncovered by the move,
+    which are not cleared, are appended to aExposed if it is non-null: there are at most two,
+    a horizontal strip and a vertical strip, which do not overlap.
+    Returns false, doing nothing, if pixels take up less than a byte.
+    */
+    bool Scroll(int32_t aDx,int32_t aDy,std::vector<Rect>* aExposed = nullptr)
+        {
+        int32_t bytes_per_pixel = BitsPerPixel() / 8;
+        if (bytes_per_pixel == 0)
+            return false;
+        int32_t width = iWidth;
+        int32_t height = iHeight;
+        if (aDx <= -width || aDx >= width || aDy <= -height || aDy >= height)
+            {
+            if (aExposed && width > 0 && height > 0)
+                aExposed->emplace_back(0,0,width,height);
+            return true;
+            }
+
+        int32_t min_y = std::max(aDy,0);
+        int32_t max_y = std::min(height + aDy,height);
+        int32_t min_x = std::max(aDx,0);
+        size_t row_bytes = size_t(width - std::abs(aDx)) * bytes_per_pixel;
+        if (aDx || aDy)
+            {
+            // Copy in the direction that does not overwrite rows not yet moved.
+            int32_t first = aDy > 0 ? max_y - 1 : min_y;
+            int32_t step = aDy > 0 ? -1 : 1;
+            for (int32_t y = first; y >= min_y && y < max_y; y += step)
+                memmove(iData + size_t(y) * iRowBytes + size_t(min_x) * bytes_per_pixel,
+                        iData + size_t(y - aDy) * iRowBytes + size_t(min_x - aDx) * bytes_per_pixel,
+                        row_bytes);
+            }
+
+        if (aExposed)
+            {
+            if (aDy > 0)
+                aExposed->emplace_back(0,0,width,aDy);
+            else if (aDy < 0)
+                aExposed->emplace_back(0,height + aDy,width,height);
+            if (aDx > 0)
+                aExposed->emplace_back(0,min_y,aDx,max_y);
+            else if (aDx < 0)
+                aExposed->emplace_back(width + aDx,min_y,width,max_y);
+            }
+        return true;
+        }
 
     /** The less-than operator. Assumes that the bitmaps are of the same type. */
     bool operator<(const BitmapView& aOther) const
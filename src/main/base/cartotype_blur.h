@@ -0,0 +1,168 @@
+/*
+cartotype_blur.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_bitmap.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace CartoTypeCore
+{
+
+/**
+A separable blur for bitmaps with eight bits per channel, for creating text glows and shadows.
+
+A box blur is done as a horizontal pass followed by a vertical pass. Each pass keeps a running
+sum over the blur window, so the cost per pixel does not depend on the blur width.
+The vertical pass keeps one running sum for each byte of a row and updates them a whole row at a time,
+so it reads memory in order and the inner loop can be vectorized by the compiler.
+A Gaussian blur is approximated by three box blurs of suitable widths.
+
+Pixels outside the bitmap are treated as zero, so a glow fades out towards the edges.
+*/
+class SeparableBlur
+    {
+    public:
+    /**
+    Blurs aBitmap in place. If aGaussian is true, does a Gaussian blur with standard deviation aWidth / 2,
+    otherwise does a box blur with radius aWidth, rounded to the nearest pixel.
+    Returns false, doing nothing, if the bitmap type does not use whole bytes for each channel.
+    */
+    static bool Blur(BitmapView& aBitmap,bool aGaussian,double aWidth)
+        {
+        if (aGaussian)
+            {
+            int32_t radius[3];
+            GaussianBoxRadii(aWidth / 2,radius);
+            for (int32_t r : radius)
+                if (!BoxBlur(aBitmap,r))
+                    return false;
+            return true;
+            }
+        return BoxBlur(aBitmap,int32_t(std::lround(aWidth)));
+        }
+
+    /**
+    Blurs aBitmap in place using a box of radius aRadius: each pixel becomes the average of the (2 * aRadius + 1)^2 pixels centered on it.
+    Returns false, doing nothing, if the bitmap type does not use whole bytes for each channel.
+    */
+    static bool BoxBlur(BitmapView& aBitmap,int32_t aRadius)
+        {
+        if (aBitmap.Type() != BitmapType::A8 && aBitmap.Type() != BitmapType::RGB24 && aBitmap.Type() != BitmapType::RGBA32)
+            return false;
+        aRadius = std::min(aRadius,KMaxRadius);
+        if (aRadius <= 0 || aBitmap.Width() == 0 || aBitmap.Height() == 0)
+            return true;
+        size_t channels = size_t(aBitmap.BitsPerPixel() / 8);
+        BlurRows(aBitmap,channels,aRadius);
+        BlurColumns(aBitmap,channels,aRadius);
+        return true;
+        }
+
+    /** Sets aRadius to the radii of three box blurs which together approximate a Gaussian blur with the standard deviation aSigma. */
+    static void GaussianBoxRadii(double aSigma,int32_t aRadius[3])
+        {
+        // The ideal box width for three passes, rounded down to an odd number; some passes then use the next odd width up.
+        double ideal_width = std::sqrt(12 * aSigma * aSigma / 3 + 1);
+        int32_t lower_width = int32_t(ideal_width);
+        if (lower_width % 2 == 0)
+            lower_width--;
+        int32_t upper_width = lower_width + 2;
+        double ideal_lower_passes = (12 * aSigma * aSigma - 3.0 * lower_width * lower_width - 12.0 * lower_width - 9) / (-4.0 * lower_width - 4);
+        int32_t lower_passes = int32_t(std::lround(ideal_lower_passes));
+        for (int32_t i = 0; i < 3; i++)
+            aRadius[i] = ((i < lower_passes ? lower_width : upper_width) - 1) / 2;
+        }
+
+    private:
+    /** The largest radius supported, which keeps the running sums and their scaled values within 32 bits. */
+    static constexpr int32_t KMaxRadius = 4095;
+
+    // Returns the reciprocal of the window size, scaled by 2^24.
+    static uint32_t Reciprocal(int32_t aRadius)
+        {
+        uint32_t window = uint32_t(2 * aRadius + 1);
+        return ((1U << 24) + window / 2) / window;
+        }
+
+    static uint8_t Average(uint32_t aSum,uint32_t aReciprocal)
+        {
+        return uint8_t((aSum * aReciprocal + (1U << 23)) >> 24);
+        }
+
+    static void BlurRows(BitmapView& aBitmap,size_t aChannels,int32_t aRadius)
+        {
+        const size_t width = size_t(aBitmap.Width());
+        const size_t radius = size_t(aRadius);
+        const uint32_t reciprocal = Reciprocal(aRadius);
+        std::vector<uint8_t> source(width * aChannels);
+        for (int32_t y = 0; y < aBitmap.Height(); y++)
+            {
+            uint8_t* row = aBitmap.Data() + size_t(y) * aBitmap.RowBytes();
+            memcpy(source.data(),row,source.size());
+            for (size_t c = 0; c < aChannels; c++)
+                {
+                const uint8_t* in = source.data() + c;
+                uint8_t* out = row + c;
+                uint32_t sum = 0;
+                for (size_t x = 0; x < radius && x < width; x++)
+                    sum += in[x * aChannels];
+                for (size_t x = 0; x < width; x++)
+                    {
+                    if (x + radius < width)
+                        sum += in[(x + radius) * aChannels];
+                    out[x * aChannels] = Average(sum,reciprocal);
+                    if (x >= radius)
+                        sum -= in[(x - radius) * aChannels];
+                    }
+                }
+            }
+        }
+
+    static void BlurColumns(BitmapView& aBitmap,size_t aChannels,int32_t aRadius)
+        {
+        const size_t height = size_t(aBitmap.Height());
+        const size_t row_length = size_t(aBitmap.Width()) * aChannels;
+        const size_t row_bytes = size_t(aBitmap.RowBytes());
+        const size_t radius = size_t(aRadius);
+        const uint32_t reciprocal = Reciprocal(aRadius);
+        uint8_t* data = aBitmap.Data();
+
+        // The original values of the last radius + 1 rows, which are needed after the rows have been overwritten.
+        std::vector<uint8_t> saved((radius + 1) * row_length);
+        std::vector<uint32_t> sum(row_length);
+        uint32_t* s = sum.data();
+        for (size_t y = 0; y < radius && y < height; y++)
+            {
+            const uint8_t* in = data + y * row_bytes;
+            for (size_t i = 0; i < row_length; i++)
+                s[i] += in[i];
+            }
+        for (size_t y = 0; y < height; y++)
+            {
+            uint8_t* row = data + y * row_bytes;
+            if (y + radius < height)
+                {
+                const uint8_t* in = data + (y + radius) * row_bytes;
+                for (size_t i = 0; i < row_length; i++)
+                    s[i] += in[i];
+                }
+            memcpy(saved.data() + (y % (radius + 1)) * row_length,row,row_length);
+            for (size_t i = 0; i < row_length; i++)
+                row[i] = Average(s[i],reciprocal);
+            if (y >= radius)
+                {
+                const uint8_t* old = saved.data() + ((y - radius) % (radius + 1)) * row_length;
+                for (size_t i = 0; i < row_length; i++)
+                    s[i] -= old[i];
+                }
+            }
+        }
+    };
+
+}
@@ -0,0 +1,57 @@
+/*
+cartotype_compressed_stream.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#include <cartotype_compressed_stream.h>
+#include <zlib.h>
+
+namespace CartoTypeCore
+{
+
+/**
+Decompresses block number aBlock into iBlockData, unless it is already there.
+Throws KErrorCorrupt if the block's size is not the size given by the index.
+*/
+void CompressedFileInputStream::DecompressBlock(size_t aBlock)
+    {
+    if (aBlock == iBlockNumber)
+        return;
+    iBlockNumber = SIZE_MAX;
+
+    iCompressedData.resize(KMaxBlockSize);
+    uint8_t* compressed = iCompressedData.data();
+    int64_t position = iIndex->CompressedOffset[aBlock];
+    if (iFile.Seek(position,SEEK_SET) || iFile.Read(compressed,KHeaderSize) != KHeaderSize)
+        throw KErrorIo;
+    size_t block_size = BlockSize(compressed);
+    if (block_size < KHeaderSize + KTrailerSize)
+        throw KErrorCorrupt;
+    size_t rest = block_size - KHeaderSize;
+    if (iFile.Read(compressed + KHeaderSize,rest) != rest)
+        throw KErrorIo;
+    const uint8_t* trailer = compressed + block_size - KTrailerSize;
+    uint32_t uncompressed_size = ReadLittleEndian32(trailer + 4);
+    const auto& offset = iIndex->UncompressedOffset;
+    int64_t end = aBlock + 1 < offset.size() ? offset[aBlock + 1] : iIndex->UncompressedLength;
+    if (uncompressed_size > KMaxBlockSize || int64_t(uncompressed_size) != end - offset[aBlock])
+        throw KErrorCorrupt;
+
+    iBlockData.resize(uncompressed_size);
+    z_stream z = { };
+    if (inflateInit2(&z,-MAX_WBITS) != Z_OK)
+        throw KErrorNoMemory;
+    z.next_in = compressed + KHeaderSize;
+    z.avail_in = uInt(block_size - KHeaderSize - KTrailerSize);
+    z.next_out = iBlockData.data();
+    z.avail_out = uInt(uncompressed_size);
+    int status = inflate(&z,Z_FINISH);
+    inflateEnd(&z);
+    if (status != Z_STREAM_END || z.avail_out != 0 ||
+        crc32(crc32(0,nullptr,0),iBlockData.data(),uInt(uncompressed_size)) != ReadLittleEndian32(trailer))
+        throw KErrorCorrupt;
+    iBlockNumber = aBlock;
+    }
+
+}
@@ -0,0 +1,264 @@
+/*
+cartotype_compressed_stream.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_stream.h>
+#include <algorithm>
+
+namespace CartoTypeCore
+{
+
+/**
+An input stream for a file compressed in blocks using the BGZF format,
+which is created by the bgzip tool and can be read by any gzip decompressor.
+
+The file is a series of gzip members, each holding up to 64Kb of uncompressed data
+and recording its own compressed size, so any position in the uncompressed data can be
+reached by decompressing a single block. The block index is read from a .gzi file
+of the same name plus ".gzi" (created by bgzip -i) if there is one; otherwise it
+is built by reading the block headers when the file is opened. A .gzi file
+which exists but cannot be read or does not match the data file is reported as an error.
+
+Decompressed data is held in the CachedFileInputStream buffer cache, so frequently used
+parts of the file are decompressed only once.
+
+Decompression uses zlib, which is used only by cartotype_compressed_stream.cpp, not by this header.
+Programs using this class must compile cartotype_compressed_stream.cpp and link with zlib.
+*/
+class CompressedFileInputStream: public CachedFileInputStream
+    {
+    public:
+    /** Creates a CompressedFileInputStream to read from the file aFileName. Returns the result in aError. */
+    static std::unique_ptr<CompressedFileInputStream> New(Result& aError,const std::string& aFileName,size_t aBufferSize = KDefaultBufferSize,size_t aMaxBuffers = KDefaultMaxBuffers)
+        {
+        std::unique_ptr<CompressedFileInputStream> stream(new CompressedFileInputStream(aBufferSize,aMaxBuffers));
+        aError = stream->Open(aFileName,nullptr);
+        if (aError)
+            return nullptr;
+        return stream;
+        }
+
+    /** Creates a CompressedFileInputStream to read from the file aFileName. Throws an exception if the file cannot be opened or is not in BGZF format. */
+    explicit CompressedFileInputStream(const std::string& aFileName,size_t aBufferSize = KDefaultBufferSize,size_t aMaxBuffers = KDefaultMaxBuffers):
+        CompressedFileInputStream(aBufferSize,aMaxBuffers)
+        {
+        Result error = Open(aFileName,nullptr);
+        if (error)
+            throw error;
+        }
+
+    /** Returns true if the file aFileName starts with a BGZF block header. */
+    static bool IsCompressed(const std::string& aFileName)
+        {
+        BinaryInputFile file;
+        uint8_t header[KHeaderSize];
+        return !file.Open(aFileName.c_str()) && file.Read(header,KHeaderSize) == KHeaderSize && BlockSize(header) != 0;
+        }
+
+    /** Returns a copy of this CompressedFileInputStream, sharing the block index. */
+    std::unique_ptr<FileInputStream> Copy() override
+        {
+        std::unique_ptr<CompressedFileInputStream> stream(new CompressedFileInputStream(iBufferSize,iCache.MaxBuffers()));
+        Result error = stream->Open(iName,iIndex);
+        if (error)
+            throw error;
+        return stream;
+        }
+
+    /**
+    Does nothing: read-ahead is not supported, because buffer positions are positions in the uncompressed data,
+    not in the compressed file.
+    */
+    void SetReadAhead(size_t /*aBufferCount*/) override { }
+
+    protected:
+    /** Fills aBuffer with uncompressed data starting at aPos, decompressing as many blocks as needed. */
+    void ReadBuffer(CBuffer& aBuffer,int64_t aPos) override
+        {
+        if (!aBuffer.iData)
+            aBuffer.iData = new uint8_t[iBufferSize];
+        aBuffer.iPosition = aPos;
+        aBuffer.iSize = 0;
+        while (aBuffer.iSize < iBufferSize && aPos < iLength)
+            {
+            const auto& offset = iIndex->UncompressedOffset;
+            size_t block = size_t(std::upper_bound(offset.begin(),offset.end(),aPos) - offset.begin()) - 1;
+            DecompressBlock(block);
+            size_t offset_in_block = size_t(aPos - offset[block]);
+            if (offset_in_block >= iBlockData.size())
+                throw KErrorCorrupt;
+            size_t bytes = std::min(iBufferSize - aBuffer.iSize,iBlockData.size() - offset_in_block);
+            if (!bytes)
+                throw KErrorCorrupt;
+            memcpy(aBuffer.iData + aBuffer.iSize,iBlockData.data() + offset_in_block,bytes);
+            aBuffer.iSize += bytes;
+            aPos += int64_t(bytes);
+            }
+        }
+
+    private:
+    /** The index of the blocks in a file. It is shared between copies of a stream. */
+    class BlockIndex
+        {
+        public:
+        /** The offset of each block in the compressed file. */
+        std::vector<int64_t> CompressedOffset;
+        /** The offset of the start of each block's data in the uncompressed data. */
+        std::vector<int64_t> UncompressedOffset;
+        /** The offset of the end of the last block in the compressed file. */
+        int64_t CompressedLength = 0;
+        /** The length of the uncompressed data. */
+        int64_t UncompressedLength = 0;
+        };
+
+    /** The size of a BGZF block header. */
+    static constexpr size_t KHeaderSize = 18;
+    /** The size of a gzip member trailer: the CRC and the uncompressed size. */
+    static constexpr size_t KTrailerSize = 8;
+    /** The maximum size of a BGZF block, compressed or uncompressed. */
+    static constexpr size_t KMaxBlockSize = 65536;
+
+    CompressedFileInputStream(size_t aBufferSize,size_t aMaxBuffers):
+        CachedFileInputStream(aBufferSize,aMaxBuffers)
+        {
+        }
+
+    static uint32_t ReadLittleEndian16(const uint8_t* aP) { return uint32_t(aP[0]) | uint32_t(aP[1]) << 8; }
+    static uint32_t ReadLittleEndian32(const uint8_t* aP) { return ReadLittleEndian16(aP) | ReadLittleEndian16(aP + 2) << 16; }
+    static uint64_t ReadLittleEndian64(const uint8_t* aP) { return uint64_t(ReadLittleEndian32(aP)) | uint64_t(ReadLittleEndian32(aP + 4)) << 32; }
+
+    /**
+    Returns the total size of the block whose header is aHeader, or zero if it is not a BGZF header.
+    Only the usual header, in which the BC field is the only extra field, is recognised.
+    */
+    static size_t BlockSize(const uint8_t* aHeader)
+        {
+        if (aHeader[0] != 31 || aHeader[1] != 139 || aHeader[2] != 8 || !(aHeader[3] & 4) ||
+            ReadLittleEndian16(aHeader + 10) != 6 || aHeader[12] != 'B' || aHeader[13] != 'C' || ReadLittleEndian16(aHeader + 14) != 2)
+            return 0;
+        return ReadLittleEndian16(aHeader + 16) + 1;
+        }
+
+    Result Open(const std::string& aFileName,std::shared_ptr<const BlockIndex> aIndex)
+        {
+        Result error = iFile.Open(aFileName.c_str());
+        if (error)
+            return error;
+        iName = aFileName;
+        iIndex = aIndex;
+        if (!iIndex)
+            {
+            auto index = std::make_shared<BlockIndex>();
+            error = iFile.Seek(0,SEEK_END);
+            if (!error)
+                {
+                index->CompressedLength = iFile.Tell();
+                error = ReadIndexFile(*index,aFileName + ".gzi");
+                if (error == KErrorNotFound)
+                    error = BuildIndex(*index);
+                }
+            if (error)
+                return error;
+            iIndex = index;
+            }
+        iLength = iIndex->UncompressedLength;
+        return KErrorNone;
+        }
+
+    /**
+    Reads a .gzi index file. Returns KErrorNotFound if there is none, or KErrorCorrupt if it is invalid
+    or does not match the data file. As in an index built by BuildIndex, the uncompressed offsets must be
+    strictly increasing, because empty blocks are not indexed, and no block may hold more than KMaxBlockSize bytes.
+    Block sizes are checked again when blocks are decompressed.
+    */
+    Result ReadIndexFile(BlockIndex& aIndex,const std::string& aFileName)
+        {
+        BinaryInputFile file;
+        if (file.Open(aFileName.c_str()))
+            return KErrorNotFound;
+        uint8_t buffer[16];
+        if (file.Read(buffer,8) != 8)
+            return KErrorCorrupt;
+        uint64_t count = ReadLittleEndian64(buffer);
+        aIndex.CompressedOffset.push_back(0);
+        aIndex.UncompressedOffset.push_back(0);
+        for (uint64_t i = 0; i < count; i++)
+            {
+            if (file.Read(buffer,16) != 16)
+                return KErrorCorrupt;
+            int64_t compressed_offset = int64_t(ReadLittleEndian64(buffer));
+            int64_t uncompressed_offset = int64_t(ReadLittleEndian64(buffer + 8));
+            if (compressed_offset <= aIndex.CompressedOffset.back() || uncompressed_offset <= aIndex.UncompressedOffset.back() ||
+                uncompressed_offset - aIndex.UncompressedOffset.back() > int64_t(KMaxBlockSize))
+                return KErrorCorrupt;
+            aIndex.CompressedOffset.push_back(compressed_offset);
+            aIndex.UncompressedOffset.push_back(uncompressed_offset);
+            }
+
+        // The .gzi file does not give the size of the last block, so read it from the last block's trailer.
+        int64_t last_block = aIndex.CompressedOffset.back();
+        uint8_t header[KHeaderSize];
+        if (iFile.Seek(last_block,SEEK_SET) || iFile.Read(header,KHeaderSize) != KHeaderSize)
+            return KErrorCorrupt;
+        size_t block_size = BlockSize(header);
+        if (block_size < KHeaderSize + KTrailerSize || last_block + int64_t(block_size) > aIndex.CompressedLength ||
+            iFile.Seek(last_block + int64_t(block_size) - 4,SEEK_SET) || iFile.Read(buffer,4) != 4)
+            return KErrorCorrupt;
+        uint32_t last_block_size = ReadLittleEndian32(buffer);
+        if (last_block_size > KMaxBlockSize || (last_block_size == 0 && count))
+            return KErrorCorrupt;
+        aIndex.UncompressedLength = aIndex.UncompressedOffset.back() + last_block_size;
+        return KErrorNone;
+        }
+
+    /** Builds the index by reading the header and uncompressed size of each block. */
+    Result BuildIndex(BlockIndex& aIndex)
+        {
+        aIndex.CompressedOffset.clear();
+        aIndex.UncompressedOffset.clear();
+        int64_t compressed_offset = 0;
+        int64_t uncompressed_offset = 0;
+        uint8_t header[KHeaderSize];
+        while (compressed_offset < aIndex.CompressedLength)
+            {
+            if (iFile.Seek(compressed_offset,SEEK_SET) || iFile.Read(header,KHeaderSize) != KHeaderSize)
+                return KErrorCorrupt;
+            size_t block_size = BlockSize(header);
+            if (block_size < KHeaderSize + KTrailerSize || iFile.Seek(compressed_offset + int64_t(block_size) - 4,SEEK_SET) || iFile.Read(header,4) != 4)
+                return KErrorUnknownDataFormat;
+            uint32_t uncompressed_size = ReadLittleEndian32(header);
+            if (uncompressed_size > KMaxBlockSize)
+                return KErrorCorrupt;
+            if (uncompressed_size)
+                {
+                aIndex.CompressedOffset.push_back(compressed_offset);
+                aIndex.UncompressedOffset.push_back(uncompressed_offset);
+                }
+            compressed_offset += int64_t(block_size);
+            uncompressed_offset += uncompressed_size;
+            }
+        if (aIndex.CompressedOffset.empty())
+            {
+            aIndex.CompressedOffset.push_back(0);
+            aIndex.UncompressedOffset.push_back(0);
+            }
+        aIndex.UncompressedLength = uncompressed_offset;
+        return KErrorNone;
+        }
+
+    void DecompressBlock(size_t aBlock);
+
+    std::shared_ptr<const BlockIndex> iIndex;
+    /** The number of the block held in iBlockData, or SIZE_MAX if none. */
+    size_t iBlockNumber = SIZE_MAX;
+    /** The most recently decompressed block. */
+    std::vector<uint8_t> iBlockData;
+    /** The compressed data of the most recently decompressed block. */
+    std::vector<uint8_t> iCompressedData;
+    };
+
+}
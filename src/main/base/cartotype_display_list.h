@@ -0,0 +1,358 @@
+/*
+cartotype_display_list.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_graphics_context.h>
+#include <functional>
+
+namespace CartoTypeCore
+{
+
+/** Parameters controlling how a display list is replayed. */
+class DisplayListReplayParam
+    {
+    public:
+    /** The offset in pixels added to all positions after scaling; use it to draw a part of the list, such as one tile, into a smaller bitmap. */
+    PointFP Offset;
+    /**
+    The scale applied to positions: the points of paths, the top left corners of bitmaps, clip rectangles, and glow widths and offsets.
+    Bitmaps such as labels and icons are drawn at their recorded size, and strokes were recorded as shapes, so a list
+    replayed at a scale other than 1 is not the same as the map drawn at a different resolution.
+    */
+    double Scale = 1;
+    /**
+    If not empty, a function returning the color with which to blend the paints in a group, as set by DisplayListRecorder::BeginGroup.
+    Groups are used to apply blend styles such as night mode without drawing the map again.
+    */
+    std::function<Color(uint32_t aGroup)> BlendColor;
+    };
+
+/**
+A display list is a compact record of the drawing operations used to draw a map, after the map data has been
+read, the style sheet applied, and paths transformed to pixel coordinates and clipped. It can be replayed into
+any graphics context, which does only the rasterization. Display lists are created using DisplayListRecorder.
+*/
+class DisplayList
+    {
+    public:
+    /**
+    Draws the display list into aGc, using aParam if it is non-null.
+    The graphics parameters of aGc are changed by the replayed operations.
+    */
+    void Replay(GraphicsContext& aGc,const DisplayListReplayParam* aParam = nullptr) const
+        {
+        double scale = aParam ? aParam->Scale : 1;
+        PointFP offset = aParam ? aParam->Offset : PointFP();
+        bool transform = scale != 1 || offset.X != 0 || offset.Y != 0;
+        const std::function<Color(uint32_t)>* blend = aParam && aParam->BlendColor ? &aParam->BlendColor : nullptr;
+        uint32_t group = 0;
+        const GraphicsParam* graphics_param = nullptr;
+        std::vector<OutlinePoint> transformed_point;
+
+        for (const auto& c : iCommand)
+            {
+            switch (c.iType)
+                {
+                case TCommandType::Group:
+                    group = c.iIndex;
+                    if (graphics_param && blend)
+                        SetParam(aGc,*graphics_param,scale,offset,(*blend)(group));
+                    break;
+
+                case TCommandType::Param:
+                    graphics_param = &iParam[c.iIndex];
+                    SetParam(aGc,*graphics_param,scale,offset,blend ? (*blend)(group) : KTransparentBlack);
+                    break;
+
+                case TCommandType::Glow:
+                    {
+                    const TGlow& g = iGlow[c.iIndex];
+                    CartoTypeCore::Color color = g.iColor;
+                    CartoTypeCore::Color blend_color = blend ? (*blend)(group) : KTransparentBlack;
+                    if (!blend_color.IsNull())
+                        color.Blend(blend_color);
+                    aGc.SetGlow(color,g.iWidth * scale,PointFP(g.iOffset.X * scale,g.iOffset.Y * scale));
+                    }
+                    break;
+
+                case TCommandType::Shape:
+                    {
+                    const TPath& p = iPath[c.iIndex];
+                    const TContour& last = iContour[p.iFirstContour + p.iContourCount - 1];
+                    size_t first_point = iContour[p.iFirstContour].iFirstPoint;
+                    size_t end_point = last.iFirstPoint + last.iPointCount;
+                    const OutlinePoint* point = iPoint.data() + first_point;
+                    if (transform)
+                        {
+                        transformed_point.clear();
+                        for (size_t i = first_point; i < end_point; i++)
+                            {
+                            const OutlinePoint& q = iPoint[i];
+                            transformed_point.emplace_back(int32_t(std::lround(q.X * scale + offset.X * 64)),
+                                                           int32_t(std::lround(q.Y * scale + offset.Y * 64)),q.Type);
+                            }
+                        point = transformed_point.data();
+                        }
+                    TPathView path(point,first_point,iContour.data() + p.iFirstContour,p.iContourCount);
+                    aGc.DrawShape(path);
+                    }
+                    break;
+
+                case TCommandType::Bitmap:
+                case TCommandType::MonochromeBitmap:
+                    {
+                    const TBitmap& b = iBitmap[c.iIndex];
+                    BitmapView view(b.iType,const_cast<uint8_t*>(iBitmapData.data() + b.iDataOffset),b.iWidth,b.iHeight,b.iRowBytes,b.iPalette);
+                    Point top_left(int32_t(std::lround(c.iPoint.X * scale + offset.X)),int32_t(std::lround(c.iPoint.Y * scale + offset.Y)));
+                    if (c.iType == TCommandType::Bitmap)
+                        aGc.DrawBitmap(view,top_left);
+                    else
+                        aGc.DrawBitmapMonochrome(view,top_left);
+                    }
+                    break;
+
+                case TCommandType::Clear:
+                    aGc.Clear();
+                    break;
+                }
+            }
+        }
+
+    /** Returns the number of drawing operations in the list. */
+    size_t CommandCount() const { return iCommand.size(); }
+
+    /** Returns the approximate number of bytes used by the list. */
+    size_t MemoryUsed() const
+        {
+        return iCommand.size() * sizeof(TCommand) + iParam.size() * sizeof(GraphicsParam) + iGlow.size() * sizeof(TGlow) +
+               iPath.size() * sizeof(TPath) + iContour.size() * sizeof(TContour) + iPoint.size() * sizeof(OutlinePoint) +
+               iBitmap.size() * sizeof(TBitmap) + iBitmapData.size();
+        }
+
+    /** Returns false if some operations, such as drawing textures, could not be recorded, so that replaying the list will not reproduce the map exactly. */
+    bool IsComplete() const { return iComplete; }
+
+    private:
+    friend class DisplayListRecorder;
+
+    enum class TCommandType: uint8_t
+        {
+        Group,
+        Param,
+        Glow,
+        Shape,
+        Bitmap,
+        MonochromeBitmap,
+        Clear
+        };
+
+    class TCommand
+        {
+        public:
+        TCommandType iType;
+        uint32_t iIndex;
+        Point iPoint;
+        };
+
+    class TGlow
+        {
+        public:
+        CartoTypeCore::Color iColor;
+        double iWidth;
+        PointFP iOffset;
+        };
+
+    class TContour
+        {
+        public:
+        uint32_t iFirstPoint;
+        uint32_t iPointCount;
+        bool iClosed;
+        };
+
+    class TPath
+        {
+        public:
+        uint32_t iFirstContour;
+        uint32_t iContourCount;
+        };
+
+    class TBitmap
+        {
+        public:
+        BitmapType iType;
+        uint32_t iWidth;
+        uint32_t iHeight;
+        uint32_t iRowBytes;
+        size_t iDataOffset;
+        std::shared_ptr<Palette> iPalette;
+        };
+
+    // A path referring to contours stored in the display list; aPoint is the path's first point, which is point aFirstPoint in the list.
+    class TPathView: public MPath
+        {
+        public:
+        TPathView(const OutlinePoint* aPoint,size_t aFirstPoint,const TContour* aContour,size_t aContours):
+            iPoint(aPoint),
+            iFirstPoint(aFirstPoint),
+            iContour(aContour),
+            iContours(aContours)
+            {
+            }
+        size_t Contours() const override { return iContours; }
+        ContourView ContourByIndex(size_t aIndex) const override
+            {
+            const TContour& c = iContour[aIndex];
+            return ContourView(iPoint + (c.iFirstPoint - iFirstPoint),c.iPointCount,c.iClosed);
+            }
+        bool MayHaveCurves() const override { return true; }
+
+        private:
+        const OutlinePoint* iPoint;
+        size_t iFirstPoint;
+        const TContour* iContour;
+        size_t iContours;
+        };
+
+    static void SetParam(GraphicsContext& aGc,const GraphicsParam& aParam,double aScale,const PointFP& aOffset,Color aBlendColor)
+        {
+        GraphicsParam p = aParam;
+        if (aScale != 1 || aOffset.X != 0 || aOffset.Y != 0)
+            p.Clip = Rect(int32_t(std::floor(aParam.Clip.Min.X * aScale + aOffset.X)),int32_t(std::floor(aParam.Clip.Min.Y * aScale + aOffset.Y)),
+                          int32_t(std::ceil(aParam.Clip.Max.X * aScale + aOffset.X)),int32_t(std::ceil(aParam.Clip.Max.Y * aScale + aOffset.Y)));
+        p.Paint.SetBlendColor(aBlendColor);
+        aGc.SetParam(p);
+        }
+
+    std::vector<TCommand> iCommand;
+    std::vector<GraphicsParam> iParam;
+    std::vector<TGlow> iGlow;
+    std::vector<TPath> iPath;
+    std::vector<TContour> iContour;
+    std::vector<OutlinePoint> iPoint;
+    std::vector<TBitmap> iBitmap;
+    std::vector<uint8_t> iBitmapData;
+    bool iComplete = true;
+    };
+
+/**
+A graphics context which records drawing operations in a display list instead of drawing them.
+Strokes are recorded as the filled shapes they are converted to. Graphics parameters are recorded only
+when they have changed since the previous drawing operation.
+*/
+class DisplayListRecorder: public GraphicsContext
+    {
+    public:
+    /** Creates a recorder for a drawing surface with the bounds aBounds. */
+    DisplayListRecorder(std::shared_ptr<CEngine> aEngine,const Rect& aBounds):
+        GraphicsContext(aEngine,aBounds,nullptr),
+        iDisplayList(std::make_unique<DisplayList>())
+        {
+        }
+
+    DrawResult DrawBitmap(const BitmapView& aBitmap,const Point& aTopLeft) override
+        {
+        RecordBitmap(DisplayList::TCommandType::Bitmap,aBitmap,aTopLeft);
+        return DrawResult::Success;
+        }
+
+    DrawResult DrawBitmapMonochrome(const BitmapView& aBitmap,const Point& aTopLeft) override
+        {
+        RecordBitmap(DisplayList::TCommandType::MonochromeBitmap,aBitmap,aTopLeft);
+        return DrawResult::Success;
+        }
+
+    DrawResult DrawShape(const MPath& aPath) override
+        {
+        size_t contours = aPath.Contours();
+        if (!contours)
+            return DrawResult::Success;
+        RecordParam();
+        DisplayList& d = *iDisplayList;
+        DisplayList::TPath path { uint32_t(d.iContour.size()),uint32_t(contours) };
+        for (size_t i = 0; i < contours; i++)
+            {
+            ContourView contour = aPath.ContourByIndex(i);
+            size_t points = contour.Points();
+            d.iContour.push_back(DisplayList::TContour { uint32_t(d.iPoint.size()),uint32_t(points),contour.Closed() });
+            for (size_t j = 0; j < points; j++)
+                d.iPoint.push_back(contour.Point(j));
+            }
+        d.iCommand.push_back(DisplayList::TCommand { DisplayList::TCommandType::Shape,uint32_t(d.iPath.size()),Point() });
+        d.iPath.push_back(path);
+        return DrawResult::Success;
+        }
+
+    /** Textures are owned by the graphics system that draws them and cannot be recorded; the display list is marked as incomplete. */
+    DrawResult DrawTexture(const Texture& /*aTexture*/,const PointFP& /*aTopLeft*/,const AffineTransform& /*aTransform*/) override
+        {
+        iDisplayList->iComplete = false;
+        return DrawResult::Success;
+        }
+
+    /** Records a clear operation, preceded by any changed graphics parameters, so that it is replayed with the parameters in force when it was recorded. */
+    void Clear() override
+        {
+        RecordParam();
+        iDisplayList->iCommand.push_back(DisplayList::TCommand { DisplayList::TCommandType::Clear,0,Point() });
+        }
+
+    void SetGlow(CartoTypeCore::Color aColor,double aWidth,const PointFP& aOffset) override
+        {
+        GraphicsContext::SetGlow(aColor,aWidth,aOffset);
+        DisplayList& d = *iDisplayList;
+        d.iCommand.push_back(DisplayList::TCommand { DisplayList::TCommandType::Glow,uint32_t(d.iGlow.size()),Point() });
+        d.iGlow.push_back(DisplayList::TGlow { aColor,aWidth,aOffset });
+        }
+
+    /**
+    Starts a group of drawing operations, such as those for a single style, identified by aGroup.
+    When the list is replayed the paints in each group can be blended with a different color.
+    */
+    void BeginGroup(uint32_t aGroup)
+        {
+        iDisplayList->iCommand.push_back(DisplayList::TCommand { DisplayList::TCommandType::Group,aGroup,Point() });
+        }
+
+    /** Returns the recorded display list, and starts a new empty one. */
+    std::unique_ptr<DisplayList> TakeDisplayList()
+        {
+        auto d = std::make_unique<DisplayList>();
+        std::swap(d,iDisplayList);
+        iChangeFlags = KAllChanged;
+        return d;
+        }
+
+    private:
+    void RecordParam()
+        {
+        if (!iChangeFlags)
+            return;
+        DisplayList& d = *iDisplayList;
+        d.iCommand.push_back(DisplayList::TCommand { DisplayList::TCommandType::Param,uint32_t(d.iParam.size()),Point() });
+        d.iParam.push_back(iParam);
+        iChangeFlags = 0;
+        }
+
+    void RecordBitmap(DisplayList::TCommandType aType,const BitmapView& aBitmap,const Point& aTopLeft)
+        {
+        RecordParam();
+        DisplayList& d = *iDisplayList;
+        size_t row_bytes = (size_t(aBitmap.Width()) * size_t(aBitmap.BitsPerPixel()) + 7) / 8;
+        DisplayList::TBitmap b { aBitmap.Type(),uint32_t(aBitmap.Width()),uint32_t(aBitmap.Height()),uint32_t(row_bytes),d.iBitmapData.size(),aBitmap.Palette() };
+        d.iBitmapData.resize(d.iBitmapData.size() + row_bytes * size_t(aBitmap.Height()));
+        uint8_t* dest = d.iBitmapData.data() + b.iDataOffset;
+        for (int32_t y = 0; y < aBitmap.Height(); y++, dest += row_bytes)
+            memcpy(dest,aBitmap.Data() + size_t(y) * aBitmap.RowBytes(),row_bytes);
+        d.iCommand.push_back(DisplayList::TCommand { aType,uint32_t(d.iBitmap.size()),aTopLeft });
+        d.iBitmap.push_back(b);
+        }
+
+    std::unique_ptr<DisplayList> iDisplayList;
+    };
+
+}
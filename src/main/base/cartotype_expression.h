@@ -288,6 +288,7 @@ class VariableDictionary: public MVariableDictionary
             iDictionary.erase(aVariableName);
         }
     template<typename Functor> void Apply(Functor& aFunctor) { for (auto& p : iDictionary) { aFunctor(p.first,p.second); } }
+    template<typename Functor> void Apply(Functor& aFunctor) const { for (const auto& p : iDictionary) { aFunctor(p.first,p.second); } }
 
     private:
     StringDictionary iDictionary;
@@ -741,6 +741,41 @@ class MLabelHandler
     virtual void operator()(const BitmapView& aLabelBitmap,const Point& aTopLeft,const Point& aHotSpot) = 0;
     };
 
+/** A label in a batch passed to an MLabelBatchHandler. */
+class LabelBatchItem
+    {
+    public:
+    /**
+    An identifier for the label's image, which is the same in every batch as long as the image is unchanged and stays in the atlas.
+    Different images have different identifiers, and identifiers are not reused.
+    */
+    uint64_t Id = 0;
+    /** The position of the label's image in the atlas bitmap, in pixels. */
+    Rect AtlasRect;
+    /** The position at which the top left corner of the label is to be drawn. */
+    Point TopLeft;
+    /** The position with which the label is associated. */
+    Point HotSpot;
+    /** True if the label's image was written to the atlas for this batch; false if it is unchanged since the previous batch. */
+    bool Changed = true;
+    };
+
+/**
+A functor class to handle all the labels of a frame together, packed into a single 32bpp RGBA atlas bitmap.
+It allows GPU-based clients to upload one texture per frame instead of one per label, and to skip labels that have not changed.
+*/
+class MLabelBatchHandler
+    {
+    public:
+    virtual ~MLabelBatchHandler() { }
+    /**
+    Handles the labels aLabels, whose images are in aAtlas. If aAtlasReset is true the whole atlas has been rewritten,
+    and any copy of it must be replaced; otherwise only the areas of labels marked as changed need to be updated.
+    The atlas normally holds all the labels of a frame; if they do not fit, the handler is called more than once for the frame.
+    */
+    virtual void operator()(const BitmapView& aAtlas,const std::vector<LabelBatchItem>& aLabels,bool aAtlasReset) = 0;
+    };
+
 /**
 Tile bitmap parameters are used in the various tile drawing functions to control
 whether map objects and labels are drawn, and whether labels are passed to an external handler.
@@ -0,0 +1,219 @@
+/*
+cartotype_label_batch.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_graphics_context.h>
+#include <unordered_map>
+#include <vector>
+
+namespace CartoTypeCore
+{
+
+/**
+A label handler which packs the labels of a frame into an atlas bitmap and passes them to an MLabelBatchHandler
+in a single call.
+
+The atlas is kept from frame to frame. A label whose image was in an earlier frame keeps its place in the atlas
+and is not copied again, so a client only needs to update the areas of the labels marked as changed.
+Images are found using a hash of their pixels, and a match is confirmed by comparing the pixels with the atlas.
+Space is allocated in rows ('shelves') and is not reused until the atlas is full, when it is cleared and refilled.
+Labels which cannot be put in the atlas, because they are larger than it, are passed to the fallback handler, if any.
+*/
+class LabelBatcher: public MLabelHandler
+    {
+    public:
+    /**
+    Creates a label batcher passing labels to aHandler, using an atlas of aAtlasWidth x aAtlasHeight pixels.
+    Labels which do not fit the atlas are passed to aFallbackHandler if it is non-null, otherwise they are ignored.
+    */
+    LabelBatcher(MLabelBatchHandler& aHandler,int32_t aAtlasWidth = 2048,int32_t aAtlasHeight = 2048,MLabelHandler* aFallbackHandler = nullptr):
+        iHandler(aHandler),
+        iFallbackHandler(aFallbackHandler),
+        iAtlas(BitmapType::RGBA32,aAtlasWidth,aAtlasHeight)
+        {
+        iAtlas.Clear();
+        }
+
+    /** Adds a label to the current frame. */
+    void operator()(const BitmapView& aLabelBitmap,const Point& aTopLeft,const Point& aHotSpot) override
+        {
+        if (aLabelBitmap.Width() <= 0 || aLabelBitmap.Height() <= 0)
+            return;
+
+        LabelBatchItem item;
+        item.TopLeft = aTopLeft;
+        item.HotSpot = aHotSpot;
+        uint64_t hash = Hash(aLabelBitmap);
+        std::vector<TSlot>& slots = iSlot[hash];
+        const TSlot* slot = nullptr;
+        for (const auto& s : slots)
+            if (Equal(aLabelBitmap,s.iRect))
+                {
+                slot = &s;
+                break;
+                }
+        if (slot)
+            {
+            item.Id = slot->iId;
+            item.AtlasRect = slot->iRect;
+            item.Changed = false;
+            }
+        else
+            {
+            if (!Allocate(aLabelBitmap.Width(),aLabelBitmap.Height(),item.AtlasRect))
+                {
+                // The atlas is full: pass on the labels so far, then start again with an empty atlas.
+                // A label which does not fit even an empty atlas is passed to the fallback handler.
+                if (aLabelBitmap.Width() > iAtlas.Width() || aLabelBitmap.Height() > iAtlas.Height())
+                    {
+                    if (iFallbackHandler)
+                        (*iFallbackHandler)(aLabelBitmap,aTopLeft,aHotSpot);
+                    return;
+                    }
+                if (!iItem.empty())
+                    Flush();
+                Reset();
+                if (!Allocate(aLabelBitmap.Width(),aLabelBitmap.Height(),item.AtlasRect))
+                    {
+                    if (iFallbackHandler)
+                        (*iFallbackHandler)(aLabelBitmap,aTopLeft,aHotSpot);
+                    return;
+                    }
+                }
+            Copy(aLabelBitmap,item.AtlasRect);
+            item.Id = ++iLastId;
+            iSlot[hash].push_back(TSlot { item.Id,item.AtlasRect });
+            }
+        iItem.push_back(item);
+        }
+
+    /** Passes the labels added since the last call to the handler. Call this at the end of each frame. */
+    void Flush()
+        {
+        iHandler(iAtlas,iItem,iAtlasReset);
+        iItem.clear();
+        iAtlasReset = false;
+        }
+
+    /** Clears the atlas so that every label is copied into it again. */
+    void Reset()
+        {
+        iAtlas.Clear();
+        iSlot.clear();
+        iShelf.clear();
+        iUsedHeight = 0;
+        iAtlasReset = true;
+        }
+
+    private:
+    class TShelf
+        {
+        public:
+        int32_t iY;
+        int32_t iHeight;
+        int32_t iUsedWidth;
+        };
+
+    class TSlot
+        {
+        public:
+        uint64_t iId;
+        Rect iRect;
+        };
+
+    bool Allocate(int32_t aWidth,int32_t aHeight,Rect& aRect)
+        {
+        if (aWidth > iAtlas.Width())
+            return false;
+        for (auto& shelf : iShelf)
+            {
+            if (aHeight <= shelf.iHeight && aHeight * 4 >= shelf.iHeight * 3 && shelf.iUsedWidth + aWidth <= iAtlas.Width())
+                {
+                aRect = Rect(shelf.iUsedWidth,shelf.iY,shelf.iUsedWidth + aWidth,shelf.iY + aHeight);
+                shelf.iUsedWidth += aWidth;
+                return true;
+                }
+            }
+        if (iUsedHeight + aHeight > iAtlas.Height())
+            return false;
+        iShelf.push_back(TShelf { iUsedHeight,aHeight,aWidth });
+        aRect = Rect(0,iUsedHeight,aWidth,iUsedHeight + aHeight);
+        iUsedHeight += aHeight;
+        return true;
+        }
+
+    // Converts row aY of aLabelBitmap to RGBA32, returning a pointer to the converted row, which may be in iRow.
+    const uint8_t* Row(const BitmapView& aLabelBitmap,int32_t aY)
+        {
+        const uint8_t* source = aLabelBitmap.Data() + size_t(aY) * aLabelBitmap.RowBytes();
+        if (aLabelBitmap.Type() == BitmapType::RGBA32)
+            return source;
+        iRow.resize(size_t(aLabelBitmap.Width()));
+        aLabelBitmap.ReadRow(uint32_t(aY),iRow.data());
+        return (const uint8_t*)iRow.data();
+        }
+
+    uint8_t* AtlasRow(const Rect& aRect,int32_t aY)
+        {
+        return iAtlas.Data() + size_t(aRect.Min.Y + aY) * iAtlas.RowBytes() + size_t(aRect.Min.X) * 4;
+        }
+
+    void Copy(const BitmapView& aLabelBitmap,const Rect& aRect)
+        {
+        size_t row_bytes = size_t(aLabelBitmap.Width()) * 4;
+        for (int32_t y = 0; y < aLabelBitmap.Height(); y++)
+            memcpy(AtlasRow(aRect,y),Row(aLabelBitmap,y),row_bytes);
+        }
+
+    // Returns true if the image in the atlas at aRect is the same as aLabelBitmap.
+    bool Equal(const BitmapView& aLabelBitmap,const Rect& aRect)
+        {
+        if (aRect.Width() != aLabelBitmap.Width() || aRect.Height() != aLabelBitmap.Height())
+            return false;
+        size_t row_bytes = size_t(aLabelBitmap.Width()) * 4;
+        for (int32_t y = 0; y < aLabelBitmap.Height(); y++)
+            if (memcmp(AtlasRow(aRect,y),Row(aLabelBitmap,y),row_bytes))
+                return false;
+        return true;
+        }
+
+    // A fast hash of the label image, taking eight bytes at a time.
+    static uint64_t Hash(const BitmapView& aLabelBitmap)
+        {
+        const uint64_t k = 0x9E3779B97F4A7C15ULL;
+        uint64_t h = (uint64_t(aLabelBitmap.Width()) << 32 | uint32_t(aLabelBitmap.Height())) * k ^ uint64_t(aLabelBitmap.Type());
+        size_t row_length = (size_t(aLabelBitmap.Width()) * size_t(aLabelBitmap.BitsPerPixel()) + 7) / 8;
+        for (int32_t y = 0; y < aLabelBitmap.Height(); y++)
+            {
+            const uint8_t* p = aLabelBitmap.Data() + size_t(y) * aLabelBitmap.RowBytes();
+            size_t i = 0;
+            for (; i + 8 <= row_length; i += 8)
+                {
+                uint64_t word;
+                memcpy(&word,p + i,8);
+                h = (h ^ word) * k;
+                h ^= h >> 29;
+                }
+            for (; i < row_length; i++)
+                h = (h ^ p[i]) * k;
+            }
+        return h ^ (h >> 32);
+        }
+
+    MLabelBatchHandler& iHandler;
+    MLabelHandler* iFallbackHandler;
+    Bitmap iAtlas;
+    std::vector<LabelBatchItem> iItem;
+    std::unordered_map<uint64_t,std::vector<TSlot>> iSlot;
+    std::vector<TShelf> iShelf;
+    std::vector<uint32_t> iRow;
+    int32_t iUsedHeight = 0;
+    uint64_t iLastId = 0;
+    bool iAtlasReset = true;
+    };
+
+}
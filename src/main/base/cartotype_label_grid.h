@@ -0,0 +1,285 @@
+/*
+cartotype_label_grid.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_base.h>
+#include <unordered_map>
+#include <vector>
+
+namespace CartoTypeCore
+{
+
+/**
+A uniform grid over the placed label boxes in a map image, used to find whether a new label overlaps any label already placed.
+
+Each cell records the boxes overlapping it, and also an occupancy mask: a 64-bit mask of the 8 x 8 blocks
+of the cell touched by any of those boxes. If a candidate's mask for a cell does not share any blocks with the
+cell's mask, the boxes in that cell are not tested; only when the masks share a block are the boxes compared.
+Clearing the grid keeps its memory, so one grid can be reused for every frame.
+*/
+class LabelCollisionGrid
+    {
+    public:
+    /** Creates a grid covering an area of aWidth x aHeight pixels, using square cells of aCellSize pixels, rounded up to a power of two of at least 8. */
+    LabelCollisionGrid(int32_t aWidth = 0,int32_t aHeight = 0,int32_t aCellSize = 64)
+        {
+        SetSize(aWidth,aHeight,aCellSize);
+        }
+
+    /** Changes the area covered by the grid and removes all the boxes. */
+    void SetSize(int32_t aWidth,int32_t aHeight,int32_t aCellSize = 64)
+        {
+        iBlockShift = 0;
+        while ((8 << iBlockShift) < aCellSize)
+            iBlockShift++;
+        iCellSize = 8 << iBlockShift;
+        iWidth = std::max(aWidth,0);
+        iHeight = std::max(aHeight,0);
+        iColumns = (std::max(aWidth,0) + iCellSize - 1) / iCellSize;
+        iRows = (std::max(aHeight,0) + iCellSize - 1) / iCellSize;
+        iCell.clear();
+        iCell.resize(size_t(iColumns) * size_t(iRows));
+        iUsedCell.clear();
+        iBox.clear();
+        }
+
+    /**
+    Returns true if aBox overlaps any box in the grid inside the area covered by the grid.
+    Boxes which merely touch do not overlap.
+    */
+    bool Intersects(const Rect& aBox) const
+        {
+        int32_t c0,r0,c1,r1;
+        if (!CellRange(aBox,c0,r0,c1,r1))
+            return false;
+        for (int32_t r = r0; r <= r1; r++)
+            for (int32_t c = c0; c <= c1; c++)
+                {
+                const TCell& cell = iCell[size_t(r) * size_t(iColumns) + size_t(c)];
+                if (!(cell.iMask & Mask(aBox,c,r)))
+                    continue;
+                for (uint32_t index : cell.iBox)
+                    {
+                    const Rect& b = iBox[index];
+                    if (b.Min.X < aBox.Max.X && aBox.Min.X < b.Max.X && b.Min.Y < aBox.Max.Y && aBox.Min.Y < b.Max.Y)
+                        return true;
+                    }
+                }
+        return false;
+        }
+
+    /** Adds aBox to the grid. Boxes entirely outside the area covered by the grid are ignored. */
+    void Insert(const Rect& aBox)
+        {
+        int32_t c0,r0,c1,r1;
+        if (!CellRange(aBox,c0,r0,c1,r1))
+            return;
+        uint32_t index = uint32_t(iBox.size());
+        iBox.push_back(aBox);
+        for (int32_t r = r0; r <= r1; r++)
+            for (int32_t c = c0; c <= c1; c++)
+                {
+                size_t cell_index = size_t(r) * size_t(iColumns) + size_t(c);
+                TCell& cell = iCell[cell_index];
+                if (cell.iBox.empty())
+                    iUsedCell.push_back(uint32_t(cell_index));
+                cell.iMask |= Mask(aBox,c,r);
+                cell.iBox.push_back(index);
+                }
+        }
+
+    /** Adds aBox to the grid and returns true if it does not overlap any box already in the grid, otherwise returns false. */
+    bool InsertIfClear(const Rect& aBox)
+        {
+        if (Intersects(aBox))
+            return false;
+        Insert(aBox);
+        return true;
+        }
+
+    /** Removes all the boxes, keeping the memory allocated for them. Only the cells that were used are visited. */
+    void Clear()
+        {
+        for (uint32_t index : iUsedCell)
+            {
+            iCell[index].iMask = 0;
+            iCell[index].iBox.clear();
+            }
+        iUsedCell.clear();
+        iBox.clear();
+        }
+
+    /** Returns the number of boxes in the grid. */
+    size_t Count() const { return iBox.size(); }
+
+    private:
+    class TCell
+        {
+        public:
+        uint64_t iMask = 0;
+        std::vector<uint32_t> iBox;
+        };
+
+    bool CellRange(const Rect& aBox,int32_t& aC0,int32_t& aR0,int32_t& aC1,int32_t& aR1) const
+        {
+        // Clip the box to the area covered by the grid. Two boxes which both overlap that area, and overlap each other,
+        // overlap each other inside it, so overlaps outside the area are never reported.
+        int32_t min_x = std::max(aBox.Min.X,0);
+        int32_t min_y = std::max(aBox.Min.Y,0);
+        int32_t max_x = std::min(aBox.Max.X,iWidth);
+        int32_t max_y = std::min(aBox.Max.Y,iHeight);
+        if (min_x >= max_x || min_y >= max_y)
+            return false;
+        aC0 = min_x / iCellSize;
+        aR0 = min_y / iCellSize;
+        aC1 = (max_x - 1) / iCellSize;
+        aR1 = (max_y - 1) / iCellSize;
+        return true;
+        }
+
+    // Returns the mask of the blocks of the cell at column aC and row aR touched by aBox.
+    uint64_t Mask(const Rect& aBox,int32_t aC,int32_t aR) const
+        {
+        int32_t x = aC * iCellSize;
+        int32_t y = aR * iCellSize;
+        int32_t b0 = (std::max(aBox.Min.X,x) - x) >> iBlockShift;
+        int32_t b1 = (std::min(aBox.Max.X,x + iCellSize) - 1 - x) >> iBlockShift;
+        int32_t l0 = (std::max(aBox.Min.Y,y) - y) >> iBlockShift;
+        int32_t l1 = (std::min(aBox.Max.Y,y + iCellSize) - 1 - y) >> iBlockShift;
+        uint64_t row = ((uint64_t(1) << (b1 - b0 + 1)) - 1) << b0;
+        uint64_t mask = 0;
+        for (int32_t l = l0; l <= l1; l++)
+            mask |= row << (8 * l);
+        return mask;
+        }
+
+    int32_t iCellSize = 64;
+    int32_t iBlockShift = 3;
+    int32_t iWidth = 0;
+    int32_t iHeight = 0;
+    int32_t iColumns = 0;
+    int32_t iRows = 0;
+    std::vector<TCell> iCell;
+    std::vector<uint32_t> iUsedCell;
+    std::vector<Rect> iBox;
+    };
+
+/**
+Places labels for successive frames, optionally reusing the placements from the previous frame.
+
+Labels are offered in priority order by calling Place with an identifier that is the same for the same
+label in every frame. In incremental mode, a label that was placed wholly inside the previous frame and whose box
+has only moved by the offset passed to BeginFrame (as after Pan) is known not to overlap any other such label,
+so it is tested only against the labels placed in this frame that were not carried over. Labels which were partly
+outside the previous frame are not carried over, because overlaps outside the grid are not detected, and could come
+into view after a pan. Labels whose boxes changed,
+as after Zoom or Rotate, and new labels are tested against everything.
+The labels placed are the same as in non-incremental mode; incremental mode only saves some of the overlap tests.
+*/
+class LabelPlacer
+    {
+    public:
+    /** Counts of the labels handled in the current frame. */
+    class Statistics
+        {
+        public:
+        /** The number of labels offered. */
+        size_t Candidates = 0;
+        /** The number of labels placed. */
+        size_t Placed = 0;
+        /** The number of labels placed again after being tested only against labels new to this frame. */
+        size_t Retained = 0;
+        };
+
+    /** Creates a label placer for a map of aWidth x aHeight pixels. */
+    LabelPlacer(int32_t aWidth = 0,int32_t aHeight = 0,int32_t aCellSize = 64):
+        iWidth(aWidth),
+        iHeight(aHeight),
+        iCellSize(aCellSize),
+        iRetainedGrid(aWidth,aHeight,aCellSize),
+        iNewGrid(aWidth,aHeight,aCellSize)
+        {
+        }
+
+    /**
+    Starts a new frame of aWidth x aHeight pixels. If aIncremental is true and the size is unchanged,
+    the previous frame's placements, moved by aOffset, can be reused; otherwise they are discarded.
+    */
+    void BeginFrame(int32_t aWidth,int32_t aHeight,bool aIncremental,const Point& aOffset = Point())
+        {
+        if (aWidth != iWidth || aHeight != iHeight)
+            {
+            iWidth = aWidth;
+            iHeight = aHeight;
+            iRetainedGrid.SetSize(aWidth,aHeight,iCellSize);
+            iNewGrid.SetSize(aWidth,aHeight,iCellSize);
+            aIncremental = false;
+            }
+        else
+            {
+            iRetainedGrid.Clear();
+            iNewGrid.Clear();
+            }
+        iPrevious.swap(iCurrent);
+        iCurrent.clear();
+        if (!aIncremental)
+            iPrevious.clear();
+        iOffset = aOffset;
+        iStatistics = Statistics();
+        }
+
+    /**
+    Places the label aId with the box aBox if it does not overlap any label already placed in this frame.
+    Returns true if the label was placed.
+    */
+    bool Place(uint64_t aId,const Rect& aBox)
+        {
+        iStatistics.Candidates++;
+        bool placed = false;
+        auto p = iPrevious.find(aId);
+        if (p != iPrevious.end() &&
+            p->second.Min.X >= 0 && p->second.Min.Y >= 0 && p->second.Max.X <= iWidth && p->second.Max.Y <= iHeight &&
+            p->second.Min.X + iOffset.X == aBox.Min.X && p->second.Min.Y + iOffset.Y == aBox.Min.Y &&
+            p->second.Max.X + iOffset.X == aBox.Max.X && p->second.Max.Y + iOffset.Y == aBox.Max.Y)
+            {
+            if (!iNewGrid.Intersects(aBox))
+                {
+                iRetainedGrid.Insert(aBox);
+                iStatistics.Retained++;
+                placed = true;
+                }
+            }
+        else if (!iRetainedGrid.Intersects(aBox))
+            placed = iNewGrid.InsertIfClear(aBox);
+
+        if (placed)
+            {
+            iCurrent[aId] = aBox;
+            iStatistics.Placed++;
+            }
+        return placed;
+        }
+
+    /** Returns true if aBox does not overlap any label placed in this frame. */
+    bool IsClear(const Rect& aBox) const { return !iRetainedGrid.Intersects(aBox) && !iNewGrid.Intersects(aBox); }
+
+    /** Returns counts of the labels handled in the current frame. */
+    const Statistics& FrameStatistics() const { return iStatistics; }
+
+    private:
+    int32_t iWidth;
+    int32_t iHeight;
+    int32_t iCellSize;
+    LabelCollisionGrid iRetainedGrid;
+    LabelCollisionGrid iNewGrid;
+    std::unordered_map<uint64_t,Rect> iPrevious;
+    std::unordered_map<uint64_t,Rect> iCurrent;
+    Point iOffset;
+    Statistics iStatistics;
+    };
+
+}
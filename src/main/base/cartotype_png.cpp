@@ -0,0 +1,144 @@
+/*
+cartotype_png.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#include <cartotype.h>
+#include <cartotype_png.h>
+#include <zlib.h>
+
+namespace CartoTypeCore
+{
+
+void PngEncoder::Encode(MOutputStream& aOutput)
+    {
+    ChooseFormat();
+    iRowBytes = iWidth * iBytesPerPixel;
+    size_t rows_per_chunk = std::max(size_t(1),iParam.ChunkSize / (iRowBytes + 1));
+    size_t chunk_count = (iHeight + rows_per_chunk - 1) / rows_per_chunk;
+
+    std::unique_ptr<ThreadPool> own_pool;
+    ThreadPool* pool = iParam.Pool;
+    if (!pool && chunk_count > 1 && iParam.ThreadCount != 1)
+        {
+        own_pool = std::make_unique<ThreadPool>(std::min(iParam.ThreadCount ? iParam.ThreadCount : size_t(std::thread::hardware_concurrency()),chunk_count));
+        pool = own_pool.get();
+        }
+    // A task running on the pool cannot wait for other tasks on it, so it encodes on its own thread.
+    if (pool && pool->IsWorkerThread())
+        pool = nullptr;
+
+    WriteHeader(aOutput);
+
+    // The zlib header for the deflate method with a 32Kb window; the check bits make it a multiple of 31.
+    uint8_t zlib_header[2] = { 0x78,0 };
+    zlib_header[1] = uint8_t(LevelFlags() << 6);
+    zlib_header[1] = uint8_t(zlib_header[1] + 31 - (zlib_header[0] * 256 + zlib_header[1]) % 31);
+
+    uLong adler = adler32(0,nullptr,0);
+    size_t batch_size = pool ? pool->ThreadCount() * 2 : 1;
+    std::vector<TChunk> batch;
+    for (size_t first_chunk = 0; first_chunk < chunk_count; first_chunk += batch_size)
+        {
+        batch.resize(std::min(batch_size,chunk_count - first_chunk));
+        for (size_t i = 0; i < batch.size(); i++)
+            {
+            batch[i].iFirstRow = (first_chunk + i) * rows_per_chunk;
+            batch[i].iEndRow = std::min(iHeight,batch[i].iFirstRow + rows_per_chunk);
+            }
+        if (pool)
+            {
+            TaskGroup group(*pool);
+            for (auto& chunk : batch)
+                {
+                TChunk* c = &chunk;
+                group.Submit([this,c](size_t) { Compress(*c); });
+                }
+            group.Wait();
+            }
+        else
+            {
+            for (auto& chunk : batch)
+                Compress(chunk);
+            }
+
+        for (auto& chunk : batch)
+            {
+            size_t length = (chunk.iEndRow - chunk.iFirstRow) * (iRowBytes + 1);
+            adler = adler32_combine(adler,chunk.iAdler,z_off_t(length));
+            std::vector<uint8_t>& data = chunk.iCompressedData;
+            if (chunk.iFirstRow == 0)
+                data.insert(data.begin(),zlib_header,zlib_header + 2);
+            if (chunk.iEndRow == iHeight)
+                {
+                uint8_t trailer[4];
+                WriteBigEndian32(trailer,uint32_t(adler));
+                data.insert(data.end(),trailer,trailer + 4);
+                }
+            WriteChunk(aOutput,"IDAT",data.data(),data.size());
+            }
+        }
+    WriteChunk(aOutput,"IEND",nullptr,0);
+    }
+
+void PngEncoder::Compress(TChunk& aChunk) const
+    {
+    // Filter the rows of the chunk, preceded by the rows making up its dictionary.
+    const size_t filtered_row_bytes = iRowBytes + 1;
+    size_t dictionary_rows = std::min(aChunk.iFirstRow,(KDictionarySize + filtered_row_bytes - 1) / filtered_row_bytes);
+    size_t first_row = aChunk.iFirstRow - dictionary_rows;
+    std::vector<uint8_t> filtered((aChunk.iEndRow - first_row) * filtered_row_bytes);
+    TRowBuffers buffers(iWidth,iRowBytes);
+    if (first_row)
+        ConvertRow(first_row - 1,buffers,buffers.iPrevRow.data());
+    for (size_t y = first_row; y < aChunk.iEndRow; y++)
+        {
+        ConvertRow(y,buffers,buffers.iRow.data());
+        FilterRow(buffers.iRow.data(),buffers.iPrevRow.data(),buffers,filtered.data() + (y - first_row) * filtered_row_bytes);
+        std::swap(buffers.iRow,buffers.iPrevRow);
+        }
+
+    size_t start = dictionary_rows * filtered_row_bytes;
+    size_t length = filtered.size() - start;
+    bool last = aChunk.iEndRow == iHeight;
+    aChunk.iAdler = uint32_t(adler32(adler32(0,nullptr,0),filtered.data() + start,uInt(length)));
+
+    z_stream z = { };
+    if (deflateInit2(&z,std::clamp(iParam.CompressionLevel,0,9),Z_DEFLATED,-MAX_WBITS,8,iPalettized ? Z_DEFAULT_STRATEGY : Z_FILTERED) != Z_OK)
+        throw KErrorNoMemory;
+    if (start)
+        {
+        size_t dictionary_length = std::min(start,KDictionarySize);
+        deflateSetDictionary(&z,filtered.data() + start - dictionary_length,uInt(dictionary_length));
+        }
+    aChunk.iCompressedData.resize(deflateBound(&z,uLong(length)) + 16);
+    z.next_in = filtered.data() + start;
+    z.avail_in = uInt(length);
+    z.next_out = aChunk.iCompressedData.data();
+    z.avail_out = uInt(aChunk.iCompressedData.size());
+    int status = deflate(&z,last ? Z_FINISH : Z_SYNC_FLUSH);
+    bool ok = status == (last ? Z_STREAM_END : Z_OK) && z.avail_in == 0;
+    aChunk.iCompressedData.resize(z.total_out);
+    deflateEnd(&z);
+    if (!ok)
+        throw KErrorGeneral;
+    }
+
+void PngEncoder::WriteChunk(MOutputStream& aOutput,const char* aType,const uint8_t* aData,size_t aLength)
+    {
+    uint8_t header[8];
+    WriteBigEndian32(header,uint32_t(aLength));
+    memcpy(header + 4,aType,4);
+    aOutput.Write(header,8);
+    if (aLength)
+        aOutput.Write(aData,aLength);
+    uLong crc = crc32(crc32(0,nullptr,0),header + 4,4);
+    if (aLength)
+        crc = crc32(crc,aData,uInt(aLength));
+    uint8_t trailer[4];
+    WriteBigEndian32(trailer,uint32_t(crc));
+    aOutput.Write(trailer,4);
+    }
+
+}
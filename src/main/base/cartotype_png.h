@@ -0,0 +1,371 @@
+/*
+cartotype_png.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_bitmap.h>
+#include <cartotype_thread_pool.h>
+#include <algorithm>
+
+namespace CartoTypeCore
+{
+
+/** Parameters controlling the way PngEncoder writes a bitmap. */
+class PngEncoderParam
+    {
+    public:
+    /** The zlib compression level, from 0 (no compression, fastest) to 9 (best compression, slowest). */
+    int32_t CompressionLevel = 6;
+    /**
+    If true, the image is reduced to a fixed palette of 252 colors, a 6 x 7 x 6 color cube, and a transparent color,
+    which is much faster than finding an optimal palette. Pixels less than half opaque become transparent.
+    */
+    bool FastPalettize = false;
+    /**
+    The number of threads used to filter and compress the image. If it is zero, the number of hardware threads is used.
+    Ignored if Pool is non-null.
+    */
+    size_t ThreadCount = 0;
+    /** If non-null, a thread pool used instead of creating threads, which saves the cost of starting them for each image. */
+    ThreadPool* Pool = nullptr;
+    /** The approximate number of bytes of filtered image data compressed as a unit by each thread. */
+    size_t ChunkSize = 128 * 1024;
+    };
+
+/**
+A PNG encoder which filters and compresses the image in parallel.
+
+Each row is filtered using whichever of the None, Sub, Up and Paeth filters gives the smallest sum of
+absolute differences. The rows are divided into chunks, which are converted, filtered and compressed
+independently on separate threads, in the same way as pigz: each chunk is primed with the previous 32Kb of
+filtered data as its dictionary and ends with a sync flush, so that the compressed chunks can be concatenated
+into a single zlib stream. A chunk filters the rows making up its dictionary again rather than waiting for the
+previous chunk. Chunks are compressed a few at a time for each thread and written as they are finished, so
+memory use depends on the number of threads and the chunk size, not on the size of the image.
+Opaque images are written without an alpha channel.
+
+BitmapView::WritePng, which is part of the library, does not use this class. Programs using this class must
+compile cartotype_png.cpp and link with zlib.
+*/
+class PngEncoder
+    {
+    public:
+    /** Writes aBitmap in PNG format to aOutput. */
+    static Result Write(MOutputStream& aOutput,const BitmapView& aBitmap,const PngEncoderParam& aParam = PngEncoderParam())
+        {
+        if (aBitmap.Width() <= 0 || aBitmap.Height() <= 0)
+            return KErrorInvalidArgument;
+        try
+            {
+            PngEncoder encoder(aBitmap,aParam);
+            encoder.Encode(aOutput);
+            return KErrorNone;
+            }
+        catch (Result error)
+            {
+            return error;
+            }
+        catch (std::bad_alloc&)
+            {
+            return KErrorNoMemory;
+            }
+        }
+
+    private:
+    PngEncoder(const BitmapView& aBitmap,const PngEncoderParam& aParam):
+        iBitmap(aBitmap),
+        iParam(aParam),
+        iWidth(size_t(aBitmap.Width())),
+        iHeight(size_t(aBitmap.Height()))
+        {
+        }
+
+    enum class TFilter: uint8_t
+        {
+        None = 0,
+        Sub = 1,
+        Up = 2,
+        Paeth = 4
+        };
+
+    class TChunk
+        {
+        public:
+        size_t iFirstRow = 0;
+        size_t iEndRow = 0;
+        std::vector<uint8_t> iCompressedData;
+        uint32_t iAdler = 1;
+        };
+
+    /** Buffers used by one thread to convert and filter rows. */
+    class TRowBuffers
+        {
+        public:
+        explicit TRowBuffers(size_t aWidth,size_t aRowBytes):
+            iPixel(aWidth),
+            iRow(aRowBytes),
+            iPrevRow(aRowBytes)
+            {
+            for (auto& c : iCandidate)
+                c.resize(aRowBytes);
+            }
+
+        std::vector<uint32_t> iPixel;
+        std::vector<uint8_t> iRow;
+        std::vector<uint8_t> iPrevRow;
+        std::vector<uint8_t> iCandidate[4];
+        };
+
+    /** Writes the whole PNG file to aOutput. Throws an error code on failure. */
+    void Encode(MOutputStream& aOutput);
+
+    // Reads the bitmap once to decide whether it needs an alpha channel, or, for a palette image, a transparent color.
+    void ChooseFormat()
+        {
+        bool opaque = true;
+        std::vector<uint32_t> pixel(iWidth);
+        for (size_t y = 0; y < iHeight && (opaque || (iParam.FastPalettize && !iHasTransparency)); y++)
+            {
+            iBitmap.ReadRow(uint32_t(y),pixel.data());
+            for (uint32_t p : pixel)
+                {
+                if ((p >> 24) != 0xFF)
+                    opaque = false;
+                if ((p >> 24) < 128)
+                    iHasTransparency = true;
+                }
+            }
+        iOpaque = opaque;
+        if (iParam.FastPalettize)
+            {
+            iPalettized = true;
+            iBytesPerPixel = 1;
+            }
+        else
+            iBytesPerPixel = opaque ? 3 : 4;
+        }
+
+    void WriteHeader(MOutputStream& aOutput) const
+        {
+        static const uint8_t signature[8] = { 0x89,'P','N','G','\r','\n',0x1A,'\n' };
+        aOutput.Write(signature,sizeof(signature));
+
+        uint8_t header[13];
+        WriteBigEndian32(header,uint32_t(iWidth));
+        WriteBigEndian32(header + 4,uint32_t(iHeight));
+        header[8] = 8;
+        header[9] = iPalettized ? 3 : (iBytesPerPixel == 4 ? 6 : 2);
+        header[10] = header[11] = header[12] = 0;
+        WriteChunk(aOutput,"IHDR",header,sizeof(header));
+
+        if (iPalettized)
+            {
+            std::vector<uint8_t> palette;
+            for (uint32_t r = 0; r < 6; r++)
+                for (uint32_t g = 0; g < 7; g++)
+                    for (uint32_t b = 0; b < 6; b++)
+                        {
+                        palette.push_back(uint8_t(r * 255 / 5));
+                        palette.push_back(uint8_t(g * 255 / 6));
+                        palette.push_back(uint8_t(b * 255 / 5));
+                        }
+            palette.insert(palette.end(),3,0);
+            WriteChunk(aOutput,"PLTE",palette.data(),palette.size());
+            if (iHasTransparency)
+                {
+                std::vector<uint8_t> transparency(KTransparentIndex + 1,0xFF);
+                transparency[KTransparentIndex] = 0;
+                WriteChunk(aOutput,"tRNS",transparency.data(),transparency.size());
+                }
+            }
+        }
+
+    // Converts row aY of the bitmap to straight (not premultiplied) RGBA, RGB, or fast palette indexes in aOut.
+    void ConvertRow(size_t aY,TRowBuffers& aBuffers,uint8_t* aOut) const
+        {
+        uint32_t* pixel = aBuffers.iPixel.data();
+        iBitmap.ReadRow(uint32_t(aY),pixel);
+        if (!iOpaque)
+            BitmapView::Unpremultiply(pixel,iWidth);
+
+        if (iPalettized)
+            {
+            for (size_t i = 0; i < iWidth; i++)
+                {
+                uint32_t p = pixel[i];
+                if ((p >> 24) < 128)
+                    aOut[i] = KTransparentIndex;
+                else
+                    {
+                    uint32_t r = ((p & 0xFF) * 5 + 127) / 255;
+                    uint32_t g = (((p >> 8) & 0xFF) * 6 + 127) / 255;
+                    uint32_t b = (((p >> 16) & 0xFF) * 5 + 127) / 255;
+                    aOut[i] = uint8_t((r * 7 + g) * 6 + b);
+                    }
+                }
+            return;
+            }
+
+        uint8_t* q = aOut;
+        for (size_t i = 0; i < iWidth; i++)
+            {
+            uint32_t p = pixel[i];
+            *q++ = uint8_t(p);
+            *q++ = uint8_t(p >> 8);
+            *q++ = uint8_t(p >> 16);
+            if (iBytesPerPixel == 4)
+                *q++ = uint8_t(p >> 24);
+            }
+        }
+
+    // Writes the filter type and filtered data for the row aRow, whose predecessor is aPrev, to aOut.
+    void FilterRow(const uint8_t* aRow,const uint8_t* aPrev,TRowBuffers& aBuffers,uint8_t* aOut) const
+        {
+        // The PNG specification recommends no filtering for palette images.
+        if (iPalettized)
+            {
+            aOut[0] = uint8_t(TFilter::None);
+            memcpy(aOut + 1,aRow,iRowBytes);
+            return;
+            }
+
+        static const TFilter filter[4] = { TFilter::None,TFilter::Sub,TFilter::Up,TFilter::Paeth };
+        std::vector<uint8_t>* candidate = aBuffers.iCandidate;
+        memcpy(candidate[0].data(),aRow,iRowBytes);
+        FilterSub(candidate[1].data(),aRow);
+        FilterUp(candidate[2].data(),aRow,aPrev);
+        FilterPaeth(candidate[3].data(),aRow,aPrev);
+        size_t best = 0;
+        uint64_t best_cost = UINT64_MAX;
+        for (size_t i = 0; i < 4; i++)
+            {
+            uint64_t cost = Cost(candidate[i].data());
+            if (cost < best_cost)
+                {
+                best = i;
+                best_cost = cost;
+                }
+            }
+        aOut[0] = uint8_t(filter[best]);
+        memcpy(aOut + 1,candidate[best].data(),iRowBytes);
+        }
+
+    void FilterSub(uint8_t* aOut,const uint8_t* aRow) const
+        {
+        for (size_t i = 0; i < iBytesPerPixel; i++)
+            aOut[i] = aRow[i];
+        for (size_t i = iBytesPerPixel; i < iRowBytes; i++)
+            aOut[i] = uint8_t(aRow[i] - aRow[i - iBytesPerPixel]);
+        }
+
+    void FilterUp(uint8_t* aOut,const uint8_t* aRow,const uint8_t* aPrev) const
+        {
+        for (size_t i = 0; i < iRowBytes; i++)
+            aOut[i] = uint8_t(aRow[i] - aPrev[i]);
+        }
+
+    void FilterPaeth(uint8_t* aOut,const uint8_t* aRow,const uint8_t* aPrev) const
+        {
+        // At the start of the row the left and upper left bytes are zero, so the predictor is the byte above.
+        for (size_t i = 0; i < iBytesPerPixel; i++)
+            aOut[i] = uint8_t(aRow[i] - aPrev[i]);
+        size_t i = iBytesPerPixel;
+#ifdef CARTOTYPE_SSE2
+        // Encoding uses only unfiltered data, so eight bytes can be predicted at once.
+        __m128i zero = _mm_setzero_si128();
+        for (; i + 8 <= iRowBytes; i += 8)
+            {
+            __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(aRow + i - iBytesPerPixel)),zero);
+            __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(aPrev + i)),zero);
+            __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(aPrev + i - iBytesPerPixel)),zero);
+            __m128i x = _mm_loadl_epi64((const __m128i*)(aRow + i));
+            __m128i pa = _mm_sub_epi16(b,c);
+            __m128i pb = _mm_sub_epi16(a,c);
+            __m128i pc = _mm_add_epi16(pa,pb);
+            pa = _mm_max_epi16(pa,_mm_sub_epi16(zero,pa));
+            pb = _mm_max_epi16(pb,_mm_sub_epi16(zero,pb));
+            pc = _mm_max_epi16(pc,_mm_sub_epi16(zero,pc));
+            // Choose a if pa <= pb and pa <= pc, otherwise b if pb <= pc, otherwise c.
+            __m128i use_a = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi16(pa,pb),_mm_cmpgt_epi16(pa,pc)),_mm_set1_epi16(-1));
+            __m128i use_b = _mm_andnot_si128(_mm_cmpgt_epi16(pb,pc),_mm_set1_epi16(-1));
+            __m128i bc = _mm_or_si128(_mm_and_si128(use_b,b),_mm_andnot_si128(use_b,c));
+            __m128i predictor = _mm_or_si128(_mm_and_si128(use_a,a),_mm_andnot_si128(use_a,bc));
+            _mm_storel_epi64((__m128i*)(aOut + i),_mm_sub_epi8(x,_mm_packus_epi16(predictor,zero)));
+            }
+#endif
+        for (; i < iRowBytes; i++)
+            {
+            int a = aRow[i - iBytesPerPixel];
+            int b = aPrev[i];
+            int c = aPrev[i - iBytesPerPixel];
+            int pa = std::abs(b - c);
+            int pb = std::abs(a - c);
+            int pc = std::abs(a + b - 2 * c);
+            int predictor = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+            aOut[i] = uint8_t(aRow[i] - predictor);
+            }
+        }
+
+    // Returns the sum of the absolute values of the filtered bytes treated as signed numbers.
+    uint64_t Cost(const uint8_t* aData) const
+        {
+        uint64_t cost = 0;
+        size_t i = 0;
+#ifdef CARTOTYPE_SSE2
+        __m128i zero = _mm_setzero_si128();
+        __m128i total = zero;
+        for (; i + 16 <= iRowBytes; i += 16)
+            {
+            __m128i x = _mm_loadu_si128((const __m128i*)(aData + i));
+            __m128i negated = _mm_sub_epi8(zero,x);
+            total = _mm_add_epi64(total,_mm_sad_epu8(_mm_min_epu8(x,negated),zero));
+            }
+        cost = uint64_t(_mm_cvtsi128_si32(total)) + uint64_t(_mm_cvtsi128_si32(_mm_srli_si128(total,8)));
+#endif
+        for (; i < iRowBytes; i++)
+            cost += std::min(aData[i],uint8_t(256 - aData[i]));
+        return cost;
+        }
+
+    /** Converts, filters and compresses the rows of aChunk, setting its compressed data and the Adler-32 checksum of its filtered data. */
+    void Compress(TChunk& aChunk) const;
+
+    // The FLEVEL field of the zlib header, which describes the compression level used.
+    int LevelFlags() const
+        {
+        if (iParam.CompressionLevel < 2)
+            return 0;
+        if (iParam.CompressionLevel < 6)
+            return 1;
+        return iParam.CompressionLevel == 6 ? 2 : 3;
+        }
+
+    static void WriteBigEndian32(uint8_t* aP,uint32_t aValue)
+        {
+        aP[0] = uint8_t(aValue >> 24);
+        aP[1] = uint8_t(aValue >> 16);
+        aP[2] = uint8_t(aValue >> 8);
+        aP[3] = uint8_t(aValue);
+        }
+
+    /** Writes a PNG chunk of type aType, with its length and CRC. */
+    static void WriteChunk(MOutputStream& aOutput,const char* aType,const uint8_t* aData,size_t aLength);
+
+    static constexpr uint8_t KTransparentIndex = 252;
+    static constexpr size_t KDictionarySize = 32768;
+
+    const BitmapView& iBitmap;
+    const PngEncoderParam& iParam;
+    size_t iWidth;
+    size_t iHeight;
+    size_t iBytesPerPixel = 4;
+    size_t iRowBytes = 0;
+    bool iOpaque = true;
+    bool iPalettized = false;
+    bool iHasTransparency = false;
+    };
+
+}
@@ -0,0 +1,20 @@
+/*
+cartotype_simd.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+/*
+Detect the SIMD instruction sets that are always available on the target processor,
+so that pixel operations can use them without a run-time check.
+SSE2 is part of the x86-64 baseline and NEON of the AArch64 baseline.
+*/
+#if (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define CARTOTYPE_SSE2
+    #include <emmintrin.h>
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(__ARM_BIG_ENDIAN)
+    #define CARTOTYPE_NEON
+    #include <arm_neon.h>
+#endif
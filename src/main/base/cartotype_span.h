@@ -0,0 +1,255 @@
+/*
+cartotype_span.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_simd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace CartoTypeCore
+{
+
+/**
+Functions to composite horizontal spans of pixels onto a BitmapType::RGBA32 bitmap,
+for use when filling shapes, drawing glyph masks, drawing bitmaps, and filling with patterns.
+
+Pixels are premultiplied RGBA values, held in 32-bit words with alpha in the top byte, as in the Color class.
+Source pixels are composited over destination pixels using the Porter-Duff 'over' operator,
+after being multiplied by an optional coverage value for each pixel, such as the value of an
+anti-aliased shape or glyph mask, and an optional alpha value for the whole span.
+Multiplication uses the same rounding as GraphicsContext::MultiplyIntensities.
+
+Four pixels at a time are processed using SSE2 or NEON where available.
+All versions give identical results.
+*/
+class SpanBlender
+    {
+    public:
+    /** Composites aCount pixels of the color aColor over aDest, using the coverage values in aCoverage, or full coverage if aCoverage is null. */
+    static void BlendColor(uint32_t* aDest,size_t aCount,uint32_t aColor,const uint8_t* aCoverage)
+        {
+        if (!aCoverage)
+            {
+            FillColor(aDest,aCount,aColor,255);
+            return;
+            }
+        size_t i = 0;
+#if defined(CARTOTYPE_SSE2)
+        __m128i color = _mm_set1_epi32(int(aColor));
+        for (; i + 4 <= aCount; i += 4)
+            {
+            uint32_t c;
+            memcpy(&c,aCoverage + i,4);
+            if (c == 0)
+                continue;
+            __m128i p = _mm_loadu_si128((const __m128i*)(aDest + i));
+            _mm_storeu_si128((__m128i*)(aDest + i),Over(p,Multiply(color,ExpandCoverage(c))));
+            }
+#elif defined(CARTOTYPE_NEON)
+        uint32x4_t color = vdupq_n_u32(aColor);
+        for (; i + 4 <= aCount; i += 4)
+            {
+            uint32_t c;
+            memcpy(&c,aCoverage + i,4);
+            if (c == 0)
+                continue;
+            uint32x4_t p = vld1q_u32(aDest + i);
+            vst1q_u32(aDest + i,Over(p,Multiply(color,ExpandCoverage(c))));
+            }
+#endif
+        for (; i < aCount; i++)
+            if (aCoverage[i])
+                aDest[i] = Over(aDest[i],Multiply(aColor,aCoverage[i]));
+        }
+
+    /** Composites aCount pixels of the color aColor over aDest, using the same coverage value aCoverage for each pixel. */
+    static void FillColor(uint32_t* aDest,size_t aCount,uint32_t aColor,uint8_t aCoverage)
+        {
+        if (aCoverage == 0)
+            return;
+        uint32_t color = Multiply(aColor,aCoverage);
+        if ((color >> 24) == 0xFF)
+            {
+            std::fill(aDest,aDest + aCount,color);
+            return;
+            }
+        if (color == 0)
+            return;
+        size_t i = 0;
+#if defined(CARTOTYPE_SSE2)
+        __m128i source = _mm_set1_epi32(int(color));
+        for (; i + 4 <= aCount; i += 4)
+            {
+            __m128i p = _mm_loadu_si128((const __m128i*)(aDest + i));
+            _mm_storeu_si128((__m128i*)(aDest + i),Over(p,source));
+            }
+#elif defined(CARTOTYPE_NEON)
+        uint32x4_t source = vdupq_n_u32(color);
+        for (; i + 4 <= aCount; i += 4)
+            vst1q_u32(aDest + i,Over(vld1q_u32(aDest + i),source));
+#endif
+        for (; i < aCount; i++)
+            aDest[i] = Over(aDest[i],color);
+        }
+
+    /**
+    Composites the aCount pixels in aSource over aDest, multiplying them by the coverage values in aCoverage
+    if it is non-null, and by aAlpha.
+    */
+    static void BlendPixels(uint32_t* aDest,const uint32_t* aSource,size_t aCount,const uint8_t* aCoverage,uint8_t aAlpha = 255)
+        {
+        if (aAlpha == 0)
+            return;
+        size_t i = 0;
+#if defined(CARTOTYPE_SSE2)
+        __m128i alpha = _mm_set1_epi8(char(aAlpha));
+        for (; i + 4 <= aCount; i += 4)
+            {
+            __m128i coverage = alpha;
+            if (aCoverage)
+                {
+                uint32_t c;
+                memcpy(&c,aCoverage + i,4);
+                if (c == 0)
+                    continue;
+                coverage = Multiply(ExpandCoverage(c),alpha);
+                }
+            __m128i source = Multiply(_mm_loadu_si128((const __m128i*)(aSource + i)),coverage);
+            __m128i p = _mm_loadu_si128((const __m128i*)(aDest + i));
+            _mm_storeu_si128((__m128i*)(aDest + i),Over(p,source));
+            }
+#elif defined(CARTOTYPE_NEON)
+        uint32x4_t alpha = vdupq_n_u32(aAlpha * 0x01010101U);
+        for (; i + 4 <= aCount; i += 4)
+            {
+            uint32x4_t coverage = alpha;
+            if (aCoverage)
+                {
+                uint32_t c;
+                memcpy(&c,aCoverage + i,4);
+                if (c == 0)
+                    continue;
+                coverage = Multiply(ExpandCoverage(c),alpha);
+                }
+            uint32x4_t source = Multiply(vld1q_u32(aSource + i),coverage);
+            vst1q_u32(aDest + i,Over(vld1q_u32(aDest + i),source));
+            }
+#endif
+        for (; i < aCount; i++)
+            {
+            uint8_t coverage = aCoverage ? MultiplyIntensities(aCoverage[i],aAlpha) : aAlpha;
+            if (coverage)
+                aDest[i] = Over(aDest[i],Multiply(aSource[i],coverage));
+            }
+        }
+
+    /**
+    Composites aCount pixels of a repeating pattern over aDest, multiplying them by the coverage values
+    in aCoverage if it is non-null, and by aAlpha. The pattern is a row of aPatternLength pixels at aPattern,
+    and the first pixel of the span takes the pattern pixel at aPatternOffset. This is used for texture and pattern fills.
+    */
+    static void BlendPattern(uint32_t* aDest,size_t aCount,const uint32_t* aPattern,size_t aPatternLength,size_t aPatternOffset,
+                             const uint8_t* aCoverage,uint8_t aAlpha = 255)
+        {
+        if (aPatternLength == 0)
+            return;
+        aPatternOffset %= aPatternLength;
+        while (aCount)
+            {
+            size_t n = std::min(aCount,aPatternLength - aPatternOffset);
+            BlendPixels(aDest,aPattern + aPatternOffset,n,aCoverage,aAlpha);
+            aDest += n;
+            if (aCoverage)
+                aCoverage += n;
+            aCount -= n;
+            aPatternOffset = 0;
+            }
+        }
+
+    /** Multiplies two intensities, treated as fractions in the range 0...255, in the same way as GraphicsContext::MultiplyIntensities. */
+    static uint8_t MultiplyIntensities(uint32_t aIntensity1,uint32_t aIntensity2)
+        {
+        return uint8_t((aIntensity1 * aIntensity2 + 255) >> 8);
+        }
+
+    /** Multiplies each channel of the pixel aPixel by aValue. */
+    static uint32_t Multiply(uint32_t aPixel,uint32_t aValue)
+        {
+        return MultiplyIntensities(aPixel & 0xFF,aValue) |
+               (MultiplyIntensities((aPixel >> 8) & 0xFF,aValue) << 8) |
+               (MultiplyIntensities((aPixel >> 16) & 0xFF,aValue) << 16) |
+               (uint32_t(MultiplyIntensities(aPixel >> 24,aValue)) << 24);
+        }
+
+    /** Composites the premultiplied pixel aSource over aDest. */
+    static uint32_t Over(uint32_t aDest,uint32_t aSource)
+        {
+        uint32_t d = Multiply(aDest,255 - (aSource >> 24));
+        uint32_t result = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+            result |= std::min(((d >> shift) & 0xFF) + ((aSource >> shift) & 0xFF),255U) << shift;
+        return result;
+        }
+
+    private:
+#if defined(CARTOTYPE_SSE2)
+    // Multiplies the bytes of aA and aB as intensities.
+    static __m128i Multiply(__m128i aA,__m128i aB)
+        {
+        __m128i zero = _mm_setzero_si128();
+        __m128i k255 = _mm_set1_epi16(255);
+        __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(aA,zero),_mm_unpacklo_epi8(aB,zero)),k255),8);
+        __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(aA,zero),_mm_unpackhi_epi8(aB,zero)),k255),8);
+        return _mm_packus_epi16(lo,hi);
+        }
+
+    // Composites four premultiplied source pixels over four destination pixels.
+    static __m128i Over(__m128i aDest,__m128i aSource)
+        {
+        // Replicate each source alpha into all four bytes of its pixel, and invert it.
+        __m128i alpha = _mm_srli_epi32(aSource,24);
+        alpha = _mm_or_si128(alpha,_mm_slli_epi32(alpha,8));
+        alpha = _mm_or_si128(alpha,_mm_slli_epi32(alpha,16));
+        __m128i inverse_alpha = _mm_xor_si128(alpha,_mm_set1_epi32(-1));
+        return _mm_adds_epu8(aSource,Multiply(aDest,inverse_alpha));
+        }
+
+    // Expands four coverage bytes so that each fills the four bytes of a pixel.
+    static __m128i ExpandCoverage(uint32_t aCoverage)
+        {
+        __m128i c = _mm_cvtsi32_si128(int(aCoverage));
+        c = _mm_unpacklo_epi8(c,c);
+        return _mm_unpacklo_epi16(c,c);
+        }
+#elif defined(CARTOTYPE_NEON)
+    static uint32x4_t Multiply(uint32x4_t aA,uint32x4_t aB)
+        {
+        uint8x16_t a = vreinterpretq_u8_u32(aA);
+        uint8x16_t b = vreinterpretq_u8_u32(aB);
+        uint16x8_t k255 = vdupq_n_u16(255);
+        uint16x8_t lo = vshrq_n_u16(vmlaq_u16(k255,vmovl_u8(vget_low_u8(a)),vmovl_u8(vget_low_u8(b))),8);
+        uint16x8_t hi = vshrq_n_u16(vmlaq_u16(k255,vmovl_u8(vget_high_u8(a)),vmovl_u8(vget_high_u8(b))),8);
+        return vreinterpretq_u32_u8(vcombine_u8(vmovn_u16(lo),vmovn_u16(hi)));
+        }
+
+    static uint32x4_t Over(uint32x4_t aDest,uint32x4_t aSource)
+        {
+        uint32x4_t inverse_alpha = vmvnq_u32(vmulq_n_u32(vshrq_n_u32(aSource,24),0x01010101U));
+        return vreinterpretq_u32_u8(vqaddq_u8(vreinterpretq_u8_u32(aSource),vreinterpretq_u8_u32(Multiply(aDest,inverse_alpha))));
+        }
+
+    static uint32x4_t ExpandCoverage(uint32_t aCoverage)
+        {
+        uint32_t c[4] = { (aCoverage & 0xFF) * 0x01010101U,((aCoverage >> 8) & 0xFF) * 0x01010101U,
+                          ((aCoverage >> 16) & 0xFF) * 0x01010101U,(aCoverage >> 24) * 0x01010101U };
+        return vld1q_u32(c);
+        }
+#endif
+    };
+
+}
@@ -11,8 +11,16 @@ See www.cartotype.com for more information.
 #include <cartotype_errors.h>
 #include <cartotype_list.h>
 #include <cartotype_string.h>
+#include <cartotype_varint_decoder.h>
 #include <string.h>
 #include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #ifdef __unix__
     #include <unistd.h> // to define _POSIX_VERSION
@@ -27,6 +35,24 @@ See www.cartotype.com for more information.
     #define CARTOTYPE_LOW_LEVEL_FILE_IO
 #endif
 
+// Use memory-mapped files, positional reads and vectored writes where POSIX mmap, pread and writev are available.
+#if (defined(__unix__) || defined(__APPLE__))
+    #define CARTOTYPE_MAPPED_FILE_IO
+    #define CARTOTYPE_POSITIONAL_FILE_IO
+    #define CARTOTYPE_VECTORED_FILE_IO
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <errno.h>
+    #include <sys/uio.h>
+#endif
+
+// Use direct I/O, bypassing the page cache, where O_DIRECT or F_NOCACHE is available.
+#if defined(CARTOTYPE_POSITIONAL_FILE_IO) && (defined(O_DIRECT) || defined(F_NOCACHE))
+    #define CARTOTYPE_DIRECT_FILE_IO
+#endif
+
 #ifdef CARTOTYPE_LOW_LEVEL_FILE_IO
     #if defined(ANDROID)
         #include <unistd.h>
@@ -37,6 +63,14 @@ See www.cartotype.com for more information.
     #endif
 #endif
 
+// Detect little-endian processors, on which variable-length integers can be decoded a word at a time.
+#if (defined(_MSC_VER) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+    #define CARTOTYPE_LITTLE_ENDIAN
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+#endif
+
 #undef COLLECT_STATISTICS
 
 namespace CartoTypeCore
@@ -173,6 +207,256 @@ class DataOutputStream: public DataStream
     MOutputStream& iOutputStream;
     };
 
+/** The maximum number of bytes used by a variable-length integer written by DataOutputStream::WriteUint or WriteInt. */
+constexpr size_t KMaxVariableLengthIntegerBytes = 10;
+
+/**
+Stores aValue in aBuffer, which must have room for KMaxVariableLengthIntegerBytes bytes,
+as a variable-length unsigned integer: groups of 7 bits, least significant group first,
+with the top bit of each byte set if more bytes follow. Returns the number of bytes stored.
+*/
+inline size_t EncodeVariableLengthUint(uint64_t aValue,uint8_t* aBuffer)
+    {
+    size_t bytes = 0;
+    while (aValue >= 0x80)
+        {
+        aBuffer[bytes++] = uint8_t(aValue | 0x80);
+        aValue >>= 7;
+        }
+    aBuffer[bytes++] = uint8_t(aValue);
+    return bytes;
+    }
+
+/** Converts a signed integer to the unsigned integer used to store it: 0, -1, 1, -2, ... become 0, 1, 2, 3, ... */
+inline uint64_t ZigZagEncode(int64_t aValue)
+    {
+    return (uint64_t(aValue) << 1) ^ uint64_t(aValue >> 63);
+    }
+
+/** Converts an unsigned integer created by ZigZagEncode back to the signed integer. */
+inline int64_t ZigZagDecode(uint64_t aValue)
+    {
+    return int64_t(aValue >> 1) ^ -int64_t(aValue & 1);
+    }
+
+/**
+Returns true if DataOutputStream::WriteUint and WriteInt use the format of EncodeVariableLengthUint and ZigZagEncode.
+The inline decoding functions of DataInputStream rely on that format; if this function returns false they call
+DataInputStream::ReadUint and ReadInt instead. The check is made once, by writing test values.
+*/
+inline bool VariableLengthIntegerFormatVerified()
+    {
+    static const bool verified = []
+        {
+        class TSink: public MOutputStream
+            {
+            public:
+            void Write(const uint8_t* aBuffer,size_t aBytes) override
+                {
+                if (aBytes > sizeof(iData) - iBytes)
+                    throw KErrorOverflow;
+                memcpy(iData + iBytes,aBuffer,aBytes);
+                iBytes += aBytes;
+                }
+            uint8_t iData[256];
+            size_t iBytes = 0;
+            };
+
+        const uint64_t value[] = { 0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, 0x123456789ULL, 0xFFFFFFFFFFFFFFFFULL };
+        uint8_t expected[256];
+        size_t expected_bytes = 0;
+        TSink sink;
+        try
+            {
+            DataOutputStream output(sink);
+            for (uint64_t v : value)
+                {
+                output.WriteUint(v);
+                expected_bytes += EncodeVariableLengthUint(v,expected + expected_bytes);
+                output.WriteInt(-int64_t(v >> 1));
+                expected_bytes += EncodeVariableLengthUint(ZigZagEncode(-int64_t(v >> 1)),expected + expected_bytes);
+                }
+            }
+        catch (Result)
+            {
+            return false;
+            }
+        return sink.iBytes == expected_bytes && !memcmp(sink.iData,expected,expected_bytes);
+        }();
+    return verified;
+    }
+
+/**
+A data output stream which collects its output in a buffer and passes it to the data sink
+in blocks of up to KBufferSize bytes, so that writing a small field does not need a call to the sink.
+
+All output goes through the buffer, including output from the functions inherited from DataOutputStream,
+so it stays in the order in which it was written. WriteUint8, WriteUint16, WriteUint32, WriteBytes, WriteUint and WriteInt
+are inline when called through a BufferedDataOutputStream; when called through a DataOutputStream reference
+they write the same bytes through a virtual call to the buffer.
+
+Call Flush when the writing is finished: it passes any data remaining in the buffer to the sink, and throws an exception if the sink does.
+The sink receives data only when the buffer is full or flushed, so call Flush before using the sink directly. The destructor does not flush,
+because it cannot report errors: data still in the buffer when the stream is destroyed is discarded.
+*/
+class BufferedDataOutputStream: public DataOutputStream
+    {
+    public:
+    /** Creates a buffered data output stream to write to aOutputStream. */
+    BufferedDataOutputStream(MOutputStream& aOutputStream):
+        DataOutputStream(iBuffer),
+        iBuffer(aOutputStream)
+        {
+        }
+
+    BufferedDataOutputStream(const BufferedDataOutputStream&) = delete;
+    BufferedDataOutputStream(BufferedDataOutputStream&&) = delete;
+    void operator=(const BufferedDataOutputStream&) = delete;
+    void operator=(BufferedDataOutputStream&&) = delete;
+
+    /** Writes an 8-bit unsigned integer. */
+    void WriteUint8(uint8_t aValue)
+        {
+        *iBuffer.Reserve(1) = aValue;
+        }
+    /** Writes a 16-bit unsigned integer using the current endianness. */
+    void WriteUint16(uint16_t aValue)
+        {
+        uint8_t* p = iBuffer.Reserve(2);
+        if (iEndianness == StreamEndianness::Big)
+            {
+            p[0] = uint8_t(aValue >> 8);
+            p[1] = uint8_t(aValue);
+            }
+        else
+            {
+            p[0] = uint8_t(aValue);
+            p[1] = uint8_t(aValue >> 8);
+            }
+        }
+    /** Writes a 32-bit unsigned integer using the current endianness. */
+    void WriteUint32(uint32_t aValue)
+        {
+        uint8_t* p = iBuffer.Reserve(4);
+        if (iEndianness == StreamEndianness::Big)
+            {
+            p[0] = uint8_t(aValue >> 24);
+            p[1] = uint8_t(aValue >> 16);
+            p[2] = uint8_t(aValue >> 8);
+            p[3] = uint8_t(aValue);
+            }
+        else
+            {
+            p[0] = uint8_t(aValue);
+            p[1] = uint8_t(aValue >> 8);
+            p[2] = uint8_t(aValue >> 16);
+            p[3] = uint8_t(aValue >> 24);
+            }
+        }
+    using DataOutputStream::WriteUint;
+    /**
+    Writes a variable-length unsigned integer in the format used by DataOutputStream::WriteUint.
+    It is encoded inline if VariableLengthIntegerFormatVerified returns true.
+    */
+    void WriteUint(uint64_t aValue)
+        {
+        if (!VariableLengthIntegerFormatVerified())
+            {
+            DataOutputStream::WriteUint(aValue);
+            return;
+            }
+        uint8_t* p = iBuffer.Reserve(KMaxVariableLengthIntegerBytes);
+        iBuffer.Unreserve(KMaxVariableLengthIntegerBytes - EncodeVariableLengthUint(aValue,p));
+        }
+    /** Writes a variable-length signed integer in the format used by DataOutputStream::WriteInt. */
+    void WriteInt(int64_t aValue)
+        {
+        if (!VariableLengthIntegerFormatVerified())
+            {
+            DataOutputStream::WriteInt(aValue);
+            return;
+            }
+        WriteUint(ZigZagEncode(aValue));
+        }
+    /** Writes aBytes bytes from aBuffer. Blocks at least as large as the buffer are passed to the sink without being copied. */
+    void WriteBytes(const uint8_t* aBuffer,size_t aBytes)
+        {
+        iBuffer.Write(aBuffer,aBytes);
+        }
+    /** Passes any buffered data to the sink. */
+    void Flush()
+        {
+        iBuffer.Flush();
+        }
+    /** Returns the number of bytes in the buffer which have not yet been passed to the sink. */
+    size_t BufferedBytes() const { return iBuffer.iBytes; }
+
+    /** The size of the buffer in bytes. */
+    static constexpr size_t KBufferSize = 4096;
+
+    private:
+    /** The buffer through which all the output passes. */
+    class TBuffer: public MOutputStream
+        {
+        public:
+        explicit TBuffer(MOutputStream& aSink):
+            iSink(aSink)
+            {
+            }
+
+        // from MOutputStream
+        void Write(const uint8_t* aBuffer,size_t aBytes) override
+            {
+            if (aBytes <= KBufferSize - iBytes)
+                {
+                memcpy(iData + iBytes,aBuffer,aBytes);
+                iBytes += aBytes;
+                return;
+                }
+            Flush();
+            if (aBytes >= KBufferSize)
+                iSink.Write(aBuffer,aBytes);
+            else
+                {
+                memcpy(iData,aBuffer,aBytes);
+                iBytes = aBytes;
+                }
+            }
+
+        /** Returns a pointer to aBytes bytes at the end of the buffer, flushing the buffer first if necessary. */
+        uint8_t* Reserve(size_t aBytes)
+            {
+            if (KBufferSize - iBytes < aBytes)
+                Flush();
+            uint8_t* p = iData + iBytes;
+            iBytes += aBytes;
+            return p;
+            }
+        /** Removes aBytes unused bytes from the end of the buffer after a call to Reserve. */
+        void Unreserve(size_t aBytes)
+            {
+            iBytes -= aBytes;
+            }
+        void Flush()
+            {
+            if (iBytes)
+                {
+                // Empty the buffer first so that if the sink throws an exception the data is not written again.
+                size_t bytes = iBytes;
+                iBytes = 0;
+                iSink.Write(iData,bytes);
+                }
+            }
+
+        MOutputStream& iSink;
+        size_t iBytes = 0;
+        uint8_t iData[KBufferSize];
+        };
+
+    // iBuffer is constructed after the base class, which stores only a reference to it.
+    TBuffer iBuffer;
+    };
+
 /**
 A data input stream. It reads integers, strings and blocks of data from
 a data source provided by a class derived from MInputStream.
@@ -257,6 +541,110 @@ class DataInputStream: public DataStream
     int64_t ReadInt();
     uint32_t ReadUintMax32();
     int32_t ReadIntMax32();
+    /**
+    Reads a variable-length unsigned integer of up to 64 bits in the format used by ReadUint,
+    decoding it inline from the buffered data if it is all there, otherwise calling ReadUint.
+    On little-endian processors, values of up to 8 bytes are decoded a word at a time.
+    */
+    uint64_t ReadUintInline()
+        {
+        if (iDataBytes && VariableLengthIntegerFormatVerified())
+            {
+            if (iData[0] < 0x80)
+                {
+                iDataBytes--;
+                return *iData++;
+                }
+#ifdef CARTOTYPE_LITTLE_ENDIAN
+            if (iDataBytes >= 8)
+                {
+                uint64_t word;
+                memcpy(&word,iData,8);
+                uint64_t last_byte_flags = ~word & 0x8080808080808080ULL;
+                if (last_byte_flags)
+                    {
+                    size_t bytes = (CountTrailingZeros(last_byte_flags) >> 3) + 1;
+                    iData += bytes;
+                    iDataBytes -= bytes;
+                    return CompactGroups(word & (~0ULL >> (64 - bytes * 8)));
+                    }
+                }
+#endif
+            }
+        return ReadUint();
+        }
+    /** Reads a variable-length signed integer of up to 64 bits in the format used by ReadInt, using ReadUintInline. */
+    int64_t ReadIntInline()
+        {
+        if (VariableLengthIntegerFormatVerified())
+            return ZigZagDecode(ReadUintInline());
+        return ReadInt();
+        }
+
+    /**
+    Reads aCount variable-length unsigned integers, in the format used by ReadUint, into aArray.
+    Values in the buffered data are decoded by the fastest VariableLengthIntegerDecoder supported by the processor,
+    which is chosen at run time.
+    */
+    void ReadUintArray(uint64_t* aArray,size_t aCount)
+        {
+        if (!VariableLengthIntegerFormatVerified())
+            {
+            while (aCount--)
+                *aArray++ = ReadUint();
+            return;
+            }
+        const auto& decoder = VariableLengthIntegerDecoder::Best();
+        while (aCount)
+            {
+            if (iDataBytes >= VariableLengthIntegerDecoder::KMinDataBytes)
+                {
+                const uint8_t* p = decoder.ReadUintArray(iData,iData + iDataBytes,aArray,aCount);
+                iDataBytes -= size_t(p - iData);
+                iData = p;
+                if (!aCount)
+                    break;
+                }
+            *aArray++ = ReadUintInline();
+            aCount--;
+            }
+        }
+
+    /**
+    Reads aCount variable-length signed integers, in the format used by ReadInt, which are differences
+    between successive values, and stores the values in aArray. The first difference is relative to aStart.
+    Returns the last value, or aStart if aCount is zero. Arithmetic wraps round on overflow.
+    This is the usual encoding of coordinate arrays. The decoding is done in the same way as by ReadUintArray.
+    */
+    int32_t ReadIntDeltaArray(int32_t* aArray,size_t aCount,int32_t aStart = 0)
+        {
+        uint32_t value = uint32_t(aStart);
+        if (!VariableLengthIntegerFormatVerified())
+            {
+            while (aCount--)
+                {
+                value += uint32_t(ReadInt());
+                *aArray++ = int32_t(value);
+                }
+            return int32_t(value);
+            }
+        const auto& decoder = VariableLengthIntegerDecoder::Best();
+        while (aCount)
+            {
+            if (iDataBytes >= VariableLengthIntegerDecoder::KMinDataBytes)
+                {
+                const uint8_t* p = decoder.ReadIntDeltaArray(iData,iData + iDataBytes,aArray,aCount,value);
+                iDataBytes -= size_t(p - iData);
+                iData = p;
+                if (!aCount)
+                    break;
+                }
+            value += uint32_t(ReadIntInline());
+            *aArray++ = int32_t(value);
+            aCount--;
+            }
+        return int32_t(value);
+        }
     float ReadFloatFP();
     double ReadDoubleFP();
     int32_t ReadFloatRounded();
@@ -321,6 +709,28 @@ class DataInputStream: public DataStream
         }
 
     private:
+#ifdef CARTOTYPE_LITTLE_ENDIAN
+    /** Returns the number of trailing zero bits in a non-zero number. */
+    static int CountTrailingZeros(uint64_t aValue)
+        {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index,aValue);
+        return int(index);
+#else
+        return __builtin_ctzll(aValue);
+#endif
+        }
+
+    /** Combines the low 7 bits of each of up to 8 bytes, stored least significant first, into a 56-bit number. */
+    static uint64_t CompactGroups(uint64_t aValue)
+        {
+        aValue = (aValue & 0x007F007F007F007FULL) | ((aValue & 0x7F007F007F007F00ULL) >> 1);
+        aValue = (aValue & 0x00003FFF00003FFFULL) | ((aValue & 0x3FFF00003FFF0000ULL) >> 2);
+        return (aValue & 0x000000000FFFFFFFULL) | ((aValue & 0x0FFFFFFF00000000ULL) >> 4);
+        }
+#endif
+
     uint8_t ReadUint8Helper();
     uint16_t ReadUint16BigEndianHelper();
     uint32_t ReadUint32BigEndianHelper();
@@ -402,6 +812,94 @@ class MemoryInputStream: public MInputStream
     int64_t iPosition = 0;
     };
 
+/**
+A data input stream for a contiguous block of memory whose whole extent is known,
+such as a record read in one piece or part of a memory-mapped file.
+
+The whole block is given to DataInputStream as its buffer by a single call to the data source,
+which is made again only after Seek, so the inline reading functions of DataInputStream,
+including ReadUintInline, ReadIntInline, ReadUintArray and ReadIntDeltaArray, work directly on the block
+and do not need to refill the buffer.
+*/
+class ContiguousDataInputStream: public DataInputStream
+    {
+    public:
+    /** Creates a data input stream to read the aLength bytes starting at aData. */
+    ContiguousDataInputStream(const uint8_t* aData,size_t aLength):
+        DataInputStream(iSource),
+        iSource(aData,aLength)
+        {
+        }
+
+    ContiguousDataInputStream(const ContiguousDataInputStream&) = delete;
+    void operator=(const ContiguousDataInputStream&) = delete;
+
+    /** Returns the total length of the data in bytes. */
+    size_t Length() const { return iSource.iLength; }
+
+    private:
+    /** A data source which returns all the remaining data from each call to Read. */
+    class TSource: public MInputStream
+        {
+        public:
+        TSource(const uint8_t* aData,size_t aLength):
+            iData(aData),
+            iLength(aLength)
+            {
+            }
+
+        // from MInputStream
+        void Read(const uint8_t*& aPointer,size_t& aLength) override
+            {
+            aPointer = iData + iPosition;
+            aLength = iLength - iPosition;
+            iPosition = iLength;
+            }
+        bool EndOfStream() const override { return iPosition >= iLength; }
+        void Seek(int64_t aPosition) override
+            {
+            if (aPosition < 0 || uint64_t(aPosition) > iLength)
+                throw KErrorEndOfData;
+            iPosition = size_t(aPosition);
+            }
+        int64_t Position() override { return int64_t(iPosition); }
+        int64_t Length() override { return int64_t(iLength); }
+
+        const uint8_t* iData;
+        size_t iLength;
+        size_t iPosition = 0;
+        };
+
+    // iSource is constructed after the base class, which stores only its address.
+    TSource iSource;
+    };
+
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+/**
+Reads up to aBufferSize bytes from position aPosition in the file with the descriptor aFile
+and returns the number of bytes actually read. The file position is neither used nor changed,
+so this function may be called by several threads at once using the same descriptor.
+Positions beyond 2Gb need a 64-bit off_t, as on 64-bit platforms, or on 32-bit platforms when _FILE_OFFSET_BITS is 64;
+otherwise reading stops at 2Gb.
+*/
+inline size_t ReadFileAt(int aFile,uint8_t* aBuffer,size_t aBufferSize,int64_t aPosition)
+    {
+    size_t bytes_read = 0;
+    while (bytes_read < aBufferSize)
+        {
+        int64_t position = aPosition + int64_t(bytes_read);
+        if (sizeof(off_t) < sizeof(int64_t) && position > INT32_MAX)
+            break;
+        ssize_t n = pread(aFile,aBuffer + bytes_read,aBufferSize - bytes_read,off_t(position));
+        if (n > 0)
+            bytes_read += size_t(n);
+        else if (n == 0 || errno != EINTR)
+            break;
+        }
+    return bytes_read;
+    }
+#endif
+
 /** A file input class for reading binary data from file which may be greater than 4Gb in size. */
 #ifdef CARTOTYPE_LOW_LEVEL_FILE_IO
 class BinaryInputFile
@@ -472,6 +970,20 @@ class BinaryInputFile
 #endif
         }
 
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+    /**
+    Reads up to aBufferSize bytes from position aPosition into aBuffer and returns the number of bytes actually read.
+    The file position is neither used nor changed, so this function may be called by several threads at once.
+    */
+    size_t ReadAt(uint8_t* aBuffer,size_t aBufferSize,int64_t aPosition) const
+        {
+        return ReadFileAt(iFile,aBuffer,aBufferSize,aPosition);
+        }
+
+    /** Returns the file descriptor, or -1 if the file is not open. */
+    int Descriptor() const { return iFile; }
+#endif
+
     BinaryInputFile(const BinaryInputFile&) = delete;
     BinaryInputFile(BinaryInputFile&&) = delete;
     void operator=(const BinaryInputFile&) = delete;
@@ -541,6 +1053,20 @@ class BinaryInputFile
         return fread(aBuffer,1,aBufferSize,iFile);
         }
 
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+    /**
+    Reads up to aBufferSize bytes from position aPosition into aBuffer and returns the number of bytes actually read.
+    The file position is neither used nor changed, so this function may be called by several threads at once.
+    */
+    size_t ReadAt(uint8_t* aBuffer,size_t aBufferSize,int64_t aPosition) const
+        {
+        return ReadFileAt(fileno(iFile),aBuffer,aBufferSize,aPosition);
+        }
+
+    /** Returns the file descriptor, or -1 if the file is not open. */
+    int Descriptor() const { return iFile ? fileno(iFile) : -1; }
+#endif
+
     BinaryInputFile(const BinaryInputFile&) = delete;
     BinaryInputFile(BinaryInputFile&&) = delete;
     void operator=(const BinaryInputFile&) = delete;
@@ -551,6 +1077,223 @@ class BinaryInputFile
     };
 #endif
 
+/** Statistics about the reading of a file, used when tuning buffer sizes and counts. */
+class FileStatistics
+    {
+    public:
+    /** Adds the statistics aOther to these, for example to total the statistics of the copies of a stream. */
+    FileStatistics& operator+=(const FileStatistics& aOther)
+        {
+        ReadCount += aOther.ReadCount;
+        SeekCount += aOther.SeekCount;
+        BytesRead += aOther.BytesRead;
+        BufferHits += aOther.BufferHits;
+        BufferMisses += aOther.BufferMisses;
+        BufferEvictions += aOther.BufferEvictions;
+        IoNanoseconds += aOther.IoNanoseconds;
+        return *this;
+        }
+
+    /** The number of calls to MInputStream::Read. */
+    uint64_t ReadCount = 0;
+    /** The number of calls to MInputStream::Seek. */
+    uint64_t SeekCount = 0;
+    /** The number of bytes read into buffers from the file. */
+    uint64_t BytesRead = 0;
+    /** The number of times a buffer was found in the cache. */
+    uint64_t BufferHits = 0;
+    /** The number of times a buffer had to be read from the file. */
+    uint64_t BufferMisses = 0;
+    /** The number of buffers discarded to make room for others. */
+    uint64_t BufferEvictions = 0;
+    /** The time spent reading buffers from the file, including any decompression, in nanoseconds. */
+    uint64_t IoNanoseconds = 0;
+    };
+
+/**
+Counters for FileStatistics, which can be updated and read by any thread.
+Relaxed atomic operations are used so that counting costs very little;
+a snapshot taken while the stream is in use may therefore be slightly inconsistent.
+*/
+class FileStatisticsCounter
+    {
+    public:
+    void AddRead() { iReadCount.fetch_add(1,std::memory_order_relaxed); }
+    void AddSeek() { iSeekCount.fetch_add(1,std::memory_order_relaxed); }
+    void AddHit() { iBufferHits.fetch_add(1,std::memory_order_relaxed); }
+    void AddMiss() { iBufferMisses.fetch_add(1,std::memory_order_relaxed); }
+    void AddEviction() { iBufferEvictions.fetch_add(1,std::memory_order_relaxed); }
+    /** Records the reading of aBytes bytes from the file, which took aNanoseconds. */
+    void AddIo(uint64_t aBytes,uint64_t aNanoseconds)
+        {
+        iBytesRead.fetch_add(aBytes,std::memory_order_relaxed);
+        iIoNanoseconds.fetch_add(aNanoseconds,std::memory_order_relaxed);
+        }
+    /** Records the reading of aBytes bytes from the file, which started at aStartTime. */
+    void AddIo(uint64_t aBytes,std::chrono::steady_clock::time_point aStartTime)
+        {
+        AddIo(aBytes,uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - aStartTime).count()));
+        }
+
+    /** Returns a snapshot of the statistics. */
+    FileStatistics Statistics() const
+        {
+        FileStatistics s;
+        s.ReadCount = iReadCount.load(std::memory_order_relaxed);
+        s.SeekCount = iSeekCount.load(std::memory_order_relaxed);
+        s.BytesRead = iBytesRead.load(std::memory_order_relaxed);
+        s.BufferHits = iBufferHits.load(std::memory_order_relaxed);
+        s.BufferMisses = iBufferMisses.load(std::memory_order_relaxed);
+        s.BufferEvictions = iBufferEvictions.load(std::memory_order_relaxed);
+        s.IoNanoseconds = iIoNanoseconds.load(std::memory_order_relaxed);
+        return s;
+        }
+
+    /** Sets all the counters to zero. */
+    void Reset()
+        {
+        for (auto p : { &iReadCount, &iSeekCount, &iBytesRead, &iBufferHits, &iBufferMisses, &iBufferEvictions, &iIoNanoseconds })
+            p->store(0,std::memory_order_relaxed);
+        }
+
+    private:
+    std::atomic<uint64_t> iReadCount { 0 };
+    std::atomic<uint64_t> iSeekCount { 0 };
+    std::atomic<uint64_t> iBytesRead { 0 };
+    std::atomic<uint64_t> iBufferHits { 0 };
+    std::atomic<uint64_t> iBufferMisses { 0 };
+    std::atomic<uint64_t> iBufferEvictions { 0 };
+    std::atomic<uint64_t> iIoNanoseconds { 0 };
+    };
+
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+/**
+Read-ahead for sequential access to a file. OnRead is called for every buffer read
+from the file. When several consecutive buffers have been read, the following
+buffers are requested from the operating system by a background thread, so that
+they are in the page cache by the time they are needed.
+*/
+class FileReadAhead
+    {
+    public:
+    /** Creates a read-ahead object for the file with descriptor aFile, prefetching up to aBufferCount buffers of aBufferSize bytes. */
+    FileReadAhead(int aFile,size_t aBufferSize,size_t aBufferCount):
+        iFile(aFile),
+        iBufferSize(int64_t(aBufferSize)),
+        iBufferCount(int64_t(aBufferCount))
+        {
+        }
+
+    ~FileReadAhead()
+        {
+        if (iThread.joinable())
+            {
+                {
+                std::lock_guard<std::mutex> lock(iMutex);
+                iStop = true;
+                }
+            iCondition.notify_one();
+            iThread.join();
+            }
+        }
+
+    /** Returns the end of the data requested from the operating system so far, or zero if access has not been sequential. */
+    int64_t PrefetchEnd() const { return iPrefetchEnd; }
+
+    /** Notes that the buffer at aPosition is about to be read, and starts prefetching if access is sequential. */
+    void OnRead(int64_t aPosition)
+        {
+        if (aPosition == iNextSequentialPosition)
+            iSequentialReads++;
+        else
+            iSequentialReads = 0;
+        iNextSequentialPosition = aPosition + iBufferSize;
+        if (iSequentialReads < KMinSequentialReads)
+            return;
+
+        // Request more data only when less than half the read-ahead window remains.
+        int64_t window = iBufferSize * iBufferCount;
+        int64_t end = iNextSequentialPosition + window;
+        bool prefetching = iPrefetchEnd > iNextSequentialPosition && iPrefetchEnd < end;
+        if (prefetching && iPrefetchEnd - iNextSequentialPosition >= window / 2)
+            return;
+        int64_t start = prefetching ? iPrefetchEnd : iNextSequentialPosition;
+        iPrefetchEnd = end;
+
+            {
+            std::lock_guard<std::mutex> lock(iMutex);
+            if (iRequestEnd != start || iRequestStart == iRequestEnd)
+                iRequestStart = start;
+            iRequestEnd = end;
+            if (!iThread.joinable())
+                iThread = std::thread([this] { Run(); });
+            }
+        iCondition.notify_one();
+        }
+
+    FileReadAhead(const FileReadAhead&) = delete;
+    FileReadAhead(FileReadAhead&&) = delete;
+    void operator=(const FileReadAhead&) = delete;
+    void operator=(FileReadAhead&&) = delete;
+
+    private:
+    /** The number of consecutive buffer reads after which access is treated as sequential. */
+    static constexpr int32_t KMinSequentialReads = 2;
+
+    void Run()
+        {
+        std::unique_lock<std::mutex> lock(iMutex);
+        for (;;)
+            {
+            iCondition.wait(lock,[this] { return iStop || iRequestEnd > iRequestStart; });
+            if (iStop)
+                return;
+            int64_t start = iRequestStart;
+            int64_t end = iRequestEnd;
+            iRequestStart = iRequestEnd;
+            lock.unlock();
+            Prefetch(start,end - start);
+            lock.lock();
+            }
+        }
+
+    void Prefetch(int64_t aPosition,int64_t aLength)
+        {
+#if defined(__linux__)
+        // readahead blocks until the data is in the page cache, which is why it is called on this thread.
+        readahead(iFile,aPosition,size_t(aLength));
+#elif defined(POSIX_FADV_WILLNEED)
+        posix_fadvise(iFile,off_t(aPosition),off_t(aLength),POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+        struct radvisory advice;
+        advice.ra_offset = off_t(aPosition);
+        advice.ra_count = int(std::min(aLength,int64_t(INT32_MAX)));
+        fcntl(iFile,F_RDADVISE,&advice);
+#else
+        (void)aPosition;
+        (void)aLength;
+#endif
+        }
+
+    int iFile;
+    int64_t iBufferSize;
+    int64_t iBufferCount;
+
+    // Used only by the reading thread.
+    int64_t iNextSequentialPosition = -1;
+    int32_t iSequentialReads = 0;
+    int64_t iPrefetchEnd = 0;
+
+    // Shared with the read-ahead thread.
+    std::mutex iMutex;
+    std::condition_variable iCondition;
+    int64_t iRequestStart = 0;
+    int64_t iRequestEnd = 0;
+    bool iStop = false;
+    std::thread iThread;
+    };
+#endif
+
 /**
 Input stream for a file. The user of this stream determines the buffer size that
 is used to read from the file.
@@ -604,6 +1347,9 @@ class FileInputStream: public MInputStream
     void operator=(FileInputStream&&) = delete;
 
     protected:
+    /** Creates a FileInputStream with no open file, for the use of derived classes which do not read using buffers. */
+    FileInputStream() = default;
+
     /** A buffer storing some data from the file. */
     class CBuffer
         {
@@ -646,26 +1392,901 @@ class FileInputStream: public MInputStream
     };
 
 /**
-A simple file input stream that does not use seek when reading sequentially.
-If the first part of the filename, before any extensions, is '-', it reads from standard input.
+A file input stream whose buffers are found through an index of their positions in the file,
+with a least-recently-used list for eviction, so that finding a buffer takes constant time
+however many buffers there are. This allows a much larger number of buffers than
+the linear search used by FileInputStream.
+
+Read, Seek and the filling of buffers are implemented here rather than in FileInputStream, whose
+buffer list is not used. Derived classes can override ReadBuffer to supply the data in another way,
+for example by decompressing it.
 */
-class SimpleFileInputStream: public MInputStream
+class CachedFileInputStream: public FileInputStream
     {
     public:
-    /** Creates a SimpleFileInputStream to read from the file aFileName. Returns the result in aError. */
-    static std::unique_ptr<SimpleFileInputStream> New(Result& aError,const std::string& aFileName,size_t aBufferSize = 64 * 1024);
-    /** Creates a SimpleFileInputStream to read from the file aFileName. Throws an exception if the file cannot be opened. */
-    SimpleFileInputStream(const std::string& aFileName,size_t aBufferSize = 64 * 1024);
+    /** Creates a CachedFileInputStream to read from the file aFileName. Returns the result in aError. */
+    static std::unique_ptr<CachedFileInputStream> New(Result& aError,const std::string& aFileName,size_t aBufferSize = KDefaultBufferSize,size_t aMaxBuffers = KDefaultMaxBuffers)
+        {
+        std::unique_ptr<CachedFileInputStream> stream(new CachedFileInputStream(aBufferSize,aMaxBuffers));
+        aError = stream->Open(aFileName);
+        if (aError)
+            return nullptr;
+        return stream;
+        }
 
-    void Read(const uint8_t*& aPointer,size_t& aLength) override;
-    bool EndOfStream() const override;
-    void Seek(int64_t aPosition) override;
-    int64_t Position() override;
-    int64_t Length() override;
-    std::string Name() override { return iName; }
+    /** Creates a CachedFileInputStream to read from the file aFileName. Throws an exception if the file cannot be opened. */
+    explicit CachedFileInputStream(const std::string& aFileName,size_t aBufferSize = KDefaultBufferSize,size_t aMaxBuffers = KDefaultMaxBuffers):
+        CachedFileInputStream(aBufferSize,aMaxBuffers)
+        {
+        Result error = Open(aFileName);
+        if (error)
+            throw error;
+        }
 
-    private:
-    BinaryInputFile iFile;
+    /** Returns a copy of this CachedFileInputStream, with the same buffer size and maximum number of buffers. */
+    std::unique_ptr<FileInputStream> Copy() override
+        {
+        std::unique_ptr<CachedFileInputStream> stream(new CachedFileInputStream(iBufferSize,iCache.MaxBuffers()));
+        Result error = stream->Open(iName);
+        if (error)
+            throw error;
+        stream->SetReadAhead(iReadAheadBufferCount);
+        return stream;
+        }
+
+    // from MInputStream
+    void Read(const uint8_t*& aPointer,size_t& aLength) override
+        {
+        iStatistics.AddRead();
+        if (iLogicalPosition >= iLength)
+            {
+            aPointer = nullptr;
+            aLength = 0;
+            return;
+            }
+        int64_t offset = iLogicalPosition % int64_t(iBufferSize);
+        CBuffer& buffer = GetBuffer(iLogicalPosition - offset);
+        if (size_t(offset) >= buffer.iSize)
+            throw KErrorEndOfData;
+        aPointer = buffer.iData + offset;
+        aLength = buffer.iSize - size_t(offset);
+        iLogicalPosition += int64_t(aLength);
+        }
+    bool EndOfStream() const override { return iLogicalPosition >= iLength; }
+    void Seek(int64_t aPosition) override
+        {
+        iStatistics.AddSeek();
+        if (aPosition < 0)
+            throw KErrorIo;
+        if (aPosition > iLength)
+            throw KErrorEndOfData;
+        iLogicalPosition = aPosition;
+        }
+
+    /**
+    Enables or disables read-ahead. If aBufferCount is greater than zero, sequential reading
+    is detected and up to aBufferCount following buffers are prefetched in the background.
+    Read-ahead is not supported on all platforms. Copies made using Copy use the same setting.
+    */
+    virtual void SetReadAhead(size_t aBufferCount)
+        {
+        iReadAheadBufferCount = aBufferCount;
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+        if (aBufferCount && iFile.Descriptor() != -1)
+            iReadAhead = std::make_unique<FileReadAhead>(iFile.Descriptor(),iBufferSize,aBufferCount);
+        else
+            iReadAhead = nullptr;
+#endif
+        }
+
+    /** Returns the number of buffers in use. */
+    size_t BufferCount() const { return iCache.Count(); }
+    /** Returns the maximum number of buffers. */
+    size_t MaxBuffers() const { return iCache.MaxBuffers(); }
+    /**
+    Returns the statistics for this stream: reads, seeks, cache hits, misses and evictions,
+    and the bytes read from the file and the time taken. Copies made using Copy have their own statistics.
+    */
+    FileStatistics Statistics() const { return iStatistics.Statistics(); }
+    /** Sets all the statistics to zero. */
+    void ResetStatistics() { iStatistics.Reset(); }
+
+    protected:
+    /**
+    The data cache: a set of buffers indexed by their positions in the file, with
+    a least-recently-used list for eviction. Finding a buffer takes constant time
+    however many buffers there are.
+    */
+    class CBufferCache
+        {
+        public:
+        /** Creates a cache holding at most aMaxBuffers buffers. */
+        explicit CBufferCache(size_t aMaxBuffers):
+            iMaxBuffers(std::max(aMaxBuffers,size_t(1)))
+            {
+            }
+
+        /** Returns the buffer for aPosition, making it the most recently used one, or null if there is none. */
+        CBuffer* Find(int64_t aPosition)
+            {
+            auto iter = iIndex.find(aPosition);
+            if (iter == iIndex.end())
+                return nullptr;
+            iLru.splice(iLru.begin(),iLru,iter->second);
+            return &*iter->second;
+            }
+
+        /**
+        Returns the buffer for aPosition, making it the most recently used one. If there is none,
+        creates a new buffer, or reuses the least recently used one if the cache is full,
+        and fills it by calling aReadBuffer(CBuffer&,int64_t).
+        If aReadBuffer throws an exception, the buffer is left unused.
+        Hits, misses and evictions are counted in aStatistics if it is non-null.
+        */
+        template<class F> CBuffer& Get(int64_t aPosition,F aReadBuffer,FileStatisticsCounter* aStatistics = nullptr)
+            {
+            CBuffer* buffer = Find(aPosition);
+            if (buffer)
+                {
+                if (aStatistics)
+                    aStatistics->AddHit();
+                return *buffer;
+                }
+            if (aStatistics)
+                aStatistics->AddMiss();
+            if (iLru.size() < iMaxBuffers)
+                iLru.emplace_front();
+            else
+                {
+                iLru.splice(iLru.begin(),iLru,std::prev(iLru.end()));
+                if (iLru.front().iPosition >= 0)
+                    {
+                    iIndex.erase(iLru.front().iPosition);
+                    if (aStatistics)
+                        aStatistics->AddEviction();
+                    }
+                }
+            buffer = &iLru.front();
+            buffer->iPosition = -1;
+            buffer->iSize = 0;
+            try
+                {
+                aReadBuffer(*buffer,aPosition);
+                }
+            catch (...)
+                {
+                iLru.splice(iLru.end(),iLru,iLru.begin());
+                throw;
+                }
+            buffer->iPosition = aPosition;
+            iIndex[aPosition] = iLru.begin();
+            return *buffer;
+            }
+
+        /** Deletes all the buffers. */
+        void Clear()
+            {
+            iIndex.clear();
+            iLru.clear();
+            }
+        /** Returns the number of buffers. */
+        size_t Count() const { return iLru.size(); }
+        /** Returns the maximum number of buffers. */
+        size_t MaxBuffers() const { return iMaxBuffers; }
+
+        private:
+        using BufferList = std::list<CBuffer>;
+
+        /** The buffers, most recently used first. */
+        BufferList iLru;
+        /** An index from file positions to buffers. */
+        std::unordered_map<int64_t,BufferList::iterator> iIndex;
+        size_t iMaxBuffers;
+        };
+
+    /** Creates a stream with no open file, using buffers of aBufferSize bytes, of which up to aMaxBuffers are kept. */
+    CachedFileInputStream(size_t aBufferSize,size_t aMaxBuffers):
+        iCache(aMaxBuffers)
+        {
+        iBufferSize = std::max(aBufferSize,size_t(4));
+        }
+
+    /** Opens the file aFileName and finds its length. */
+    Result Open(const std::string& aFileName)
+        {
+        Result error = iFile.Open(aFileName.c_str());
+        if (!error)
+            error = iFile.Seek(0,SEEK_END);
+        if (error)
+            return error;
+        iLength = iFile.Tell();
+        iPositionInFile = iLength;
+        iName = aFileName;
+        return KErrorNone;
+        }
+
+    /** Fills aBuffer with up to one buffer's worth of data from the file, starting at aPos. */
+    void ReadBuffer(CBuffer& aBuffer,int64_t aPos) override
+        {
+        if (!aBuffer.iData)
+            aBuffer.iData = new uint8_t[iBufferSize];
+        size_t bytes = size_t(std::min(int64_t(iBufferSize),std::max(iLength - aPos,int64_t(0))));
+        if (aPos != iPositionInFile)
+            {
+            Result error = iFile.Seek(aPos,SEEK_SET);
+            if (error)
+                {
+                iPositionInFile = -1;
+                throw error;
+                }
+            }
+        size_t bytes_read = iFile.Read(aBuffer.iData,bytes);
+        if (bytes_read != bytes)
+            {
+            iPositionInFile = -1;
+            throw KErrorIo;
+            }
+        iPositionInFile = aPos + int64_t(bytes);
+        aBuffer.iPosition = aPos;
+        aBuffer.iSize = bytes;
+        }
+
+    /** Returns the buffer for the position aPos, which must be a multiple of the buffer size, reading it if necessary. */
+    CBuffer& GetBuffer(int64_t aPos)
+        {
+        return iCache.Get(aPos,[this](CBuffer& aBuffer,int64_t aBufferPos)
+            {
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+            if (iReadAhead)
+                iReadAhead->OnRead(aBufferPos);
+#endif
+            auto start_time = std::chrono::steady_clock::now();
+            ReadBuffer(aBuffer,aBufferPos);
+            iStatistics.AddIo(aBuffer.iSize,start_time);
+            },&iStatistics);
+        }
+
+    /** Cached data from the file, indexed by position. */
+    CBufferCache iCache;
+    /** Statistics about the reading of the file. */
+    FileStatisticsCounter iStatistics;
+    /** The number of buffers to read ahead, or zero if read-ahead is disabled. */
+    size_t iReadAheadBufferCount = 0;
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+    /** The read-ahead object, if read-ahead is enabled. */
+    std::unique_ptr<FileReadAhead> iReadAhead;
+#endif
+    };
+
+#ifdef CARTOTYPE_MAPPED_FILE_IO
+/**
+An input stream for a file which is mapped into memory in its entirety.
+
+Read returns a pointer directly into the mapping, so no data is copied, and all
+processes reading the same file share its pages through the operating system's page cache.
+Copies made using Copy share the mapping and need no extra file descriptors.
+
+The file must not be truncated while it is mapped.
+*/
+class MappedFileInputStream: public FileInputStream
+    {
+    public:
+    /** Creates a MappedFileInputStream to read from the file aFileName. Returns the result in aError. */
+    static std::unique_ptr<MappedFileInputStream> New(Result& aError,const std::string& aFileName)
+        {
+        std::shared_ptr<Mapping> mapping = Mapping::New(aError,aFileName);
+        if (aError)
+            return nullptr;
+        return std::unique_ptr<MappedFileInputStream>(new MappedFileInputStream(mapping,aFileName));
+        }
+
+    /** Creates a MappedFileInputStream to read from the file aFileName. Throws an exception if the file cannot be opened or mapped. */
+    explicit MappedFileInputStream(const std::string& aFileName)
+        {
+        Result error;
+        std::shared_ptr<Mapping> mapping = Mapping::New(error,aFileName);
+        if (error)
+            throw error;
+        Set(mapping,aFileName);
+        }
+
+    /** Returns a copy of this MappedFileInputStream, sharing the same mapping. */
+    std::unique_ptr<FileInputStream> Copy() override
+        {
+        return std::unique_ptr<FileInputStream>(new MappedFileInputStream(iMapping,iName));
+        }
+
+    // from MInputStream
+    /** Returns a pointer to all the remaining data in the file, and moves to the end of the file. */
+    void Read(const uint8_t*& aPointer,size_t& aLength) override
+        {
+        iStatistics.AddRead();
+        if (iLogicalPosition >= iLength)
+            {
+            aPointer = nullptr;
+            aLength = 0;
+            return;
+            }
+        aPointer = iMapping->Data() + iLogicalPosition;
+        aLength = size_t(iLength - iLogicalPosition);
+        iLogicalPosition = iLength;
+        }
+    bool EndOfStream() const override { return iLogicalPosition >= iLength; }
+    void Seek(int64_t aPosition) override
+        {
+        iStatistics.AddSeek();
+        if (aPosition < 0)
+            throw KErrorIo;
+        if (aPosition > iLength)
+            throw KErrorEndOfData;
+        iLogicalPosition = aPosition;
+        }
+
+    /** Returns a pointer to the start of the mapped data. */
+    const uint8_t* Data() const { return iMapping->Data(); }
+    /** Returns the numbers of reads and seeks. The other statistics are zero because the data is not read into buffers. */
+    FileStatistics Statistics() const { return iStatistics.Statistics(); }
+    /** Sets the statistics to zero. */
+    void ResetStatistics() { iStatistics.Reset(); }
+
+    private:
+    /** A read-only mapping of a whole file, shared between copies of a stream. */
+    class Mapping
+        {
+        public:
+        static std::shared_ptr<Mapping> New(Result& aError,const std::string& aFileName)
+            {
+            aError = KErrorNone;
+            int fd = open(aFileName.c_str(),O_RDONLY);
+            if (fd == -1)
+                {
+                aError = KErrorNotFound;
+                return nullptr;
+                }
+            auto mapping = std::make_shared<Mapping>();
+            struct stat status;
+            if (fstat(fd,&status) != 0)
+                aError = KErrorIo;
+            else if (uint64_t(status.st_size) > SIZE_MAX)
+                aError = KErrorOverflow;
+            else if (status.st_size > 0)
+                {
+                void* p = mmap(nullptr,size_t(status.st_size),PROT_READ,MAP_SHARED,fd,0);
+                if (p == MAP_FAILED)
+                    aError = KErrorIo;
+                else
+                    {
+                    mapping->iData = (const uint8_t*)p;
+                    mapping->iLength = size_t(status.st_size);
+                    }
+                }
+            close(fd); // the mapping remains valid after the file descriptor is closed
+            if (aError)
+                return nullptr;
+            return mapping;
+            }
+
+        Mapping() = default;
+        ~Mapping()
+            {
+            if (iData)
+                munmap((void*)iData,iLength);
+            }
+        const uint8_t* Data() const { return iData; }
+        size_t Length() const { return iLength; }
+
+        Mapping(const Mapping&) = delete;
+        Mapping(Mapping&&) = delete;
+        void operator=(const Mapping&) = delete;
+        void operator=(Mapping&&) = delete;
+
+        private:
+        const uint8_t* iData = nullptr;
+        size_t iLength = 0;
+        };
+
+    MappedFileInputStream(std::shared_ptr<Mapping> aMapping,const std::string& aFileName)
+        {
+        Set(aMapping,aFileName);
+        }
+
+    void Set(std::shared_ptr<Mapping> aMapping,const std::string& aFileName)
+        {
+        iMapping = aMapping;
+        iName = aFileName;
+        iLength = int64_t(iMapping->Length());
+        }
+
+    std::shared_ptr<Mapping> iMapping;
+    FileStatisticsCounter iStatistics;
+    };
+#endif
+
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+/**
+A cache of buffers of data from a file, which can be shared by any number of threads.
+
+Data is read using positional reads, so only one file descriptor is needed.
+The buffers are divided between a number of stripes, each with its own lock and
+least-recently-used order, so that threads reading different parts of the file
+seldom wait for each other. Buffers are immutable once read, and a buffer that is
+in use by a stream stays valid even if it is evicted from the cache.
+*/
+class SharedFileBufferCache
+    {
+    public:
+    /** A buffer of data read from the file. */
+    class Buffer
+        {
+        public:
+        /** The byte offset in the file of the data in this buffer. */
+        int64_t Position = 0;
+        /** The data. It is shorter than the buffer size only at the end of the file. */
+        std::vector<uint8_t> Data;
+        };
+
+    /** The default number of stripes. */
+    static constexpr size_t KDefaultStripeCount = 16;
+
+    /**
+    Creates a shared cache for the file aFileName, using buffers of aBufferSize bytes.
+    At most aMaxBuffers buffers, rounded up to a multiple of the number of stripes, are kept.
+    Returns the result in aError.
+    */
+    static std::shared_ptr<SharedFileBufferCache> New(Result& aError,const std::string& aFileName,size_t aBufferSize,size_t aMaxBuffers,size_t aStripeCount = KDefaultStripeCount)
+        {
+        std::shared_ptr<SharedFileBufferCache> cache(new SharedFileBufferCache(aBufferSize,aMaxBuffers,aStripeCount));
+        aError = cache->iFile.Open(aFileName.c_str());
+        if (!aError)
+            aError = cache->iFile.Seek(0,SEEK_END);
+        if (aError)
+            return nullptr;
+        cache->iLength = cache->iFile.Tell();
+        cache->iName = aFileName;
+        return cache;
+        }
+
+    /**
+    Returns the buffer starting at aPosition, which must be a multiple of the buffer size,
+    reading it from the file if it is not in the cache. Throws KErrorIo if the data cannot be read.
+    Hits, misses, evictions and reads from the file are counted in aStatistics if it is non-null.
+    */
+    std::shared_ptr<const Buffer> Get(int64_t aPosition,FileStatisticsCounter* aStatistics = nullptr)
+        {
+        Stripe& stripe = iStripe[size_t(aPosition / int64_t(iBufferSize)) % iStripeCount];
+            {
+            std::lock_guard<std::mutex> lock(stripe.Mutex);
+            auto iter = stripe.Index.find(aPosition);
+            if (iter != stripe.Index.end())
+                {
+                stripe.Lru.splice(stripe.Lru.begin(),stripe.Lru,iter->second);
+                if (aStatistics)
+                    aStatistics->AddHit();
+                return *iter->second;
+                }
+            }
+        if (aStatistics)
+            aStatistics->AddMiss();
+
+        // Read the data without holding the lock so that other threads can use this stripe meanwhile.
+        auto buffer = std::make_shared<Buffer>();
+        buffer->Position = aPosition;
+        size_t bytes = size_t(std::min(int64_t(iBufferSize),std::max(iLength - aPosition,int64_t(0))));
+        buffer->Data.resize(bytes);
+        auto start_time = std::chrono::steady_clock::now();
+        if (iFile.ReadAt(buffer->Data.data(),bytes,aPosition) != bytes)
+            throw KErrorIo;
+        if (aStatistics)
+            aStatistics->AddIo(bytes,start_time);
+
+        std::lock_guard<std::mutex> lock(stripe.Mutex);
+        auto iter = stripe.Index.find(aPosition);
+        if (iter != stripe.Index.end()) // another thread read the same buffer meanwhile
+            return *iter->second;
+        if (stripe.Lru.size() >= iMaxBuffersPerStripe)
+            {
+            stripe.Index.erase(stripe.Lru.back()->Position);
+            stripe.Lru.pop_back();
+            if (aStatistics)
+                aStatistics->AddEviction();
+            }
+        stripe.Lru.push_front(buffer);
+        stripe.Index[aPosition] = stripe.Lru.begin();
+        return buffer;
+        }
+
+    /** Returns the length of the file in bytes. */
+    int64_t Length() const { return iLength; }
+    /** Returns the size of each buffer in bytes. */
+    size_t BufferSize() const { return iBufferSize; }
+    /** Returns the name of the file. */
+    const std::string& Name() const { return iName; }
+
+    SharedFileBufferCache(const SharedFileBufferCache&) = delete;
+    SharedFileBufferCache(SharedFileBufferCache&&) = delete;
+    void operator=(const SharedFileBufferCache&) = delete;
+    void operator=(SharedFileBufferCache&&) = delete;
+
+    private:
+    using BufferList = std::list<std::shared_ptr<const Buffer>>;
+
+    /** A part of the cache with its own lock. */
+    class Stripe
+        {
+        public:
+        std::mutex Mutex;
+        /** The buffers in this stripe, most recently used first. */
+        BufferList Lru;
+        /** An index from file positions to buffers. */
+        std::unordered_map<int64_t,BufferList::iterator> Index;
+        };
+
+    SharedFileBufferCache(size_t aBufferSize,size_t aMaxBuffers,size_t aStripeCount):
+        iBufferSize(std::max(aBufferSize,size_t(4))),
+        iStripeCount(std::max(aStripeCount,size_t(1))),
+        iMaxBuffersPerStripe(std::max((aMaxBuffers + iStripeCount - 1) / iStripeCount,size_t(1))),
+        iStripe(new Stripe[iStripeCount])
+        {
+        }
+
+    BinaryInputFile iFile;
+    size_t iBufferSize;
+    size_t iStripeCount;
+    size_t iMaxBuffersPerStripe;
+    std::unique_ptr<Stripe[]> iStripe;
+    int64_t iLength = 0;
+    std::string iName;
+    };
+
+/**
+A file input stream reading from a SharedFileBufferCache.
+Copies share the cache and the file descriptor, so a copy can be made cheaply
+for each thread that needs to read the file.
+*/
+class SharedFileInputStream: public FileInputStream
+    {
+    public:
+    /** Creates a SharedFileInputStream, with a new cache, to read from the file aFileName. Returns the result in aError. */
+    static std::unique_ptr<SharedFileInputStream> New(Result& aError,const std::string& aFileName,size_t aBufferSize = KDefaultBufferSize,size_t aMaxBuffers = KDefaultMaxBuffers)
+        {
+        std::shared_ptr<SharedFileBufferCache> cache = SharedFileBufferCache::New(aError,aFileName,aBufferSize,aMaxBuffers);
+        if (aError)
+            return nullptr;
+        return std::unique_ptr<SharedFileInputStream>(new SharedFileInputStream(cache));
+        }
+
+    /** Creates a SharedFileInputStream to read from an existing cache. */
+    explicit SharedFileInputStream(std::shared_ptr<SharedFileBufferCache> aCache):
+        iCache(aCache)
+        {
+        iName = iCache->Name();
+        iLength = iCache->Length();
+        iBufferSize = iCache->BufferSize();
+        }
+
+    /** Returns a copy of this SharedFileInputStream, sharing the same cache. */
+    std::unique_ptr<FileInputStream> Copy() override
+        {
+        return std::unique_ptr<FileInputStream>(new SharedFileInputStream(iCache));
+        }
+
+    // from MInputStream
+    void Read(const uint8_t*& aPointer,size_t& aLength) override
+        {
+        iStatistics.AddRead();
+        if (iLogicalPosition >= iLength)
+            {
+            aPointer = nullptr;
+            aLength = 0;
+            return;
+            }
+        int64_t offset = iLogicalPosition % int64_t(iBufferSize);
+        iCurrentBuffer = iCache->Get(iLogicalPosition - offset,&iStatistics);
+        aPointer = iCurrentBuffer->Data.data() + offset;
+        aLength = iCurrentBuffer->Data.size() - size_t(offset);
+        iLogicalPosition += aLength;
+        }
+    bool EndOfStream() const override { return iLogicalPosition >= iLength; }
+    void Seek(int64_t aPosition) override
+        {
+        iStatistics.AddSeek();
+        if (aPosition < 0)
+            throw KErrorIo;
+        if (aPosition > iLength)
+            throw KErrorEndOfData;
+        iLogicalPosition = aPosition;
+        }
+
+    /** Returns the shared cache. */
+    std::shared_ptr<SharedFileBufferCache> Cache() const { return iCache; }
+    /**
+    Returns the statistics for this stream. Cache hits, misses, evictions and reads from the file are those caused by this stream,
+    although the buffers are shared; add the statistics of all the streams sharing a cache to get the totals for the file.
+    */
+    FileStatistics Statistics() const { return iStatistics.Statistics(); }
+    /** Sets all the statistics to zero. */
+    void ResetStatistics() { iStatistics.Reset(); }
+
+    private:
+    std::shared_ptr<SharedFileBufferCache> iCache;
+    /** The buffer returned by the last call to Read, kept alive until the next call. */
+    std::shared_ptr<const SharedFileBufferCache::Buffer> iCurrentBuffer;
+    FileStatisticsCounter iStatistics;
+    };
+#endif
+
+#ifdef CARTOTYPE_DIRECT_FILE_IO
+/**
+A block of memory holding data read by a DirectFileReader. The memory is page-aligned,
+as direct I/O requires, and can be backed by huge pages to reduce TLB misses when
+large tables are accessed randomly.
+*/
+class DirectReadBuffer
+    {
+    public:
+    /** The size of a huge page on the platforms where huge pages are supported. */
+    static constexpr size_t KHugePageSize = 2 * 1024 * 1024;
+
+    ~DirectReadBuffer()
+        {
+        if (iMemory)
+            munmap(iMemory,iCapacity);
+        }
+
+    /** Returns a pointer to the data. */
+    const uint8_t* Data() const { return iMemory + iOffset; }
+    /** Returns the size of the data in bytes. */
+    size_t Size() const { return iSize; }
+    /** Returns true if the memory is backed by huge pages, or huge pages have been requested from the operating system. */
+    bool HugePages() const { return iHugePages; }
+
+    DirectReadBuffer(const DirectReadBuffer&) = delete;
+    DirectReadBuffer(DirectReadBuffer&&) = delete;
+    void operator=(const DirectReadBuffer&) = delete;
+    void operator=(DirectReadBuffer&&) = delete;
+
+    private:
+    friend class DirectFileReader;
+
+    DirectReadBuffer() = default;
+
+    /** Allocates at least aCapacity bytes, using huge pages if aHugePages is true and they are available. */
+    Result Allocate(size_t aCapacity,bool aHugePages)
+        {
+        void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        // Use reserved huge pages if there are any, otherwise ask for transparent huge pages.
+        if (aHugePages)
+            {
+            iCapacity = (aCapacity + KHugePageSize - 1) / KHugePageSize * KHugePageSize;
+            p = mmap(nullptr,iCapacity,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,-1,0);
+            iHugePages = p != MAP_FAILED;
+            }
+#endif
+        if (p == MAP_FAILED)
+            {
+            // Huge page rounding is not needed for ordinary pages.
+            iCapacity = aCapacity;
+            p = mmap(nullptr,iCapacity,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+            }
+        if (p == MAP_FAILED)
+            return KErrorNoMemory;
+#ifdef MADV_HUGEPAGE
+        if (aHugePages && !iHugePages)
+            iHugePages = madvise(p,iCapacity,MADV_HUGEPAGE) == 0;
+#endif
+        iMemory = (uint8_t*)p;
+        return KErrorNone;
+        }
+
+    uint8_t* iMemory = nullptr;
+    size_t iCapacity = 0;
+    size_t iOffset = 0;
+    size_t iSize = 0;
+    bool iHugePages = false;
+    };
+
+/**
+A reader for parts of a file which are read once, such as the index and header tables
+of a map file when it is loaded. Data is read using direct I/O, bypassing the page cache,
+into page-aligned buffers which can be backed by huge pages. If the file system does not
+support direct I/O the file is read normally and the pages read are then dropped
+from the page cache, so that loading many files does not evict other data.
+*/
+class DirectFileReader
+    {
+    public:
+    /** The alignment of file positions, lengths and memory addresses required for direct I/O. */
+    static constexpr size_t KAlignment = 4096;
+
+    /** Opens the file aFileName for direct reading. Returns the result in aError. */
+    static std::unique_ptr<DirectFileReader> New(Result& aError,const std::string& aFileName)
+        {
+        std::unique_ptr<DirectFileReader> reader(new DirectFileReader);
+        aError = reader->Open(aFileName);
+        if (aError)
+            return nullptr;
+        return reader;
+        }
+
+    ~DirectFileReader()
+        {
+        if (iFile != -1)
+            {
+#ifdef POSIX_FADV_DONTNEED
+            if (!iDirect)
+                posix_fadvise(iFile,0,0,POSIX_FADV_DONTNEED);
+#endif
+            close(iFile);
+            }
+        }
+
+    /**
+    Reads aLength bytes starting at aPosition into a new buffer, using huge pages if aHugePages is true.
+    Fewer bytes are returned if the end of the file is reached. Returns the result in aError.
+    */
+    std::unique_ptr<DirectReadBuffer> Read(Result& aError,int64_t aPosition,size_t aLength,bool aHugePages = false)
+        {
+        aError = KErrorNone;
+        if (aPosition < 0)
+            {
+            aError = KErrorIo;
+            return nullptr;
+            }
+        aLength = size_t(std::min(int64_t(aLength),std::max(iLength - aPosition,int64_t(0))));
+        int64_t start = aPosition / int64_t(KAlignment) * int64_t(KAlignment);
+        size_t offset = size_t(aPosition - start);
+        size_t bytes = (offset + aLength + KAlignment - 1) / KAlignment * KAlignment;
+
+        std::unique_ptr<DirectReadBuffer> buffer(new DirectReadBuffer);
+        aError = buffer->Allocate(std::max(bytes,KAlignment),aHugePages);
+        if (aError)
+            return nullptr;
+
+        // A direct read can stop short at the end of the file, which is not necessarily aligned.
+        errno = 0;
+        size_t bytes_read = ReadFileAt(iFile,buffer->iMemory,bytes,start);
+#ifdef O_DIRECT
+        /*
+        Some file systems accept O_DIRECT when the file is opened but reject the reads,
+        for example if the device block size is larger than KAlignment. Read such files normally.
+        */
+        if (bytes_read < offset + aLength && errno == EINVAL && iDirect)
+            {
+            int flags = fcntl(iFile,F_GETFL);
+            if (flags != -1 && fcntl(iFile,F_SETFL,flags & ~O_DIRECT) != -1)
+                {
+                iDirect = false;
+                bytes_read = ReadFileAt(iFile,buffer->iMemory,bytes,start);
+                }
+            }
+#endif
+        if (bytes_read < offset + aLength)
+            {
+            aError = KErrorIo;
+            return nullptr;
+            }
+#ifdef POSIX_FADV_DONTNEED
+        if (!iDirect)
+            posix_fadvise(iFile,start,off_t(bytes),POSIX_FADV_DONTNEED);
+#endif
+        buffer->iOffset = offset;
+        buffer->iSize = aLength;
+        return buffer;
+        }
+
+    /** Returns the length of the file in bytes. */
+    int64_t Length() const { return iLength; }
+    /** Returns true if the page cache is bypassed, or false if the file system does not support direct I/O. */
+    bool Direct() const { return iDirect; }
+
+    DirectFileReader(const DirectFileReader&) = delete;
+    DirectFileReader(DirectFileReader&&) = delete;
+    void operator=(const DirectFileReader&) = delete;
+    void operator=(DirectFileReader&&) = delete;
+
+    private:
+    DirectFileReader() = default;
+
+    Result Open(const std::string& aFileName)
+        {
+#ifdef O_DIRECT
+        iFile = open(aFileName.c_str(),O_RDONLY | O_DIRECT);
+        iDirect = iFile != -1;
+#endif
+        if (iFile == -1)
+            iFile = open(aFileName.c_str(),O_RDONLY);
+        if (iFile == -1)
+            return KErrorNotFound;
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+        iDirect = fcntl(iFile,F_NOCACHE,1) != -1;
+#endif
+        struct stat status;
+        if (fstat(iFile,&status) != 0)
+            return KErrorIo;
+        iLength = int64_t(status.st_size);
+        return KErrorNone;
+        }
+
+    int iFile = -1;
+    int64_t iLength = 0;
+    bool iDirect = false;
+    };
+#endif
+
+/** Parameters controlling the way OpenFileInputStream opens a file. */
+class FileInputStreamParam
+    {
+    public:
+    /** The size of each buffer in bytes. */
+    size_t BufferSize = FileInputStream::KDefaultBufferSize;
+    /** The maximum number of buffers. */
+    size_t MaxBuffers = FileInputStream::KDefaultMaxBuffers;
+    /**
+    If true, and the platform supports it, the whole file is mapped into memory
+    instead of being read into buffers. BufferSize and MaxBuffers are then ignored.
+    */
+    bool MemoryMapped = false;
+    /**
+    If true, and the platform supports positional reads, the file is read using a SharedFileBufferCache
+    so that copies of the stream made for other threads share the same file descriptor and buffers.
+    Ignored if MemoryMapped is true and the file is successfully mapped.
+    */
+    bool SharedBuffers = false;
+    /**
+    If greater than zero, sequential reading is detected and up to this number of
+    following buffers are prefetched in the background. Used only for buffered streams.
+    */
+    size_t ReadAheadBufferCount = 0;
+    };
+
+/**
+Opens a file for reading, using the method specified by aParam.
+Buffered files are read using a CachedFileInputStream.
+If memory mapping is requested but fails, for example because there is not enough
+address space for a very large file, the file is read using buffers instead.
+*/
+inline std::unique_ptr<FileInputStream> OpenFileInputStream(Result& aError,const std::string& aFileName,const FileInputStreamParam& aParam)
+    {
+#ifdef CARTOTYPE_MAPPED_FILE_IO
+    if (aParam.MemoryMapped)
+        {
+        std::unique_ptr<FileInputStream> stream = MappedFileInputStream::New(aError,aFileName);
+        if (!aError)
+            return stream;
+        }
+#endif
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+    if (aParam.SharedBuffers)
+        return SharedFileInputStream::New(aError,aFileName,aParam.BufferSize,aParam.MaxBuffers);
+#endif
+    std::unique_ptr<CachedFileInputStream> stream = CachedFileInputStream::New(aError,aFileName,aParam.BufferSize,aParam.MaxBuffers);
+    if (stream && aParam.ReadAheadBufferCount)
+        stream->SetReadAhead(aParam.ReadAheadBufferCount);
+    return stream;
+    }
+
+/**
+A simple file input stream that does not use seek when reading sequentially.
+If the first part of the filename, before any extensions, is '-', it reads from standard input.
+*/
+class SimpleFileInputStream: public MInputStream
+    {
+    public:
+    /** Creates a SimpleFileInputStream to read from the file aFileName. Returns the result in aError. */
+    static std::unique_ptr<SimpleFileInputStream> New(Result& aError,const std::string& aFileName,size_t aBufferSize = 64 * 1024);
+    /** Creates a SimpleFileInputStream to read from the file aFileName. Throws an exception if the file cannot be opened. */
+    SimpleFileInputStream(const std::string& aFileName,size_t aBufferSize = 64 * 1024);
+
+    void Read(const uint8_t*& aPointer,size_t& aLength) override;
+    bool EndOfStream() const override;
+    void Seek(int64_t aPosition) override;
+    int64_t Position() override;
+    int64_t Length() override;
+    std::string Name() override { return iName; }
+
+    private:
+    BinaryInputFile iFile;
     std::vector<uint8_t> iBuffer;
     std::string iName;
     int64_t iLength = -1;
@@ -714,6 +2335,140 @@ class FileOutputStream: public OpenFileOutputStream
     ~FileOutputStream();
     };
 
+#ifdef CARTOTYPE_VECTORED_FILE_IO
+/**
+An output stream to write to a file using large blocks. Data is collected in a buffer
+and written when the buffer is full. A block too large for the buffer is written together
+with the buffered data in a single writev call, without being copied.
+The destructor flushes the buffer and closes the file.
+*/
+class VectoredFileOutputStream: public MOutputStream
+    {
+    public:
+    /** The default buffer size in bytes. */
+    static constexpr size_t KDefaultBufferSize = 256 * 1024;
+
+    /** Creates a VectoredFileOutputStream to write to the file aFileName, replacing any existing file. Returns the result in aError. */
+    static std::unique_ptr<VectoredFileOutputStream> New(Result& aError,const std::string& aFileName,size_t aBufferSize = KDefaultBufferSize)
+        {
+        aError = KErrorNone;
+        int file = open(aFileName.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0666);
+        if (file == -1)
+            {
+            aError = KErrorIo;
+            return nullptr;
+            }
+        return std::unique_ptr<VectoredFileOutputStream>(new VectoredFileOutputStream(file,aBufferSize));
+        }
+
+    /** Creates a VectoredFileOutputStream to write to the file aFileName, replacing any existing file. Throws an exception if the file cannot be opened. */
+    explicit VectoredFileOutputStream(const std::string& aFileName,size_t aBufferSize = KDefaultBufferSize):
+        VectoredFileOutputStream(open(aFileName.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0666),aBufferSize)
+        {
+        if (iFile == -1)
+            throw KErrorIo;
+        }
+
+    /** Flushes the buffer, ignoring errors, and closes the file. */
+    ~VectoredFileOutputStream()
+        {
+        if (iFile != -1)
+            {
+            try
+                {
+                Flush();
+                }
+            catch (...)
+                {
+                }
+            close(iFile);
+            }
+        }
+
+    void Write(const uint8_t* aBuffer,size_t aBytes) override
+        {
+        if (aBytes <= iBufferSize - iBuffer.size())
+            {
+            iBuffer.insert(iBuffer.end(),aBuffer,aBuffer + aBytes);
+            return;
+            }
+        if (aBytes < iBufferSize)
+            {
+            Flush();
+            iBuffer.insert(iBuffer.end(),aBuffer,aBuffer + aBytes);
+            return;
+            }
+        iovec block[2];
+        block[0].iov_base = iBuffer.data();
+        block[0].iov_len = iBuffer.size();
+        block[1].iov_base = (void*)aBuffer;
+        block[1].iov_len = aBytes;
+        WriteBlocks(block,2);
+        iBuffer.clear();
+        }
+
+    /** Writes any buffered data to the file. Throws KErrorIo if the data cannot be written. */
+    void Flush()
+        {
+        if (iBuffer.empty())
+            return;
+        iovec block;
+        block.iov_base = iBuffer.data();
+        block.iov_len = iBuffer.size();
+        WriteBlocks(&block,1);
+        iBuffer.clear();
+        }
+
+    /** Returns the current position in the file, including buffered data, as a byte offset relative to the start of the file. */
+    int64_t Position() const { return iPosition + int64_t(iBuffer.size()); }
+
+    VectoredFileOutputStream(const VectoredFileOutputStream&) = delete;
+    VectoredFileOutputStream(VectoredFileOutputStream&&) = delete;
+    void operator=(const VectoredFileOutputStream&) = delete;
+    void operator=(VectoredFileOutputStream&&) = delete;
+
+    private:
+    VectoredFileOutputStream(int aFile,size_t aBufferSize):
+        iFile(aFile),
+        iBufferSize(std::max(aBufferSize,size_t(1)))
+        {
+        iBuffer.reserve(iBufferSize);
+        }
+
+    /** Writes all the data in aBlock, retrying after partial writes. */
+    void WriteBlocks(iovec* aBlock,int aBlockCount)
+        {
+        while (aBlockCount)
+            {
+            ssize_t n = writev(iFile,aBlock,aBlockCount);
+            if (n < 0)
+                {
+                if (errno == EINTR)
+                    continue;
+                throw KErrorIo;
+                }
+            iPosition += n;
+            while (aBlockCount && size_t(n) >= aBlock->iov_len)
+                {
+                n -= ssize_t(aBlock->iov_len);
+                aBlock++;
+                aBlockCount--;
+                }
+            if (aBlockCount)
+                {
+                aBlock->iov_base = (uint8_t*)aBlock->iov_base + n;
+                aBlock->iov_len -= size_t(n);
+                }
+            }
+        }
+
+    int iFile = -1;
+    size_t iBufferSize;
+    std::vector<uint8_t> iBuffer;
+    int64_t iPosition = 0;
+    };
+#endif
+
 /**
 Output stream for a buffer in memory. The caller specifies the initial size of the buffer,
 which is automatically enlarged when necessary.
@@ -0,0 +1,182 @@
+/*
+cartotype_style_cache.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_expression.h>
+#include <cartotype_feature_info.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+namespace CartoTypeCore
+{
+
+/**
+A cache of the outcome of style sheet rules for map objects, used to avoid evaluating the same conditions for every object in every frame.
+
+Most style sheet conditions refer only to the object's layer and feature info (@feature_type, @sub_type and @),
+and to style sheet variables. For such conditions the outcome is the same for every object of the same type with the same
+layer and feature info drawn at the same scale, so it is stored under the key (condition, layer, object type, feature info, scale band).
+The condition is identified by a number chosen by the caller, such as the index of the rule in the style sheet, so that
+the outcomes of different conditions for the same object are kept apart. A scale band is the range of scales between
+two adjacent scale limits used by the style sheet, so objects in the same band are drawn in the same way.
+Conditions referring to string attributes cannot be cached and must be evaluated for each object.
+
+The cache does not know when the style sheet or the style sheet variables change: its owner must call Invalidate
+whenever they do, and before the condition numbers are reused for different conditions.
+*/
+class StyleResolutionCache
+    {
+    public:
+    /** Statistics about the use of the cache. */
+    class Statistics
+        {
+        public:
+        /** Returns the proportion of lookups that found an entry, in the range 0...1. */
+        double HitRate() const { return Hits + Misses ? double(Hits) / double(Hits + Misses) : 0; }
+
+        /** The number of lookups that found an entry. */
+        uint64_t Hits = 0;
+        /** The number of lookups that did not find an entry. */
+        uint64_t Misses = 0;
+        /** The number of entries in the cache. */
+        size_t EntryCount = 0;
+        /** The number of times the cache has been invalidated. */
+        uint64_t Invalidations = 0;
+        };
+
+    /** Creates a cache holding up to aMaxEntries outcomes; if it becomes full it is emptied. */
+    explicit StyleResolutionCache(size_t aMaxEntries = 65536):
+        iMaxEntries(aMaxEntries)
+        {
+        }
+
+    /**
+    Returns true if the outcome of the condition aExpression depends only on the layer, feature info and scale.
+    aIsStyleSheetVariable is called for names not starting with '@', and returns true if the name is a style sheet variable
+    rather than a string attribute of the object.
+    */
+    template<class IsStyleSheetVariable> static bool IsCacheable(const RpnExpression& aExpression,IsStyleSheetVariable aIsStyleSheetVariable)
+        {
+        for (const auto& op : aExpression.Exp)
+            {
+            if (op.Type != ExpressionOpType::Variable)
+                continue;
+            if (op.String.Length() && op.String[0] == '@')
+                {
+                if (op.String.Compare("@") && op.String.Compare("@feature_type") && op.String.Compare("@sub_type") && op.String.Compare("@layer"))
+                    return false;
+                }
+            else if (!op.String.Length() || !aIsStyleSheetVariable(op.String))
+                return false;
+            }
+        return true;
+        }
+
+    /**
+    Sets the scale limits used by the style sheet, as scale denominators; they are used to divide scales into bands.
+    The cache is invalidated because scale bands may have changed.
+    */
+    void SetScaleLimits(std::vector<double> aScaleLimits)
+        {
+        std::sort(aScaleLimits.begin(),aScaleLimits.end());
+        aScaleLimits.erase(std::unique(aScaleLimits.begin(),aScaleLimits.end()),aScaleLimits.end());
+        std::lock_guard<std::mutex> lock(iMutex);
+        iScaleLimit = std::move(aScaleLimits);
+        iOutcome.clear();
+        iStatistics.Invalidations++;
+        }
+
+    /** Returns the scale band containing the scale denominator aScale. */
+    uint32_t ScaleBand(double aScale) const
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        return uint32_t(std::upper_bound(iScaleLimit.begin(),iScaleLimit.end(),aScale) - iScaleLimit.begin());
+        }
+
+    /**
+    Finds the outcome of the condition aCondition for an object of type aObjectType in the layer with index aLayer,
+    with the feature info aFeatureInfo, drawn in the scale band aScaleBand. Returns true and sets aOutcome if it is found.
+    */
+    bool Find(uint32_t aCondition,uint32_t aLayer,MapObjectType aObjectType,FeatureInfo aFeatureInfo,uint32_t aScaleBand,uint32_t& aOutcome)
+        {
+        TKey key(aCondition,aLayer,aObjectType,aFeatureInfo,aScaleBand);
+        std::lock_guard<std::mutex> lock(iMutex);
+        auto p = iOutcome.find(key);
+        if (p == iOutcome.end())
+            {
+            iStatistics.Misses++;
+            return false;
+            }
+        iStatistics.Hits++;
+        aOutcome = p->second;
+        return true;
+        }
+
+    /**
+    Stores the outcome of the condition aCondition for an object of type aObjectType in the layer with index aLayer,
+    with the feature info aFeatureInfo, drawn in the scale band aScaleBand.
+    */
+    void Insert(uint32_t aCondition,uint32_t aLayer,MapObjectType aObjectType,FeatureInfo aFeatureInfo,uint32_t aScaleBand,uint32_t aOutcome)
+        {
+        TKey key(aCondition,aLayer,aObjectType,aFeatureInfo,aScaleBand);
+        std::lock_guard<std::mutex> lock(iMutex);
+        if (iOutcome.size() >= iMaxEntries)
+            iOutcome.clear();
+        iOutcome[key] = aOutcome;
+        }
+
+    /** Removes all the outcomes. Call this when the style sheet or the style sheet variables change. */
+    void Invalidate()
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        iOutcome.clear();
+        iStatistics.Invalidations++;
+        }
+
+    /** Returns statistics about the use of the cache. */
+    Statistics CacheStatistics() const
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        Statistics s = iStatistics;
+        s.EntryCount = iOutcome.size();
+        return s;
+        }
+
+    private:
+    class TKey
+        {
+        public:
+        TKey(uint32_t aCondition,uint32_t aLayer,MapObjectType aObjectType,FeatureInfo aFeatureInfo,uint32_t aScaleBand):
+            iConditionAndLayer(uint64_t(aCondition) << 32 | aLayer),
+            iRest(uint64_t(aScaleBand) << 40 | uint64_t(uint8_t(aObjectType)) << 32 | aFeatureInfo.RawValue())
+            {
+            }
+        bool operator==(const TKey& aOther) const { return iConditionAndLayer == aOther.iConditionAndLayer && iRest == aOther.iRest; }
+
+        uint64_t iConditionAndLayer;
+        uint64_t iRest;
+        };
+
+    class TKeyHash
+        {
+        public:
+        size_t operator()(const TKey& aKey) const
+            {
+            uint64_t h = (aKey.iConditionAndLayer ^ aKey.iRest * 0x9E3779B97F4A7C15ULL) * 0xBF58476D1CE4E5B9ULL;
+            return size_t(h ^ (h >> 31));
+            }
+        };
+
+    mutable std::mutex iMutex;
+    size_t iMaxEntries;
+    std::vector<double> iScaleLimit;
+    std::unordered_map<TKey,uint32_t,TKeyHash> iOutcome;
+    Statistics iStatistics;
+    };
+
+}
@@ -0,0 +1,432 @@
+/*
+cartotype_text_cache.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_graphics_context.h>
+#include <array>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace CartoTypeCore
+{
+
+/** Statistics about the use of a cache. */
+class TextCacheStatistics
+    {
+    public:
+    /** Returns the proportion of lookups that found an entry, in the range 0...1. */
+    double HitRate() const { return Hits + Misses ? double(Hits) / double(Hits + Misses) : 0; }
+
+    /** The number of lookups that found an entry. */
+    uint64_t Hits = 0;
+    /** The number of lookups that did not find an entry. */
+    uint64_t Misses = 0;
+    /** The number of entries removed to make room for new ones. */
+    uint64_t Evictions = 0;
+    /** The number of entries in the cache. */
+    size_t EntryCount = 0;
+    /** The total size of the entries in bytes, as given when they were inserted. */
+    size_t Bytes = 0;
+    };
+
+/**
+The key of a shaped text run: the text, the font specification, and the text parameters which affect
+shaping and bidirectional reordering. The font color is not part of the key, because a run shaped
+in one color can be drawn in any other. The path, if any, is not part of the key, so text drawn along a path,
+or copy-fitted to one, and rich text using the Fonts array of TextParam, should not be cached using this key.
+*/
+class TextRunKey
+    {
+    public:
+    TextRunKey() = default;
+    /** Creates the key for the text aText drawn using aFontSpec and aParam. */
+    TextRunKey(const MString& aText,const FontSpec& aFontSpec,const TextParam& aParam):
+        Text((const char16_t*)aText.Data(),aText.Length()),
+        Typeface((const char16_t*)aFontSpec.Attrib.Name.Data(),aFontSpec.Attrib.Name.Length()),
+        Style(aFontSpec.Attrib.Style),
+        Scripts(aFontSpec.Attrib.Scripts),
+        Flags(aFontSpec.Instance.Flags),
+        Size(aFontSpec.Instance.Size),
+        Transform { { aFontSpec.Instance.Transform.A(),aFontSpec.Instance.Transform.B(),aFontSpec.Instance.Transform.C(),
+                      aFontSpec.Instance.Transform.D(),aFontSpec.Instance.Transform.Tx(),aFontSpec.Instance.Transform.Ty() } },
+        MaxWidth(aParam.MaxWidth),
+        Baseline(aParam.Baseline),
+        BaselineOffset(aParam.BaselineOffset),
+        LetterSpacing(aParam.LetterSpacing),
+        WordSpacing(aParam.WordSpacing)
+        {
+        }
+
+    /** The equality operator. */
+    bool operator==(const TextRunKey& aOther) const
+        {
+        return Text == aOther.Text && Typeface == aOther.Typeface && Style == aOther.Style && Scripts == aOther.Scripts &&
+               Flags == aOther.Flags && Size == aOther.Size && Transform == aOther.Transform &&
+               MaxWidth == aOther.MaxWidth && Baseline == aOther.Baseline && BaselineOffset == aOther.BaselineOffset &&
+               LetterSpacing == aOther.LetterSpacing && WordSpacing == aOther.WordSpacing;
+        }
+    /** The inequality operator. */
+    bool operator!=(const TextRunKey& aOther) const { return !(*this == aOther); }
+
+    /** Returns a hash value for use in unordered containers, using the FNV-1a algorithm. */
+    size_t Hash() const
+        {
+        uint64_t hash = 14695981039346656037ULL;
+        auto add = [&hash](const void* aData,size_t aLength)
+            {
+            const uint8_t* p = (const uint8_t*)aData;
+            for (size_t i = 0; i < aLength; i++)
+                hash = (hash ^ p[i]) * 1099511628211ULL;
+            };
+        add(Text.data(),Text.length() * sizeof(char16_t));
+        add(Typeface.data(),Typeface.length() * sizeof(char16_t));
+        add(&Style,sizeof(Style));
+        add(&Scripts,sizeof(Scripts));
+        add(&Flags,sizeof(Flags));
+        add(&Size,sizeof(Size));
+        add(Transform.data(),sizeof(Transform));
+        add(&MaxWidth,sizeof(MaxWidth));
+        add(&Baseline,sizeof(Baseline));
+        add(&BaselineOffset,sizeof(BaselineOffset));
+        add(&LetterSpacing,sizeof(LetterSpacing));
+        add(&WordSpacing,sizeof(WordSpacing));
+        return size_t(hash);
+        }
+
+    /** The text. */
+    std::u16string Text;
+    /** The name of the typeface. */
+    std::u16string Typeface;
+    /** The typeface style. */
+    uint32_t Style = 0;
+    /** The scripts required of the typeface. */
+    uint32_t Scripts = 0;
+    /** The typeface instance flags. */
+    uint32_t Flags = 0;
+    /** The size in pixels per em. */
+    double Size = 0;
+    /** The font transform, as the parameters A, B, C, D, Tx and Ty. */
+    std::array<double,6> Transform { };
+    /** The maximum width of the text. */
+    int32_t MaxWidth = INT32_MAX;
+    /** The baseline used to align the text. */
+    TextBaseline Baseline = TextBaseline::Alphabetic;
+    /** The baseline offset in pixels. */
+    double BaselineOffset = 0;
+    /** The letter spacing in pixels. */
+    double LetterSpacing = 0;
+    /** The word spacing in pixels. */
+    double WordSpacing = 0;
+    };
+
+/** The hash function for TextRunKey, for use as the third template argument of LruCache. */
+class TextRunKeyHash
+    {
+    public:
+    size_t operator()(const TextRunKey& aKey) const { return aKey.Hash(); }
+    };
+
+/**
+A thread-safe cache with a bounded total size, from which the least recently used entries are evicted.
+It is intended for caching shaped text runs, using TextRunKey and TextRunKeyHash as the key and hash function,
+so that labels drawn repeatedly, such as street names in adjacent tiles, are not shaped and reordered again.
+Values are held by shared pointers so that an entry can be used after it has been evicted.
+*/
+template<class K,class V,class H = std::hash<K>> class LruCache
+    {
+    public:
+    /** Creates a cache holding entries with a total size of up to aMaxBytes bytes. */
+    explicit LruCache(size_t aMaxBytes): iMaxBytes(aMaxBytes) { }
+
+    /** Returns the entry with the key aKey, or null if there is none, and makes it the most recently used entry. */
+    std::shared_ptr<const V> Find(const K& aKey)
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        auto p = iIndex.find(aKey);
+        if (p == iIndex.end())
+            {
+            iStatistics.Misses++;
+            return nullptr;
+            }
+        iStatistics.Hits++;
+        iList.splice(iList.begin(),iList,p->second);
+        return p->second->iValue;
+        }
+
+    /**
+    Inserts aValue, which takes up aBytes bytes, with the key aKey, replacing any existing entry with that key,
+    then evicts the least recently used entries until the total size is within the limit.
+    */
+    void Insert(const K& aKey,std::shared_ptr<const V> aValue,size_t aBytes)
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        auto p = iIndex.find(aKey);
+        if (p != iIndex.end())
+            {
+            iStatistics.Bytes -= p->second->iBytes;
+            iList.erase(p->second);
+            iIndex.erase(p);
+            }
+        iList.push_front(TEntry { aKey,std::move(aValue),aBytes });
+        iIndex[aKey] = iList.begin();
+        iStatistics.Bytes += aBytes;
+        Trim();
+        }
+
+    /** Sets the maximum total size of the entries, evicting entries if necessary. */
+    void SetMaxBytes(size_t aMaxBytes)
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        iMaxBytes = aMaxBytes;
+        Trim();
+        }
+
+    /** Removes all the entries. */
+    void Clear()
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        iList.clear();
+        iIndex.clear();
+        iStatistics.Bytes = 0;
+        }
+
+    /** Returns statistics about the use of the cache. */
+    TextCacheStatistics Statistics() const
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        TextCacheStatistics s = iStatistics;
+        s.EntryCount = iList.size();
+        return s;
+        }
+
+    /** Resets the hit, miss and eviction counts to zero. */
+    void ResetStatistics()
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        iStatistics.Hits = iStatistics.Misses = iStatistics.Evictions = 0;
+        }
+
+    private:
+    class TEntry
+        {
+        public:
+        K iKey;
+        std::shared_ptr<const V> iValue;
+        size_t iBytes;
+        };
+
+    void Trim()
+        {
+        // Keep the most recent entry even if it is larger than the limit.
+        while (iStatistics.Bytes > iMaxBytes && iList.size() > 1)
+            {
+            iStatistics.Bytes -= iList.back().iBytes;
+            iIndex.erase(iList.back().iKey);
+            iList.pop_back();
+            iStatistics.Evictions++;
+            }
+        }
+
+    mutable std::mutex iMutex;
+    size_t iMaxBytes;
+    std::list<TEntry> iList;
+    std::unordered_map<K,typename std::list<TEntry>::iterator,H> iIndex;
+    TextCacheStatistics iStatistics;
+    };
+
+/**
+An atlas of anti-aliased (A8) glyph images packed into large bitmaps, or pages, in rows ('shelves') of similar height.
+If it is shared by several frameworks, a glyph is rasterized only once whichever framework draws it first.
+When all the pages are full the least recently used page is cleared and reused. The class is thread-safe.
+*/
+template<class K,class H = std::hash<K>> class GlyphAtlas
+    {
+    public:
+    /** The position of a glyph in the atlas. The page is kept in memory as long as the entry exists. */
+    class Entry
+        {
+        public:
+        /** Returns a view of the glyph image. */
+        BitmapView View() const { return Page ? Page->View(Bounds) : BitmapView(BitmapType::A8,nullptr,0,0,0); }
+
+        /** The page containing the glyph. */
+        std::shared_ptr<Bitmap> Page;
+        /** The bounds of the glyph in the page. */
+        Rect Bounds;
+        };
+
+    /** Creates an atlas of up to aMaxPages pages, each aPageSize pixels square. The page size is at least 2 and the number of pages at least 1. */
+    GlyphAtlas(int32_t aPageSize = 1024,size_t aMaxPages = 4):
+        iPageSize(std::max(aPageSize,2)),
+        iMaxPages(std::max(aMaxPages,size_t(1)))
+        {
+        }
+
+    /** Finds the glyph with the key aKey. Returns true and sets aEntry if it is found. */
+    bool Find(const K& aKey,Entry& aEntry)
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        auto p = iIndex.find(aKey);
+        if (p == iIndex.end())
+            {
+            iStatistics.Misses++;
+            return false;
+            }
+        iStatistics.Hits++;
+        TPage& page = *iPage[p->second.iPage];
+        page.iLastUse = ++iClock;
+        aEntry.Page = page.iBitmap;
+        aEntry.Bounds = p->second.iBounds;
+        return true;
+        }
+
+    /**
+    Copies the A8 glyph image aGlyph into the atlas with the key aKey and sets aEntry to its position.
+    Returns false, leaving the atlas unchanged, if the glyph is not an A8 bitmap or is too large for a page.
+    */
+    bool Insert(const K& aKey,const BitmapView& aGlyph,Entry& aEntry)
+        {
+        // Each glyph takes up one more pixel than its size in each direction, for the gap between glyphs.
+        if (aGlyph.Type() != BitmapType::A8 || aGlyph.Width() > iPageSize - 1 || aGlyph.Height() > iPageSize - 1)
+            return false;
+        std::lock_guard<std::mutex> lock(iMutex);
+        auto p = iIndex.find(aKey);
+        if (p != iIndex.end())
+            {
+            TPage& page = *iPage[p->second.iPage];
+            aEntry.Page = page.iBitmap;
+            aEntry.Bounds = p->second.iBounds;
+            return true;
+            }
+
+        // Leave a one-pixel gap between glyphs so that filtering does not pick up neighboring glyphs.
+        int32_t width = aGlyph.Width() + 1;
+        int32_t height = aGlyph.Height() + 1;
+        Point position;
+        size_t page_index = 0;
+        while (page_index < iPage.size() && !Allocate(*iPage[page_index],width,height,position))
+            page_index++;
+        if (page_index == iPage.size())
+            {
+            if (iPage.size() < iMaxPages)
+                iPage.push_back(std::make_unique<TPage>());
+            else
+                page_index = LeastRecentlyUsedPage();
+            ResetPage(page_index);
+            if (!Allocate(*iPage[page_index],width,height,position))
+                return false;
+            }
+
+        TPage& page = *iPage[page_index];
+        page.iLastUse = ++iClock;
+        Rect bounds(position.X,position.Y,position.X + aGlyph.Width(),position.Y + aGlyph.Height());
+        for (int32_t y = 0; y < aGlyph.Height(); y++)
+            memcpy(page.iBitmap->Data() + size_t(position.Y + y) * page.iBitmap->RowBytes() + position.X,
+                   aGlyph.Data() + size_t(y) * aGlyph.RowBytes(),size_t(aGlyph.Width()));
+        iIndex[aKey] = TLocation { page_index,bounds };
+        page.iKeys.push_back(aKey);
+        aEntry.Page = page.iBitmap;
+        aEntry.Bounds = bounds;
+        return true;
+        }
+
+    /** Returns statistics about the use of the atlas. Bytes is the memory used by the pages. */
+    TextCacheStatistics Statistics() const
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        TextCacheStatistics s = iStatistics;
+        s.EntryCount = iIndex.size();
+        s.Bytes = iPage.size() * size_t(iPageSize) * size_t(iPageSize);
+        return s;
+        }
+
+    private:
+    class TShelf
+        {
+        public:
+        int32_t iY = 0;
+        int32_t iHeight = 0;
+        int32_t iUsedWidth = 0;
+        };
+
+    class TPage
+        {
+        public:
+        std::shared_ptr<Bitmap> iBitmap;
+        std::vector<TShelf> iShelf;
+        int32_t iUsedHeight = 0;
+        uint64_t iLastUse = 0;
+        std::vector<K> iKeys;
+        };
+
+    class TLocation
+        {
+        public:
+        size_t iPage;
+        Rect iBounds;
+        };
+
+    bool Allocate(TPage& aPage,int32_t aWidth,int32_t aHeight,Point& aPosition)
+        {
+        // Use the first shelf that is tall enough but not much taller, to avoid wasting space.
+        for (auto& shelf : aPage.iShelf)
+            {
+            if (aHeight <= shelf.iHeight && aHeight * 4 >= shelf.iHeight * 3 && shelf.iUsedWidth + aWidth <= iPageSize)
+                {
+                aPosition = Point(shelf.iUsedWidth,shelf.iY);
+                shelf.iUsedWidth += aWidth;
+                return true;
+                }
+            }
+        if (aPage.iUsedHeight + aHeight > iPageSize)
+            return false;
+        TShelf shelf;
+        shelf.iY = aPage.iUsedHeight;
+        shelf.iHeight = aHeight;
+        shelf.iUsedWidth = aWidth;
+        aPage.iShelf.push_back(shelf);
+        aPage.iUsedHeight += aHeight;
+        aPosition = Point(0,shelf.iY);
+        return true;
+        }
+
+    size_t LeastRecentlyUsedPage() const
+        {
+        size_t lru = 0;
+        for (size_t i = 1; i < iPage.size(); i++)
+            if (iPage[i]->iLastUse < iPage[lru]->iLastUse)
+                lru = i;
+        return lru;
+        }
+
+    void ResetPage(size_t aIndex)
+        {
+        TPage& page = *iPage[aIndex];
+        for (const auto& key : page.iKeys)
+            iIndex.erase(key);
+        iStatistics.Evictions += page.iKeys.size();
+        page.iKeys.clear();
+        page.iShelf.clear();
+        page.iUsedHeight = 0;
+        // Glyphs in the old page may still be in use, so make a new bitmap rather than clearing the old one.
+        page.iBitmap = std::make_shared<Bitmap>(BitmapType::A8,iPageSize,iPageSize);
+        page.iBitmap->Clear();
+        }
+
+    mutable std::mutex iMutex;
+    int32_t iPageSize;
+    size_t iMaxPages;
+    std::vector<std::unique_ptr<TPage>> iPage;
+    std::unordered_map<K,TLocation,H> iIndex;
+    uint64_t iClock = 0;
+    TextCacheStatistics iStatistics;
+    };
+
+}
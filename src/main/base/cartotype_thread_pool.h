@@ -0,0 +1,274 @@
+/*
+cartotype_thread_pool.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_errors.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CartoTypeCore
+{
+
+class TaskGroup;
+
+/**
+A pool of worker threads that run tasks using work stealing.
+
+Each worker has its own queue. Tasks are distributed among the queues in turn;
+a worker takes tasks from the back of its own queue, and when that is empty it
+takes tasks from the front of the other queues, so that slow tasks, such as
+tiles with a lot of detail, do not leave other workers idle.
+
+Each task is passed the index of the worker running it, in the range 0...ThreadCount() - 1,
+which allows it to use per-worker state, such as a graphics context, without locking.
+
+If a task throws an exception it is caught on the worker thread and thrown again by the
+next call to Wait, or to TaskGroup::Wait if the task was submitted using a TaskGroup.
+If several tasks throw, only the first exception is kept.
+
+Wait must not be called by a task running on the same pool, because it would wait for itself:
+it throws KErrorGeneral if it is.
+*/
+class ThreadPool
+    {
+    public:
+    /** A task run by a worker thread. The argument is the index of the worker. */
+    using Task = std::function<void(size_t aWorker)>;
+
+    /** Creates a pool of aThreadCount threads. If aThreadCount is zero the number of hardware threads is used. */
+    explicit ThreadPool(size_t aThreadCount = 0)
+        {
+        if (aThreadCount == 0)
+            aThreadCount = std::max(std::thread::hardware_concurrency(),1U);
+        iQueue.reserve(aThreadCount);
+        for (size_t i = 0; i < aThreadCount; i++)
+            iQueue.push_back(std::make_unique<TQueue>());
+        iThread.reserve(aThreadCount);
+        for (size_t i = 0; i < aThreadCount; i++)
+            iThread.emplace_back([this,i] { Run(i); });
+        }
+
+    /** Waits for all tasks to finish, then stops the worker threads. Exceptions thrown by tasks and not yet rethrown are discarded. */
+    ~ThreadPool()
+        {
+            {
+            std::unique_lock<std::mutex> lock(iMutex);
+            iWorkDone.wait(lock,[this] { return iTotalPending == 0; });
+            iStop = true;
+            }
+        iWorkAvailable.notify_all();
+        for (auto& t : iThread)
+            t.join();
+        }
+
+    /** Adds a task to the pool. Throws KErrorInvalidArgument if aTask is empty. */
+    void Submit(Task aTask) { Submit(std::move(aTask),iGroup); }
+
+    /**
+    Waits until all tasks submitted using Submit have finished, then throws the first exception thrown by any of them.
+    Tasks submitted using a TaskGroup are not waited for.
+    */
+    void Wait() { Wait(iGroup); }
+
+    /** Returns the number of worker threads. */
+    size_t ThreadCount() const { return iThread.size(); }
+
+    /** Returns true if the current thread is one of the workers of this pool. */
+    bool IsWorkerThread() const { return CurrentPool() == this; }
+
+    /**
+    Returns the index passed to tasks running on the current thread if it is one of the workers of this pool,
+    otherwise ThreadCount(), which no worker uses.
+    */
+    size_t WorkerIndex() const { return IsWorkerThread() ? CurrentWorker() : ThreadCount(); }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+    void operator=(const ThreadPool&) = delete;
+    void operator=(ThreadPool&&) = delete;
+
+    private:
+    friend class TaskGroup;
+
+    /** The tasks submitted together, which are waited for together. Guarded by iMutex. */
+    class TGroup
+        {
+        public:
+        size_t iPending = 0; // tasks submitted but not finished
+        std::exception_ptr iException;
+        };
+
+    class TTask
+        {
+        public:
+        Task iTask;
+        TGroup* iGroup = nullptr;
+        };
+
+    class TQueue
+        {
+        public:
+        std::mutex iMutex;
+        std::deque<TTask> iTask;
+        };
+
+    static const ThreadPool*& CurrentPool()
+        {
+        static thread_local const ThreadPool* pool = nullptr;
+        return pool;
+        }
+
+    static size_t& CurrentWorker()
+        {
+        static thread_local size_t worker = 0;
+        return worker;
+        }
+
+    void Submit(Task aTask,TGroup& aGroup)
+        {
+        if (!aTask)
+            throw KErrorInvalidArgument;
+        size_t q = iNextQueue.fetch_add(1,std::memory_order_relaxed) % iQueue.size();
+            {
+            std::lock_guard<std::mutex> lock(iQueue[q]->iMutex);
+            iQueue[q]->iTask.push_back(TTask { std::move(aTask),&aGroup });
+            }
+            {
+            std::lock_guard<std::mutex> lock(iMutex);
+            aGroup.iPending++;
+            iTotalPending++;
+            iQueued++;
+            }
+        iWorkAvailable.notify_one();
+        }
+
+    void Wait(TGroup& aGroup)
+        {
+        if (IsWorkerThread())
+            throw KErrorGeneral;
+        std::exception_ptr exception;
+            {
+            std::unique_lock<std::mutex> lock(iMutex);
+            iWorkDone.wait(lock,[&aGroup] { return aGroup.iPending == 0; });
+            std::swap(exception,aGroup.iException);
+            }
+        if (exception)
+            std::rethrow_exception(exception);
+        }
+
+    /** Waits for the tasks in aGroup to finish without throwing, for use by destructors. */
+    void WaitNoThrow(TGroup& aGroup)
+        {
+        std::unique_lock<std::mutex> lock(iMutex);
+        iWorkDone.wait(lock,[&aGroup] { return aGroup.iPending == 0; });
+        aGroup.iException = nullptr;
+        }
+
+    void Run(size_t aWorker)
+        {
+        CurrentPool() = this;
+        CurrentWorker() = aWorker;
+        for (;;)
+            {
+                {
+                std::unique_lock<std::mutex> lock(iMutex);
+                iWorkAvailable.wait(lock,[this] { return iStop || iQueued > 0; });
+                if (iQueued == 0)
+                    return;
+                iQueued--;
+                }
+
+            // A task has been reserved for this worker; find it, looking in the worker's own queue first.
+            TTask task;
+            for (size_t i = 0; !task.iGroup; i = (i + 1) % iQueue.size())
+                {
+                TQueue& q = *iQueue[(aWorker + i) % iQueue.size()];
+                std::lock_guard<std::mutex> lock(q.iMutex);
+                if (q.iTask.empty())
+                    continue;
+                if (i == 0)
+                    {
+                    task = std::move(q.iTask.back());
+                    q.iTask.pop_back();
+                    }
+                else
+                    {
+                    task = std::move(q.iTask.front());
+                    q.iTask.pop_front();
+                    }
+                }
+
+            std::exception_ptr exception;
+            try
+                {
+                task.iTask(aWorker);
+                }
+            catch (...)
+                {
+                exception = std::current_exception();
+                }
+            task.iTask = nullptr; // destroy the task's captured state before it is reported as finished
+
+            std::lock_guard<std::mutex> lock(iMutex);
+            if (exception && !task.iGroup->iException)
+                task.iGroup->iException = exception;
+            iTotalPending--;
+            if (--task.iGroup->iPending == 0)
+                iWorkDone.notify_all();
+            }
+        }
+
+    std::vector<std::unique_ptr<TQueue>> iQueue;
+    std::vector<std::thread> iThread;
+    std::atomic<size_t> iNextQueue { 0 };
+    std::mutex iMutex;
+    std::condition_variable iWorkAvailable;
+    std::condition_variable iWorkDone;
+    TGroup iGroup;            // the tasks submitted using ThreadPool::Submit
+    size_t iTotalPending = 0; // tasks in all groups submitted but not finished
+    size_t iQueued = 0;       // tasks submitted but not yet reserved by a worker
+    bool iStop = false;
+    };
+
+/**
+A set of tasks run by a ThreadPool which can be waited for independently of other tasks
+using the same pool, so that several callers can share a pool. The destructor waits for
+the tasks to finish, discarding any exception not yet thrown by Wait.
+*/
+class TaskGroup
+    {
+    public:
+    explicit TaskGroup(ThreadPool& aPool): iPool(aPool) { }
+    ~TaskGroup() { iPool.WaitNoThrow(iGroup); }
+
+    /** Adds a task to the group. Throws KErrorInvalidArgument if aTask is empty. */
+    void Submit(ThreadPool::Task aTask) { iPool.Submit(std::move(aTask),iGroup); }
+    /**
+    Waits until all tasks in the group have finished, then throws the first exception thrown by any of them.
+    Throws KErrorGeneral if called by a worker of the same pool.
+    */
+    void Wait() { iPool.Wait(iGroup); }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup(TaskGroup&&) = delete;
+    void operator=(const TaskGroup&) = delete;
+    void operator=(TaskGroup&&) = delete;
+
+    private:
+    ThreadPool& iPool;
+    ThreadPool::TGroup iGroup;
+    };
+
+}
@@ -0,0 +1,361 @@
+/*
+cartotype_tile_cache.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_bitmap.h>
+#include <cartotype_color.h>
+#include <cartotype_expression.h>
+#include <cartotype_framework_observer.h>
+#include <cartotype_map_metadata.h>
+#include <cartotype_style_sheet_data.h>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <string>
+
+#ifdef _MSC_VER
+    #include <process.h>
+#else
+    #include <unistd.h>
+#endif
+
+namespace CartoTypeCore
+{
+
+/**
+A persistent cache of tile bitmaps stored as files in a directory, which an application can use
+to keep tiles drawn by Framework::TileBitmap after a restart.
+
+Tiles are stored in a flat sharded layout: <directory>/<generation>/<shard>/<quadkey>-<size>.ctt,
+where the shard is two hex digits derived from the quadkey, so that no directory holds too many files.
+The generation is made from a style hash and a data hash, passed to SetGeneration, so a tile is never returned
+for a different style or for different data. Make the style hash using StyleHash, from the style sheets,
+the style sheet variables and the blend style. Make the data hash by starting with KHashStart and
+adding, for each loaded map, its metadata using Hash and its file using HashFile, so that a map rebuilt
+without changing its metadata makes a new generation.
+
+Each tile file holds the pixels in a simple uncompressed format defined by this class,
+so that the files do not depend on the serialization of bitmaps used elsewhere.
+
+The cache is an MFrameworkObserver: when it is added as an observer of a framework, style changes and
+changes to the main map data make the current generation invalid, and Find and Insert do nothing
+until SetGeneration is called with new hashes. Files are written under a temporary name and then renamed,
+so several processes can safely share a cache directory.
+*/
+class DiskTileCache: public MFrameworkObserver
+    {
+    public:
+    /** Creates a cache in the directory aDirectory, creating the directory if necessary. Returns the result in aError. */
+    static std::shared_ptr<DiskTileCache> New(Result& aError,const std::string& aDirectory)
+        {
+        std::error_code ec;
+        std::filesystem::create_directories(aDirectory,ec);
+        if (ec)
+            {
+            aError = KErrorIo;
+            return nullptr;
+            }
+        aError = KErrorNone;
+        return std::shared_ptr<DiskTileCache>(new DiskTileCache(aDirectory));
+        }
+
+    /**
+    Sets the generation of tiles used by Find and Insert, made from the style hash aStyleHash and the map data hash aDataHash.
+    If aDeleteOldGenerations is true, all tiles belonging to other generations are deleted.
+    */
+    void SetGeneration(uint64_t aStyleHash,uint64_t aDataHash,bool aDeleteOldGenerations = false)
+        {
+        char name[40];
+        snprintf(name,sizeof(name),"%016llx%016llx",(unsigned long long)aStyleHash,(unsigned long long)aDataHash);
+        std::lock_guard<std::mutex> lock(iMutex);
+        iGeneration = name;
+        iGenerationValid = true;
+        if (aDeleteOldGenerations)
+            {
+            std::error_code ec;
+            for (auto& entry : std::filesystem::directory_iterator(iDirectory,ec))
+                if (entry.is_directory(ec) && entry.path().filename() != iGeneration)
+                    std::filesystem::remove_all(entry.path(),ec);
+            }
+        }
+
+    /** Returns true if the generation has been set and has not been made invalid by a style or data change. */
+    bool GenerationValid() const
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        return iGenerationValid;
+        }
+
+    /**
+    Finds the tile with the quadkey aQuadKey and size aTileSizeInPixels in the current generation.
+    Returns the result in aError, which is KErrorNotFound if the tile is not in the cache.
+    */
+    Bitmap Find(Result& aError,const std::string& aQuadKey,int32_t aTileSizeInPixels) const
+        {
+        aError = KErrorNotFound;
+        std::string path;
+        if (!TilePath(path,aQuadKey,aTileSizeInPixels))
+            return Bitmap();
+
+        FILE* file = fopen(path.c_str(),"rb");
+        if (!file)
+            return Bitmap();
+        Bitmap bitmap;
+        try
+            {
+            bitmap = ReadTile(file);
+            aError = KErrorNone;
+            }
+        catch (Result error)
+            {
+            aError = error;
+            }
+        fclose(file);
+        return bitmap;
+        }
+
+    /** Inserts the tile aBitmap with the quadkey aQuadKey and size aTileSizeInPixels into the current generation. */
+    Result Insert(const std::string& aQuadKey,int32_t aTileSizeInPixels,const BitmapView& aBitmap)
+        {
+        std::string path;
+        if (!TilePath(path,aQuadKey,aTileSizeInPixels))
+            return KErrorNotFound;
+
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(),ec);
+
+        // Make a name unique to this write, so that other threads and processes writing the same tile do not interfere.
+        static std::atomic<uint64_t> counter { 0 };
+#ifdef _MSC_VER
+        unsigned long long process_id = (unsigned long long)_getpid();
+#else
+        unsigned long long process_id = (unsigned long long)getpid();
+#endif
+        char suffix[48];
+        snprintf(suffix,sizeof(suffix),".%llx.%llx.tmp",process_id,(unsigned long long)counter.fetch_add(1));
+        std::string temp_path = path + suffix;
+        FILE* file = fopen(temp_path.c_str(),"wb");
+        if (!file)
+            return KErrorIo;
+        Result error = WriteTile(file,aBitmap);
+        if (fclose(file) != 0 && !error)
+            error = KErrorIo;
+        if (!error)
+            {
+            std::filesystem::rename(temp_path,path,ec);
+            if (ec)
+                error = KErrorIo;
+            }
+        if (error)
+            std::filesystem::remove(temp_path,ec);
+        return error;
+        }
+
+    /** Deletes all the tiles in the cache. */
+    void Clear()
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        std::error_code ec;
+        for (auto& entry : std::filesystem::directory_iterator(iDirectory,ec))
+            std::filesystem::remove_all(entry.path(),ec);
+        }
+
+    /** Returns the directory containing the cache. */
+    const std::string& Directory() const { return iDirectory; }
+
+    /** Adds aLength bytes of data at aData to the 64-bit FNV-1a hash aHash and returns the new hash. */
+    static uint64_t Hash(uint64_t aHash,const void* aData,size_t aLength)
+        {
+        const uint8_t* p = (const uint8_t*)aData;
+        for (size_t i = 0; i < aLength; i++)
+            aHash = (aHash ^ p[i]) * 0x100000001B3ULL;
+        return aHash;
+        }
+    /** Adds the string aText to the hash aHash and returns the new hash. */
+    static uint64_t Hash(uint64_t aHash,const std::string& aText)
+        {
+        return Hash(aHash,aText.data(),aText.size() + 1);
+        }
+    /** Adds the metadata of a map, which identifies the map and its data version, to the hash aHash and returns the new hash. */
+    static uint64_t Hash(uint64_t aHash,const MapMetaData& aMetaData)
+        {
+        uint16_t version[4] = { aMetaData.FileVersion.Major,aMetaData.FileVersion.Minor,aMetaData.CartoTypeVersion.Major,aMetaData.CartoTypeVersion.Minor };
+        aHash = Hash(aHash,version,sizeof(version));
+        aHash = Hash(aHash,&aMetaData.CartoTypeBuild,sizeof(aMetaData.CartoTypeBuild));
+        aHash = Hash(aHash,aMetaData.DataSetName);
+        return Hash(aHash,aMetaData.ProjectionParameters);
+        }
+    /**
+    Adds the name, size and last modification time of the file aFileName to the hash aHash and returns the new hash.
+    Used in addition to the metadata so that a map file rebuilt with the same metadata makes a new generation.
+    */
+    static uint64_t HashFile(uint64_t aHash,const std::string& aFileName)
+        {
+        aHash = Hash(aHash,aFileName);
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(aFileName,ec);
+        if (ec)
+            size = UINT64_MAX;
+        int64_t time = std::filesystem::last_write_time(aFileName,ec).time_since_epoch().count();
+        if (ec)
+            time = 0;
+        aHash = Hash(aHash,&size,sizeof(size));
+        return Hash(aHash,&time,sizeof(time));
+        }
+    /** Adds the string aText to the hash aHash and returns the new hash. */
+    static uint64_t Hash(uint64_t aHash,const MString& aText)
+        {
+        aHash = Hash(aHash,aText.Data(),aText.Length() * sizeof(uint16_t));
+        return Hash(aHash,"",1);
+        }
+    /**
+    Returns the style hash to pass to SetGeneration, made from the style sheets aStyleSheets, the style sheet variables aVariables
+    and the blend style aBlendStyleSet, which may be null. For a framework these are the values returned by
+    Framework::StyleSheetDataArray, Framework::StyleSheetVariables and Framework::BlendStyleSet.
+    The text of each style sheet is used, so a style sheet file edited without changing its name makes a new hash.
+    */
+    static uint64_t StyleHash(const StyleSheetDataArray& aStyleSheets,const VariableDictionary& aVariables,const BlendStyleSet* aBlendStyleSet)
+        {
+        uint64_t hash = KHashStart;
+        uint64_t count = aStyleSheets.size();
+        hash = Hash(hash,&count,sizeof(count));
+        for (const auto& s : aStyleSheets)
+            {
+            hash = Hash(hash,s.FileName());
+            hash = Hash(hash,s.Text());
+            }
+        auto add_variable = [&hash](const String& aName,const String& aValue)
+            {
+            hash = Hash(hash,aName);
+            hash = Hash(hash,aValue);
+            };
+        aVariables.Apply(add_variable);
+        count = aBlendStyleSet ? aBlendStyleSet->size() : 0;
+        hash = Hash(hash,&count,sizeof(count));
+        if (aBlendStyleSet)
+            for (const auto& b : *aBlendStyleSet)
+                {
+                hash = Hash(hash,b.Styles);
+                uint32_t color[5] = { b.MainColor.Value,b.BorderColor.Value,b.TextColor.Value,b.TextGlowColor.Value,b.IconColor.Value };
+                hash = Hash(hash,color,sizeof(color));
+                }
+        return hash;
+        }
+    /** The initial value of a hash. */
+    static constexpr uint64_t KHashStart = 0xCBF29CE484222325ULL;
+
+    // virtual functions from MFrameworkObserver
+    void OnMainDataChange() override { Invalidate(); }
+    void OnStyleChange() override { Invalidate(); }
+
+    private:
+    explicit DiskTileCache(const std::string& aDirectory): iDirectory(aDirectory) { }
+
+    void Invalidate()
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        iGenerationValid = false;
+        }
+
+    bool TilePath(std::string& aPath,const std::string& aQuadKey,int32_t aTileSizeInPixels) const
+        {
+        std::lock_guard<std::mutex> lock(iMutex);
+        if (!iGenerationValid)
+            return false;
+        char shard[8];
+        snprintf(shard,sizeof(shard),"%02x",unsigned(Hash(KHashStart,aQuadKey) & 0xFF));
+        // Zoom level 0 has an empty quadkey.
+        aPath = (std::filesystem::path(iDirectory) / iGeneration / shard / ((aQuadKey.empty() ? "_" : aQuadKey) + "-" + std::to_string(aTileSizeInPixels) + ".ctt")).string();
+        return true;
+        }
+
+    /*
+    The tile file format: the magic number, then the bitmap type, width, height and number of palette entries
+    as 32-bit little-endian integers, then the palette entries, then the rows of pixels without padding.
+    */
+    static constexpr uint8_t KMagic[8] = { 'C','T','T','C',0,0,0,2 };
+    static constexpr uint32_t KMaxTileSize = 16384;
+
+    static void Put32(uint8_t* aP,uint32_t aValue)
+        {
+        aP[0] = uint8_t(aValue); aP[1] = uint8_t(aValue >> 8); aP[2] = uint8_t(aValue >> 16); aP[3] = uint8_t(aValue >> 24);
+        }
+    static uint32_t Get32(const uint8_t* aP)
+        {
+        return aP[0] | (uint32_t(aP[1]) << 8) | (uint32_t(aP[2]) << 16) | (uint32_t(aP[3]) << 24);
+        }
+    static size_t PackedRowBytes(const BitmapView& aBitmap)
+        {
+        return (size_t(aBitmap.Width()) * aBitmap.BitsPerPixel() + 7) / 8;
+        }
+
+    static Result WriteTile(FILE* aFile,const BitmapView& aBitmap)
+        {
+        std::vector<uint8_t> header(sizeof(KMagic) + 16);
+        memcpy(header.data(),KMagic,sizeof(KMagic));
+        auto palette = aBitmap.Palette();
+        size_t colors = palette ? palette->ColorCount() : 0;
+        Put32(header.data() + 8,uint32_t(aBitmap.Type()));
+        Put32(header.data() + 12,uint32_t(aBitmap.Width()));
+        Put32(header.data() + 16,uint32_t(aBitmap.Height()));
+        Put32(header.data() + 20,uint32_t(colors));
+        for (size_t i = 0; i < colors; i++)
+            {
+            header.resize(header.size() + 4);
+            Put32(header.data() + header.size() - 4,palette->Color()[i].Value);
+            }
+        if (fwrite(header.data(),1,header.size(),aFile) != header.size())
+            return KErrorIo;
+        size_t row_bytes = PackedRowBytes(aBitmap);
+        for (int32_t y = 0; y < aBitmap.Height(); y++)
+            if (fwrite(aBitmap.Data() + size_t(y) * aBitmap.RowBytes(),1,row_bytes,aFile) != row_bytes)
+                return KErrorIo;
+        return KErrorNone;
+        }
+
+    static Bitmap ReadTile(FILE* aFile)
+        {
+        uint8_t header[sizeof(KMagic) + 16];
+        if (fread(header,1,sizeof(header),aFile) != sizeof(header) || memcmp(header,KMagic,sizeof(KMagic)))
+            throw KErrorCorrupt;
+        BitmapType type = BitmapType(Get32(header + 8));
+        uint32_t width = Get32(header + 12);
+        uint32_t height = Get32(header + 16);
+        uint32_t colors = Get32(header + 20);
+        bool valid_type = type == BitmapType::A1 || type == BitmapType::A8 || type == BitmapType::A16 || type == BitmapType::RGB16 ||
+                          type == BitmapType::RGB24 || type == BitmapType::RGBA32 || type == BitmapType::P8;
+        if (!valid_type || width > KMaxTileSize || height > KMaxTileSize || colors > 256)
+            throw KErrorCorrupt;
+
+        std::shared_ptr<CartoTypeCore::Palette> palette;
+        if (colors)
+            {
+            std::vector<uint8_t> data(colors * 4);
+            if (fread(data.data(),1,data.size(),aFile) != data.size())
+                throw KErrorCorrupt;
+            std::vector<Color> color;
+            for (size_t i = 0; i < colors; i++)
+                color.emplace_back(Get32(data.data() + i * 4));
+            palette = std::make_shared<CartoTypeCore::Palette>(color);
+            }
+
+        Bitmap bitmap(type,int32_t(width),int32_t(height),0,palette);
+        size_t row_bytes = PackedRowBytes(bitmap);
+        for (uint32_t y = 0; y < height; y++)
+            if (fread(bitmap.Data() + size_t(y) * bitmap.RowBytes(),1,row_bytes,aFile) != row_bytes)
+                throw KErrorCorrupt;
+        return bitmap;
+        }
+
+    mutable std::mutex iMutex;
+    std::string iDirectory;
+    std::string iGeneration;
+    bool iGenerationValid = false;
+    };
+
+}
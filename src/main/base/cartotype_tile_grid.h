@@ -0,0 +1,138 @@
+/*
+cartotype_tile_grid.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_bitmap.h>
+#include <cartotype_thread_pool.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace CartoTypeCore
+{
+
+/**
+A grid of square tiles covering a large bitmap, used to rasterize a single image on several threads.
+
+The items in a draw list are binned into the tiles their bounds overlap, in draw order, and then each tile is
+drawn by a separate task into a view of its part of the target bitmap. The views do not overlap, so no
+locking or compositing is needed, and because each tile draws its items in the original order the
+result is the same as drawing the whole list into the bitmap at once. Labels, which must be placed
+in a single pass over the whole image, should be drawn afterwards on one thread.
+
+The draw function is responsible for clipping each item to its tile; an item is drawn once for each
+tile it overlaps.
+*/
+class RasterTileGrid
+    {
+    public:
+    /**
+    A function to draw the items aItems, which are indexes into the draw list, into the tile aTile, whose bounds are aTileBounds.
+    aWorker identifies the thread, so that it can be used to choose per-thread state, such as a graphics context. When a pool is
+    used it is from 0 to the pool's ThreadCount() inclusive, and no two tiles being drawn at the same time have the same index.
+    */
+    using DrawFunction = std::function<void(size_t aWorker,BitmapView& aTile,const Rect& aTileBounds,const std::vector<uint32_t>& aItems)>;
+
+    /** Creates a grid of tiles of aTileSize x aTileSize pixels covering a bitmap of aWidth x aHeight pixels. */
+    RasterTileGrid(int32_t aWidth,int32_t aHeight,int32_t aTileSize = 512):
+        iWidth(std::max(aWidth,0)),
+        iHeight(std::max(aHeight,0)),
+        iTileSize(std::max(aTileSize,1)),
+        iColumns((iWidth + iTileSize - 1) / iTileSize),
+        iRows((iHeight + iTileSize - 1) / iTileSize),
+        iItems(size_t(iColumns) * size_t(iRows))
+        {
+        }
+
+    /** Returns the number of tiles. */
+    size_t TileCount() const { return iItems.size(); }
+
+    /** Returns the bounds of the tile aIndex in pixels. */
+    Rect TileBounds(size_t aIndex) const
+        {
+        int32_t x = int32_t(aIndex % size_t(iColumns)) * iTileSize;
+        int32_t y = int32_t(aIndex / size_t(iColumns)) * iTileSize;
+        return Rect(x,y,std::min(x + iTileSize,iWidth),std::min(y + iTileSize,iHeight));
+        }
+
+    /**
+    Adds the draw list item aItem, whose bounds in pixels are aBounds, to every tile it overlaps.
+    Items must be added in drawing order. Items with empty bounds, or outside the grid, are ignored.
+    */
+    void Bin(uint32_t aItem,const Rect& aBounds)
+        {
+        // Clip the bounds to the grid so that items wholly outside it are not added to the edge tiles.
+        int32_t min_x = std::max(aBounds.MinX(),0);
+        int32_t min_y = std::max(aBounds.MinY(),0);
+        int32_t max_x = std::min(aBounds.MaxX(),iWidth);
+        int32_t max_y = std::min(aBounds.MaxY(),iHeight);
+        if (min_x >= max_x || min_y >= max_y)
+            return;
+        int32_t min_column = min_x / iTileSize;
+        int32_t min_row = min_y / iTileSize;
+        int32_t max_column = (max_x - 1) / iTileSize;
+        int32_t max_row = (max_y - 1) / iTileSize;
+        for (int32_t row = min_row; row <= max_row; row++)
+            for (int32_t column = min_column; column <= max_column; column++)
+                iItems[size_t(row) * size_t(iColumns) + size_t(column)].push_back(aItem);
+        }
+
+    /** Returns the items binned into the tile aIndex, in drawing order. */
+    const std::vector<uint32_t>& Items(size_t aIndex) const { return iItems[aIndex]; }
+
+    /**
+    Draws all the tiles containing items into aTarget, which must be the size given to the constructor,
+    calling aDraw for each tile on the threads of aPool, and returns when all the tiles have been drawn.
+    The tiles are drawn on the calling thread if aPool is null or the caller is one of its workers. They are then given the
+    worker index of the caller if it is a worker, otherwise aPool->ThreadCount(), which no worker uses, or 0 if aPool is null.
+    Other tasks may use the same pool at the same time. If aDraw throws an exception Draw throws it; when the pool is used,
+    it does so after all the other tiles have been drawn, and only the first exception is thrown.
+    */
+    void Draw(ThreadPool* aPool,BitmapView& aTarget,const DrawFunction& aDraw) const
+        {
+        size_t caller = aPool ? aPool->WorkerIndex() : 0;
+        if (aPool && aPool->IsWorkerThread())
+            aPool = nullptr;
+        std::unique_ptr<TaskGroup> group;
+        if (aPool)
+            group = std::make_unique<TaskGroup>(*aPool);
+        for (size_t i = 0; i < iItems.size(); i++)
+            {
+            if (iItems[i].empty())
+                continue;
+            Rect bounds = TileBounds(i);
+            auto task = [this,i,bounds,&aTarget,&aDraw](size_t aWorker)
+                {
+                BitmapView tile = aTarget.View(bounds);
+                aDraw(aWorker,tile,bounds,iItems[i]);
+                };
+            if (group)
+                group->Submit(task);
+            else
+                task(caller);
+            }
+        if (group)
+            group->Wait();
+        }
+
+    /** Removes all the items from the tiles so that the grid can be used for another draw list of the same size. */
+    void Clear()
+        {
+        for (auto& items : iItems)
+            items.clear();
+        }
+
+    private:
+    int32_t iWidth;
+    int32_t iHeight;
+    int32_t iTileSize;
+    int32_t iColumns;
+    int32_t iRows;
+    std::vector<std::vector<uint32_t>> iItems;
+    };
+
+}
@@ -0,0 +1,494 @@
+/*
+cartotype_varint_decoder.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype_types.h>
+#include <string.h>
+
+// Compile the SSE4.1 and AVX2 decoders on x86 processors, using compilers which allow them to be chosen at run time.
+#if ((defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))))
+    #define CARTOTYPE_X86_VARINT_DECODERS
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define CARTOTYPE_VARINT_TARGET(aTarget)
+    #else
+        #define CARTOTYPE_VARINT_TARGET(aTarget) __attribute__((target(aTarget)))
+    #endif
+#endif
+
+namespace CartoTypeCore
+{
+
+/** Types of decoder for arrays of variable-length integers. */
+enum class VariableLengthIntegerDecoderType
+    {
+    /** Portable code which decodes runs of single-byte values eight at a time. */
+    Scalar,
+    /** Masked VByte decoding using SSE4.1, which decodes up to eight one-byte or two-byte values at a time. */
+    Sse41,
+    /** The SSE4.1 decoder, with runs of 32 single-byte values decoded using AVX2. */
+    Avx2
+    };
+
+/**
+Functions to decode arrays of variable-length integers in the format written by DataOutputStream::WriteUint and WriteInt:
+groups of 7 bits, least significant group first, with the top bit of each byte set if more bytes follow,
+with signed integers zig-zag encoded. They are used by DataInputStream::ReadUintArray and ReadIntDeltaArray.
+
+The decoders using SIMD instructions are compiled for all x86 processors and are chosen at run time
+by Best, if the processor supports them. The masked VByte method, described by Plaisance, Kurz and Lemire,
+uses the 12 low bits of the mask of continuation bits of the next 16 bytes as an index into a table
+of shuffles which move up to eight one-byte or two-byte values into 16-bit lanes. Longer values are decoded one at a time.
+*/
+class VariableLengthIntegerDecoder
+    {
+    public:
+    /** The minimum number of bytes of data needed by the decoding functions, which load 16 bytes at a time. */
+    static constexpr size_t KMinDataBytes = 16;
+
+    /**
+    The type of a function to decode variable-length unsigned integers from the data starting at aData and ending at aEnd
+    into aArray. It decodes values until aCount is zero, or fewer than KMinDataBytes bytes are left, or the next value
+    is longer than 10 bytes, which means the data is corrupt. It advances aArray and decrements aCount for each value
+    and returns a pointer to the next byte.
+    */
+    using UintArrayFunction = const uint8_t* (*)(const uint8_t* aData,const uint8_t* aEnd,uint64_t*& aArray,size_t& aCount);
+    /**
+    The type of a function to decode variable-length signed integers, which are differences between successive values,
+    in the same way as a UintArrayFunction. The first difference is added to aValue, and aValue is set to the last value.
+    Arithmetic wraps round on overflow.
+    */
+    using IntDeltaArrayFunction = const uint8_t* (*)(const uint8_t* aData,const uint8_t* aEnd,int32_t*& aArray,size_t& aCount,uint32_t& aValue);
+
+    /** Returns the fastest decoder supported by this processor. */
+    static const VariableLengthIntegerDecoder& Best()
+        {
+        static const VariableLengthIntegerDecoder* best = Get(VariableLengthIntegerDecoderType::Avx2) ? Get(VariableLengthIntegerDecoderType::Avx2) :
+                                                          Get(VariableLengthIntegerDecoderType::Sse41) ? Get(VariableLengthIntegerDecoderType::Sse41) :
+                                                          Get(VariableLengthIntegerDecoderType::Scalar);
+        return *best;
+        }
+
+    /** Returns the decoder of type aType, or null if it is not supported by this processor. */
+    static const VariableLengthIntegerDecoder* Get(VariableLengthIntegerDecoderType aType)
+        {
+        static const VariableLengthIntegerDecoder decoder[] =
+            {
+            { VariableLengthIntegerDecoderType::Scalar, ScalarUintArray, ScalarIntDeltaArray },
+#ifdef CARTOTYPE_X86_VARINT_DECODERS
+            { VariableLengthIntegerDecoderType::Sse41, Sse41UintArray, Sse41IntDeltaArray },
+            { VariableLengthIntegerDecoderType::Avx2, Avx2UintArray, Avx2IntDeltaArray }
+#endif
+            };
+        for (const auto& d : decoder)
+            if (d.Type == aType && Supported(aType))
+                return &d;
+        return nullptr;
+        }
+
+    /** The type of this decoder. */
+    VariableLengthIntegerDecoderType Type;
+    /** The function to decode unsigned integers. */
+    UintArrayFunction ReadUintArray;
+    /** The function to decode signed differences. */
+    IntDeltaArrayFunction ReadIntDeltaArray;
+
+    private:
+    /** Returns true if this processor supports the decoder type aType. */
+    static bool Supported(VariableLengthIntegerDecoderType aType)
+        {
+        if (aType == VariableLengthIntegerDecoderType::Scalar)
+            return true;
+#ifdef CARTOTYPE_X86_VARINT_DECODERS
+        static const int level = []
+            {
+            bool sse41 = false;
+            bool avx2 = false;
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info,0);
+            int max_function = info[0];
+            __cpuid(info,1);
+            sse41 = (info[2] & (1 << 9)) && (info[2] & (1 << 19));
+            bool os_saves_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+            if (max_function >= 7 && os_saves_avx)
+                {
+                __cpuidex(info,7,0);
+                avx2 = (info[1] & (1 << 5)) != 0;
+                }
+#else
+            __builtin_cpu_init();
+            sse41 = __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+            avx2 = __builtin_cpu_supports("avx2");
+#endif
+            return avx2 && sse41 ? 2 : (sse41 ? 1 : 0);
+            }();
+        if (aType == VariableLengthIntegerDecoderType::Sse41)
+            return level >= 1;
+        if (aType == VariableLengthIntegerDecoderType::Avx2)
+            return level >= 2;
+#endif
+        return false;
+        }
+
+    /**
+    Decodes a single value of up to 10 bytes at aData, which must have at least that many bytes, into aValue.
+    Returns a pointer to the next byte, or null if the value is longer.
+    */
+    static const uint8_t* DecodeOne(const uint8_t* aData,uint64_t& aValue)
+        {
+        uint64_t n = 0;
+        for (int i = 0; i < 10; i++)
+            {
+            uint8_t b = aData[i];
+            n |= uint64_t(b & 0x7F) << (i * 7);
+            if (b < 0x80)
+                {
+                aValue = n;
+                return aData + i + 1;
+                }
+            }
+        return nullptr;
+        }
+
+    /** Returns the signed integer stored as the zig-zag-encoded aValue. */
+    static uint32_t UnZigZag(uint64_t aValue)
+        {
+        return uint32_t(aValue >> 1) ^ (0 - uint32_t(aValue & 1));
+        }
+
+    static const uint8_t* ScalarUintArray(const uint8_t* aData,const uint8_t* aEnd,uint64_t*& aArray,size_t& aCount)
+        {
+        while (aCount && aEnd - aData >= ptrdiff_t(KMinDataBytes))
+            {
+            uint64_t word;
+            memcpy(&word,aData,8);
+            if (aCount >= 8 && !(word & 0x8080808080808080ULL))
+                {
+                for (int i = 0; i < 8; i++)
+                    aArray[i] = aData[i];
+                aData += 8;
+                aArray += 8;
+                aCount -= 8;
+                continue;
+                }
+            const uint8_t* p = DecodeOne(aData,*aArray);
+            if (!p)
+                break;
+            aData = p;
+            aArray++;
+            aCount--;
+            }
+        return aData;
+        }
+
+    static const uint8_t* ScalarIntDeltaArray(const uint8_t* aData,const uint8_t* aEnd,int32_t*& aArray,size_t& aCount,uint32_t& aValue)
+        {
+        uint32_t value = aValue;
+        while (aCount && aEnd - aData >= ptrdiff_t(KMinDataBytes))
+            {
+            uint64_t word;
+            memcpy(&word,aData,8);
+            if (aCount >= 8 && !(word & 0x8080808080808080ULL))
+                {
+                for (int i = 0; i < 8; i++)
+                    {
+                    value += UnZigZag(aData[i]);
+                    aArray[i] = int32_t(value);
+                    }
+                aData += 8;
+                aArray += 8;
+                aCount -= 8;
+                continue;
+                }
+            uint64_t n;
+            const uint8_t* p = DecodeOne(aData,n);
+            if (!p)
+                break;
+            value += UnZigZag(n);
+            *aArray++ = int32_t(value);
+            aData = p;
+            aCount--;
+            }
+        aValue = value;
+        return aData;
+        }
+
+#ifdef CARTOTYPE_X86_VARINT_DECODERS
+    /** An entry in the table of shuffles used by masked VByte decoding. */
+    class TShuffle
+        {
+        public:
+        /** The shuffle moving the bytes of each value into a 16-bit lane; 0x80 clears a byte. */
+        uint8_t Shuffle[16];
+        /** The number of values decoded. */
+        uint8_t Count;
+        /** The number of bytes used. */
+        uint8_t Bytes;
+        };
+
+    /** The table of shuffles indexed by the 12 low continuation bits, built when first needed. */
+    class TShuffleTable
+        {
+        public:
+        TShuffleTable()
+            {
+            for (int mask = 0; mask < 4096; mask++)
+                {
+                TShuffle& s = Entry[mask];
+                memset(s.Shuffle,0x80,sizeof(s.Shuffle));
+                int pos = 0;
+                int count = 0;
+                while (count < 8 && pos < 12)
+                    {
+                    if (!(mask & (1 << pos)))
+                        {
+                        s.Shuffle[count * 2] = uint8_t(pos);
+                        pos++;
+                        }
+                    else if (pos + 1 < 12 && !(mask & (1 << (pos + 1))))
+                        {
+                        s.Shuffle[count * 2] = uint8_t(pos);
+                        s.Shuffle[count * 2 + 1] = uint8_t(pos + 1);
+                        pos += 2;
+                        }
+                    else
+                        break;
+                    count++;
+                    }
+                s.Count = uint8_t(count);
+                s.Bytes = uint8_t(pos);
+                }
+            }
+
+        TShuffle Entry[4096];
+        };
+
+    static const TShuffle* ShuffleTable()
+        {
+        static const TShuffleTable table;
+        return table.Entry;
+        }
+
+    /** Decodes the values described by aShuffle from aBytes into eight 16-bit lanes. */
+    CARTOTYPE_VARINT_TARGET("ssse3,sse4.1") static __m128i Sse41Decode(__m128i aBytes,const TShuffle& aShuffle)
+        {
+        __m128i x = _mm_shuffle_epi8(aBytes,_mm_loadu_si128((const __m128i*)aShuffle.Shuffle));
+        return _mm_or_si128(_mm_and_si128(x,_mm_set1_epi16(0x7F)),_mm_srli_epi16(_mm_and_si128(x,_mm_set1_epi16(0x7F00)),1));
+        }
+
+    /** Adds the running sums of the four signed differences in aDeltas to aTotal, a vector of four copies of the previous value, stores the values in aArray and returns four copies of the last. */
+    CARTOTYPE_VARINT_TARGET("ssse3,sse4.1") static __m128i Sse41Sum4(__m128i aDeltas,__m128i aTotal,int32_t* aArray)
+        {
+        aDeltas = _mm_add_epi32(aDeltas,_mm_slli_si128(aDeltas,4));
+        aDeltas = _mm_add_epi32(aDeltas,_mm_slli_si128(aDeltas,8));
+        aTotal = _mm_add_epi32(aDeltas,aTotal);
+        _mm_storeu_si128((__m128i*)aArray,aTotal);
+        return _mm_shuffle_epi32(aTotal,0xFF);
+        }
+
+    /** Returns the signed 32-bit values of the zig-zag-encoded 32-bit values in aValue. */
+    CARTOTYPE_VARINT_TARGET("ssse3,sse4.1") static __m128i Sse41UnZigZag32(__m128i aValue)
+        {
+        return _mm_xor_si128(_mm_srli_epi32(aValue,1),_mm_sub_epi32(_mm_setzero_si128(),_mm_and_si128(aValue,_mm_set1_epi32(1))));
+        }
+
+    /**
+    Decodes some values from the 16 bytes at aData: 16 single-byte values if possible, otherwise up to eight one-byte
+    or two-byte values using a shuffle, otherwise a single value. Returns false if the next value is too long.
+    */
+    CARTOTYPE_VARINT_TARGET("ssse3,sse4.1") static bool Sse41UintBlock(const uint8_t*& aData,uint64_t*& aArray,size_t& aCount)
+        {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)aData);
+        int mask = _mm_movemask_epi8(bytes);
+        if (!mask && aCount >= 16)
+            {
+            __m128i* p = (__m128i*)aArray;
+            _mm_storeu_si128(p,_mm_cvtepu8_epi64(bytes));
+            _mm_storeu_si128(p + 1,_mm_cvtepu8_epi64(_mm_srli_si128(bytes,2)));
+            _mm_storeu_si128(p + 2,_mm_cvtepu8_epi64(_mm_srli_si128(bytes,4)));
+            _mm_storeu_si128(p + 3,_mm_cvtepu8_epi64(_mm_srli_si128(bytes,6)));
+            _mm_storeu_si128(p + 4,_mm_cvtepu8_epi64(_mm_srli_si128(bytes,8)));
+            _mm_storeu_si128(p + 5,_mm_cvtepu8_epi64(_mm_srli_si128(bytes,10)));
+            _mm_storeu_si128(p + 6,_mm_cvtepu8_epi64(_mm_srli_si128(bytes,12)));
+            _mm_storeu_si128(p + 7,_mm_cvtepu8_epi64(_mm_srli_si128(bytes,14)));
+            aData += 16;
+            aArray += 16;
+            aCount -= 16;
+            return true;
+            }
+        if (aCount >= 8)
+            {
+            const TShuffle& s = ShuffleTable()[mask & 0xFFF];
+            if (s.Count)
+                {
+                // Store all eight lanes; those beyond the values decoded are overwritten later.
+                __m128i x = Sse41Decode(bytes,s);
+                __m128i* p = (__m128i*)aArray;
+                _mm_storeu_si128(p,_mm_cvtepu16_epi64(x));
+                _mm_storeu_si128(p + 1,_mm_cvtepu16_epi64(_mm_srli_si128(x,4)));
+                _mm_storeu_si128(p + 2,_mm_cvtepu16_epi64(_mm_srli_si128(x,8)));
+                _mm_storeu_si128(p + 3,_mm_cvtepu16_epi64(_mm_srli_si128(x,12)));
+                aData += s.Bytes;
+                aArray += s.Count;
+                aCount -= s.Count;
+                return true;
+                }
+            }
+        const uint8_t* p = DecodeOne(aData,*aArray);
+        if (!p)
+            return false;
+        aData = p;
+        aArray++;
+        aCount--;
+        return true;
+        }
+
+    /** Decodes signed differences from the 16 bytes at aData in the same way as Sse41UintBlock. */
+    CARTOTYPE_VARINT_TARGET("ssse3,sse4.1") static bool Sse41IntDeltaBlock(const uint8_t*& aData,int32_t*& aArray,size_t& aCount,__m128i& aTotal)
+        {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)aData);
+        int mask = _mm_movemask_epi8(bytes);
+        if (!mask && aCount >= 16)
+            {
+            aTotal = Sse41Sum4(Sse41UnZigZag32(_mm_cvtepu8_epi32(bytes)),aTotal,aArray);
+            aTotal = Sse41Sum4(Sse41UnZigZag32(_mm_cvtepu8_epi32(_mm_srli_si128(bytes,4))),aTotal,aArray + 4);
+            aTotal = Sse41Sum4(Sse41UnZigZag32(_mm_cvtepu8_epi32(_mm_srli_si128(bytes,8))),aTotal,aArray + 8);
+            aTotal = Sse41Sum4(Sse41UnZigZag32(_mm_cvtepu8_epi32(_mm_srli_si128(bytes,12))),aTotal,aArray + 12);
+            aData += 16;
+            aArray += 16;
+            aCount -= 16;
+            return true;
+            }
+        if (aCount >= 8)
+            {
+            const TShuffle& s = ShuffleTable()[mask & 0xFFF];
+            if (s.Count)
+                {
+                // Unused lanes hold zero differences, so the last total is the last value decoded.
+                __m128i x = Sse41Decode(bytes,s);
+                aTotal = Sse41Sum4(Sse41UnZigZag32(_mm_cvtepu16_epi32(x)),aTotal,aArray);
+                aTotal = Sse41Sum4(Sse41UnZigZag32(_mm_cvtepu16_epi32(_mm_srli_si128(x,8))),aTotal,aArray + 4);
+                aData += s.Bytes;
+                aArray += s.Count;
+                aCount -= s.Count;
+                return true;
+                }
+            }
+        uint64_t n;
+        const uint8_t* p = DecodeOne(aData,n);
+        if (!p)
+            return false;
+        uint32_t value = uint32_t(_mm_cvtsi128_si32(aTotal)) + UnZigZag(n);
+        *aArray++ = int32_t(value);
+        aTotal = _mm_set1_epi32(int(value));
+        aData = p;
+        aCount--;
+        return true;
+        }
+
+    CARTOTYPE_VARINT_TARGET("ssse3,sse4.1") static const uint8_t* Sse41UintArray(const uint8_t* aData,const uint8_t* aEnd,uint64_t*& aArray,size_t& aCount)
+        {
+        while (aCount && aEnd - aData >= ptrdiff_t(KMinDataBytes))
+            if (!Sse41UintBlock(aData,aArray,aCount))
+                break;
+        return aData;
+        }
+
+    CARTOTYPE_VARINT_TARGET("ssse3,sse4.1") static const uint8_t* Sse41IntDeltaArray(const uint8_t* aData,const uint8_t* aEnd,int32_t*& aArray,size_t& aCount,uint32_t& aValue)
+        {
+        __m128i total = _mm_set1_epi32(int(aValue));
+        while (aCount && aEnd - aData >= ptrdiff_t(KMinDataBytes))
+            if (!Sse41IntDeltaBlock(aData,aArray,aCount,total))
+                break;
+        aValue = uint32_t(_mm_cvtsi128_si32(total));
+        return aData;
+        }
+
+    /** Adds the running sums of the eight signed differences in aDeltas to aTotal, as Sse41Sum4 does for four. */
+    CARTOTYPE_VARINT_TARGET("avx2") static __m256i Avx2Sum8(__m256i aDeltas,__m256i aTotal,int32_t* aArray)
+        {
+        aDeltas = _mm256_add_epi32(aDeltas,_mm256_slli_si256(aDeltas,4));
+        aDeltas = _mm256_add_epi32(aDeltas,_mm256_slli_si256(aDeltas,8));
+        __m256i low_sum = _mm256_shuffle_epi32(aDeltas,0xFF);
+        aDeltas = _mm256_add_epi32(aDeltas,_mm256_permute2x128_si256(low_sum,low_sum,0x08));
+        aTotal = _mm256_add_epi32(aDeltas,aTotal);
+        _mm256_storeu_si256((__m256i*)aArray,aTotal);
+        return _mm256_permutevar8x32_epi32(aTotal,_mm256_set1_epi32(7));
+        }
+
+    /** Returns the signed 32-bit values of the zig-zag-encoded 32-bit values in aValue. */
+    CARTOTYPE_VARINT_TARGET("avx2") static __m256i Avx2UnZigZag32(__m256i aValue)
+        {
+        return _mm256_xor_si256(_mm256_srli_epi32(aValue,1),_mm256_sub_epi32(_mm256_setzero_si256(),_mm256_and_si256(aValue,_mm256_set1_epi32(1))));
+        }
+
+    CARTOTYPE_VARINT_TARGET("avx2") static const uint8_t* Avx2UintArray(const uint8_t* aData,const uint8_t* aEnd,uint64_t*& aArray,size_t& aCount)
+        {
+        while (aCount && aEnd - aData >= ptrdiff_t(KMinDataBytes))
+            {
+            if (aCount >= 32 && aEnd - aData >= 32)
+                {
+                __m256i bytes = _mm256_loadu_si256((const __m256i*)aData);
+                if (!_mm256_movemask_epi8(bytes))
+                    {
+                    __m128i half[2] = { _mm256_castsi256_si128(bytes), _mm256_extracti128_si256(bytes,1) };
+                    __m256i* p = (__m256i*)aArray;
+                    for (int i = 0; i < 2; i++, p += 4)
+                        {
+                        _mm256_storeu_si256(p,_mm256_cvtepu8_epi64(half[i]));
+                        _mm256_storeu_si256(p + 1,_mm256_cvtepu8_epi64(_mm_srli_si128(half[i],4)));
+                        _mm256_storeu_si256(p + 2,_mm256_cvtepu8_epi64(_mm_srli_si128(half[i],8)));
+                        _mm256_storeu_si256(p + 3,_mm256_cvtepu8_epi64(_mm_srli_si128(half[i],12)));
+                        }
+                    aData += 32;
+                    aArray += 32;
+                    aCount -= 32;
+                    continue;
+                    }
+                }
+            if (!Sse41UintBlock(aData,aArray,aCount))
+                break;
+            }
+        return aData;
+        }
+
+    CARTOTYPE_VARINT_TARGET("avx2") static const uint8_t* Avx2IntDeltaArray(const uint8_t* aData,const uint8_t* aEnd,int32_t*& aArray,size_t& aCount,uint32_t& aValue)
+        {
+        __m128i total = _mm_set1_epi32(int(aValue));
+        while (aCount && aEnd - aData >= ptrdiff_t(KMinDataBytes))
+            {
+            if (aCount >= 32 && aEnd - aData >= 32)
+                {
+                __m256i bytes = _mm256_loadu_si256((const __m256i*)aData);
+                if (!_mm256_movemask_epi8(bytes))
+                    {
+                    __m128i half[2] = { _mm256_castsi256_si128(bytes), _mm256_extracti128_si256(bytes,1) };
+                    __m256i total8 = _mm256_broadcastd_epi32(total);
+                    for (int i = 0; i < 2; i++)
+                        {
+                        total8 = Avx2Sum8(Avx2UnZigZag32(_mm256_cvtepu8_epi32(half[i])),total8,aArray + i * 16);
+                        total8 = Avx2Sum8(Avx2UnZigZag32(_mm256_cvtepu8_epi32(_mm_srli_si128(half[i],8))),total8,aArray + i * 16 + 8);
+                        }
+                    total = _mm256_castsi256_si128(total8);
+                    aData += 32;
+                    aArray += 32;
+                    aCount -= 32;
+                    continue;
+                    }
+                }
+            if (!Sse41IntDeltaBlock(aData,aArray,aCount,total))
+                break;
+            }
+        aValue = uint32_t(_mm_cvtsi128_si32(total));
+        return aData;
+        }
+#endif
+    };
+
+}
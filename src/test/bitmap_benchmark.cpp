@@ -0,0 +1,77 @@
+/*
+bitmap_benchmark.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Benchmarks of the inline functions of BitmapView in cartotype_bitmap.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_bitmap.h>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/**
+Compares the time taken to convert rows of 1024 pixels to RGBA32 using ConvertRow
+with a loop converting one pixel at a time, for each supported source type.
+*/
+void BenchmarkConvertRow()
+    {
+    const size_t count = 1024;
+    std::vector<uint8_t> source(count * 4);
+    for (size_t i = 0; i < source.size(); i++)
+        source[i] = uint8_t(i * 37 + (i >> 3));
+    std::vector<Color> colors(256);
+    for (size_t i = 0; i < colors.size(); i++)
+        colors[i] = Color(uint32_t(0xFF000000 | (i * 0x010203)));
+    Palette palette(colors);
+    std::vector<uint32_t> dest(count);
+
+    Benchmark("A8: per-pixel loop, per pixel",count,[&]
+        {
+        for (size_t i = 0; i < count; i++)
+            dest[i] = 0xFF000000 | (source[i] * 0x010101U);
+        });
+    Benchmark("RGB16: per-pixel loop, per pixel",count,[&]
+        {
+        const uint16_t* p = (const uint16_t*)source.data();
+        for (size_t i = 0; i < count; i++)
+            {
+            uint32_t r = p[i] >> 11, g = (p[i] >> 5) & 63, b = p[i] & 31;
+            dest[i] = 0xFF000000 | (((b << 3) | (b >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((r << 3) | (r >> 2));
+            }
+        });
+    Benchmark("P8: per-pixel loop with range check, per pixel",count,[&]
+        {
+        for (size_t i = 0; i < count; i++)
+            dest[i] = source[i] < palette.ColorCount() ? palette.Color()[source[i]].Value : 0;
+        });
+
+    const std::pair<BitmapType,const char*> type[] =
+        {
+        { BitmapType::A8, "A8" }, { BitmapType::RGB16, "RGB16" }, { BitmapType::RGB24, "RGB24" },
+        { BitmapType::RGBA32, "RGBA32" }, { BitmapType::P8, "P8" }
+        };
+    for (const auto& t : type)
+        {
+        std::string name = std::string(t.second) + ": ConvertRow, per pixel";
+        Benchmark(name.c_str(),count,[&]
+            {
+            BitmapView::ConvertRow(t.first,source.data(),BitmapType::RGBA32,(uint8_t*)dest.data(),count,&palette);
+            });
+        }
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "ConvertRow", BenchmarkConvertRow },
+        });
+    }
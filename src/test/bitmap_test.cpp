@@ -0,0 +1,202 @@
+/*
+bitmap_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of the inline functions of BitmapView in cartotype_bitmap.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_bitmap.h>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** An RGBA32 bitmap whose pixels are numbered by position, with a view of it. */
+class TestBitmap
+    {
+    public:
+    TestBitmap(uint32_t aWidth,uint32_t aHeight):
+        Pixel(size_t(aWidth) * aHeight),
+        View(BitmapType::RGBA32,(uint8_t*)Pixel.data(),aWidth,aHeight,aWidth * 4)
+        {
+        for (uint32_t y = 0; y < aHeight; y++)
+            for (uint32_t x = 0; x < aWidth; x++)
+                Pixel[size_t(y) * aWidth + x] = Value(x,y);
+        }
+
+    static uint32_t Value(int32_t aX,int32_t aY) { return uint32_t(aY) * 1000 + uint32_t(aX) + 1; }
+    uint32_t At(const BitmapView& aView,uint32_t aX,uint32_t aY) const
+        {
+        return ((const uint32_t*)(aView.Data() + size_t(aY) * aView.RowBytes()))[aX];
+        }
+
+    std::vector<uint32_t> Pixel;
+    BitmapView View;
+    };
+
+void TestView()
+    {
+    TestBitmap bitmap(40,30);
+    BitmapView view = bitmap.View.View(Rect(10,5,20,25));
+    CT_CHECK(view.Width() == 10 && view.Height() == 20);
+    CT_CHECK(view.RowBytes() == bitmap.View.RowBytes());
+    CT_CHECK(view.Type() == BitmapType::RGBA32);
+    for (int32_t y = 0; y < view.Height(); y++)
+        for (int32_t x = 0; x < view.Width(); x++)
+            CT_CHECK(bitmap.At(view,uint32_t(x),uint32_t(y)) == TestBitmap::Value(x + 10,y + 5));
+
+    // The view shares the bitmap's pixels.
+    ((uint32_t*)view.Data())[0] = 0;
+    CT_CHECK(bitmap.Pixel[5 * 40 + 10] == 0);
+
+    // The rectangle is clipped to the bitmap.
+    view = bitmap.View.View(Rect(30,-10,50,10));
+    CT_CHECK(view.Width() == 10 && view.Height() == 10);
+    CT_CHECK(bitmap.At(view,0,0) == TestBitmap::Value(30,0));
+    view = bitmap.View.View(Rect(50,50,60,60));
+    CT_CHECK(view.Width() == 0 && view.Height() == 0);
+
+    // Views of one-bit bitmaps must start on a byte boundary.
+    std::vector<uint8_t> mono(8 * 8);
+    BitmapView mono_view(BitmapType::A1,mono.data(),64,8,8);
+    CT_CHECK(mono_view.View(Rect(8,0,16,8)).Width() == 8);
+    CT_CHECK(mono_view.View(Rect(3,0,16,8)).Width() == 0);
+    }
+
+
+/** Checks that Scroll moves the pixels by aDx and aDy and reports the uncovered rectangles correctly. */
+void CheckScroll(int32_t aDx,int32_t aDy)
+    {
+    const int32_t width = 40;
+    const int32_t height = 30;
+    TestBitmap bitmap(width,height);
+    std::vector<Rect> exposed;
+    CT_CHECK(bitmap.View.Scroll(aDx,aDy,&exposed));
+    CT_CHECK(exposed.size() <= 2);
+    for (int32_t y = 0; y < height; y++)
+        for (int32_t x = 0; x < width; x++)
+            {
+            size_t covered = 0;
+            for (const auto& r : exposed)
+                covered += r.Contains(Point(x,y)) ? 1 : 0;
+            int32_t source_x = x - aDx;
+            int32_t source_y = y - aDy;
+            bool moved = source_x >= 0 && source_x < width && source_y >= 0 && source_y < height;
+            // Each pixel is either moved or in exactly one uncovered rectangle.
+            CT_CHECK(covered == (moved ? 0 : 1));
+            if (moved)
+                CT_CHECK(bitmap.At(bitmap.View,uint32_t(x),uint32_t(y)) == TestBitmap::Value(source_x,source_y));
+            }
+    }
+
+void TestScroll()
+    {
+    for (int32_t dy : { -31, -30, -7, -1, 0, 1, 7, 29, 30 })
+        for (int32_t dx : { -41, -40, -13, -1, 0, 1, 13, 39 })
+            CheckScroll(dx,dy);
+
+    // Pixels smaller than a byte cannot be moved.
+    std::vector<uint8_t> mono(8 * 8);
+    BitmapView mono_view(BitmapType::A1,mono.data(),64,8,8);
+    CT_CHECK(!mono_view.Scroll(1,1));
+    }
+
+
+/** Returns the RGBA32 value expected for pixel aIndex of a row of type aType at aSource. */
+uint32_t ExpectedPixel(BitmapType aType,const uint8_t* aSource,size_t aIndex,const Palette* aPalette)
+    {
+    switch (aType)
+        {
+        case BitmapType::A8:
+            {
+            uint32_t v = aSource[aIndex];
+            return 0xFF000000 | (v << 16) | (v << 8) | v;
+            }
+        case BitmapType::RGB16:
+            {
+            uint32_t p = aSource[aIndex * 2] | (uint32_t(aSource[aIndex * 2 + 1]) << 8);
+            // Expand each level by repeating its high bits, so that the maximum level becomes 255.
+            uint32_t r = p >> 11, g = (p >> 5) & 63, b = p & 31;
+            r = (r << 3) | (r >> 2);
+            g = (g << 2) | (g >> 4);
+            b = (b << 3) | (b >> 2);
+            return 0xFF000000 | (b << 16) | (g << 8) | r;
+            }
+        case BitmapType::RGB24:
+            {
+            const uint8_t* p = aSource + aIndex * 3;
+            return 0xFF000000 | (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | p[2];
+            }
+        case BitmapType::RGBA32:
+            {
+            uint32_t p;
+            memcpy(&p,aSource + aIndex * 4,4);
+            return p;
+            }
+        case BitmapType::P8:
+            return aSource[aIndex] < aPalette->ColorCount() ? aPalette->Color()[aSource[aIndex]].Value : 0;
+        default:
+            return 0;
+        }
+    }
+
+void TestConvertRow()
+    {
+    std::vector<Color> colors;
+    for (uint32_t i = 0; i < 200; i++)
+        colors.emplace_back(0xFF000000 | (i * 0x010203));
+    Palette palette(colors);
+
+    std::vector<uint8_t> source(100 * 4);
+    for (size_t i = 0; i < source.size(); i++)
+        source[i] = uint8_t(i * 37 + (i >> 3));
+    // Include the extreme RGB16 levels, which must expand to 0 and 255.
+    source[0] = source[1] = 0;
+    source[2] = source[3] = 0xFF;
+
+    for (BitmapType type : { BitmapType::A8, BitmapType::RGB16, BitmapType::RGB24, BitmapType::RGBA32, BitmapType::P8 })
+        {
+        // Use all lengths up to more than two SIMD steps, so that the scalar and SIMD code are both checked.
+        for (size_t count = 0; count <= 40; count++)
+            {
+            std::vector<uint32_t> dest(count + 1,0x12345678);
+            CT_CHECK(BitmapView::ConvertRow(type,source.data(),BitmapType::RGBA32,(uint8_t*)dest.data(),count,&palette));
+            for (size_t i = 0; i < count; i++)
+                CT_CHECK(dest[i] == ExpectedPixel(type,source.data(),i,&palette));
+            CT_CHECK(dest[count] == 0x12345678);
+            }
+        }
+
+    // Unsupported conversions do nothing.
+    uint32_t dest = 0x12345678;
+    CT_CHECK(!BitmapView::ConvertRow(BitmapType::A1,source.data(),BitmapType::RGBA32,(uint8_t*)&dest,1));
+    CT_CHECK(!BitmapView::ConvertRow(BitmapType::A8,source.data(),BitmapType::RGB24,(uint8_t*)&dest,1));
+    CT_CHECK(!BitmapView::ConvertRow(BitmapType::P8,source.data(),BitmapType::RGBA32,(uint8_t*)&dest,1));
+    CT_CHECK(dest == 0x12345678);
+
+    // ReadRow converts a row of a view using ConvertRow.
+    std::vector<uint8_t> grey(10 * 3);
+    for (size_t i = 0; i < grey.size(); i++)
+        grey[i] = uint8_t(i * 8);
+    BitmapView view(BitmapType::A8,grey.data(),7,3,10);
+    std::vector<uint32_t> row(7);
+    view.ReadRow(2,row.data());
+    for (size_t i = 0; i < row.size(); i++)
+        CT_CHECK(row[i] == ExpectedPixel(BitmapType::A8,grey.data() + 20,i,nullptr));
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "View", TestView },
+        { "Scroll", TestScroll },
+        { "ConvertRow", TestConvertRow },
+        });
+    }
@@ -0,0 +1,89 @@
+/*
+blur_benchmark.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Benchmarks of SeparableBlur in cartotype_blur.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_blur.h>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/**
+A box blur of an A8 bitmap summing every pixel in the window, whose cost is proportional to the radius,
+for comparison with the running sums used by SeparableBlur.
+*/
+void DirectBoxBlur(BitmapView& aBitmap,int32_t aRadius,std::vector<uint8_t>& aTemp)
+    {
+    int32_t width = aBitmap.Width();
+    int32_t height = aBitmap.Height();
+    uint32_t window = uint32_t(2 * aRadius + 1);
+    aTemp.resize(size_t(width) * height);
+    for (int32_t y = 0; y < height; y++)
+        {
+        const uint8_t* row = aBitmap.Data() + size_t(y) * aBitmap.RowBytes();
+        for (int32_t x = 0; x < width; x++)
+            {
+            uint32_t sum = 0;
+            for (int32_t d = std::max(x - aRadius,0); d <= std::min(x + aRadius,width - 1); d++)
+                sum += row[d];
+            aTemp[size_t(y) * width + x] = uint8_t((sum + window / 2) / window);
+            }
+        }
+    for (int32_t y = 0; y < height; y++)
+        {
+        uint8_t* row = aBitmap.Data() + size_t(y) * aBitmap.RowBytes();
+        for (int32_t x = 0; x < width; x++)
+            {
+            uint32_t sum = 0;
+            for (int32_t d = std::max(y - aRadius,0); d <= std::min(y + aRadius,height - 1); d++)
+                sum += aTemp[size_t(d) * width + x];
+            row[x] = uint8_t((sum + window / 2) / window);
+            }
+        }
+    }
+
+/** Measures the time taken to blur 1024 x 1024 bitmaps of each supported type using box and Gaussian blurs of several widths. */
+void BenchmarkBlur()
+    {
+    const int32_t size = 1024;
+    const size_t pixels = size_t(size) * size;
+    const std::pair<BitmapType,const char*> type[] = { { BitmapType::A8, "A8" }, { BitmapType::RGBA32, "RGBA32" } };
+    for (const auto& t : type)
+        {
+        size_t channels = t.first == BitmapType::A8 ? 1 : 4;
+        std::vector<uint8_t> data(pixels * channels);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = uint8_t(i * 7 + (i >> 10));
+        BitmapView bitmap(t.first,data.data(),size,size,uint32_t(size * channels));
+        for (int32_t width : { 2, 8, 32 })
+            {
+            std::string name = std::string(t.second) + ": box blur, width " + std::to_string(width) + ", per pixel";
+            Benchmark(name.c_str(),pixels,[&] { SeparableBlur::Blur(bitmap,false,width); });
+            name = std::string(t.second) + ": Gaussian blur, width " + std::to_string(width) + ", per pixel";
+            Benchmark(name.c_str(),pixels,[&] { SeparableBlur::Blur(bitmap,true,width); });
+            if (t.first == BitmapType::A8)
+                {
+                std::vector<uint8_t> temp;
+                name = std::string(t.second) + ": direct box blur, width " + std::to_string(width) + ", per pixel";
+                Benchmark(name.c_str(),pixels,[&] { DirectBoxBlur(bitmap,width,temp); });
+                }
+            }
+        }
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "Blur", BenchmarkBlur },
+        });
+    }
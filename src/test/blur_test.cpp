@@ -0,0 +1,145 @@
+/*
+blur_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of SeparableBlur in cartotype_blur.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_blur.h>
+#include <random>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/**
+A box blur calculated directly, summing every pixel in the window and treating pixels outside the bitmap as zero,
+with the rounding used by SeparableBlur for each pass. The rows are blurred first, then the columns.
+*/
+std::vector<uint8_t> ReferenceBoxBlur(const std::vector<uint8_t>& aData,size_t aWidth,size_t aHeight,size_t aChannels,int32_t aRadius)
+    {
+    uint32_t window = uint32_t(2 * aRadius + 1);
+    uint32_t reciprocal = ((1U << 24) + window / 2) / window;
+    auto average = [reciprocal](uint32_t aSum) { return uint8_t((aSum * reciprocal + (1U << 23)) >> 24); };
+    std::vector<uint8_t> rows(aData.size());
+    for (size_t y = 0; y < aHeight; y++)
+        for (size_t x = 0; x < aWidth; x++)
+            for (size_t c = 0; c < aChannels; c++)
+                {
+                uint32_t sum = 0;
+                for (int32_t d = -aRadius; d <= aRadius; d++)
+                    {
+                    int64_t xx = int64_t(x) + d;
+                    if (xx >= 0 && xx < int64_t(aWidth))
+                        sum += aData[(y * aWidth + size_t(xx)) * aChannels + c];
+                    }
+                rows[(y * aWidth + x) * aChannels + c] = average(sum);
+                }
+    std::vector<uint8_t> result(aData.size());
+    for (size_t y = 0; y < aHeight; y++)
+        for (size_t x = 0; x < aWidth; x++)
+            for (size_t c = 0; c < aChannels; c++)
+                {
+                uint32_t sum = 0;
+                for (int32_t d = -aRadius; d <= aRadius; d++)
+                    {
+                    int64_t yy = int64_t(y) + d;
+                    if (yy >= 0 && yy < int64_t(aHeight))
+                        sum += rows[(size_t(yy) * aWidth + x) * aChannels + c];
+                    }
+                result[(y * aWidth + x) * aChannels + c] = average(sum);
+                }
+    return result;
+    }
+
+void TestBoxBlur()
+    {
+    std::mt19937 random(1);
+    const std::pair<BitmapType,size_t> type[] = { { BitmapType::A8, 1 }, { BitmapType::RGB24, 3 }, { BitmapType::RGBA32, 4 } };
+    for (const auto& t : type)
+        {
+        for (size_t width : { 1, 7, 33 })
+            for (size_t height : { 1, 5, 40 })
+                for (int32_t radius : { 0, 1, 2, 6, 50 })
+                    {
+                    // Use padded rows to check that the padding is not used.
+                    size_t row_bytes = width * t.second + 3;
+                    std::vector<uint8_t> data(width * height * t.second);
+                    for (auto& d : data)
+                        d = uint8_t(random() % 3 ? 0 : random());
+                    std::vector<uint8_t> bitmap_data(row_bytes * height,0xAB);
+                    for (size_t y = 0; y < height; y++)
+                        memcpy(bitmap_data.data() + y * row_bytes,data.data() + y * width * t.second,width * t.second);
+
+                    BitmapView bitmap(t.first,bitmap_data.data(),uint32_t(width),uint32_t(height),uint32_t(row_bytes));
+                    CT_CHECK(SeparableBlur::BoxBlur(bitmap,radius));
+                    auto expected = radius ? ReferenceBoxBlur(data,width,height,t.second,radius) : data;
+                    for (size_t y = 0; y < height; y++)
+                        {
+                        const uint8_t* row = bitmap_data.data() + y * row_bytes;
+                        CT_CHECK(!memcmp(row,expected.data() + y * width * t.second,width * t.second));
+                        for (size_t i = width * t.second; i < row_bytes; i++)
+                            CT_CHECK(row[i] == 0xAB);
+                        }
+                    }
+        }
+
+    // Unsupported types are not changed.
+    std::vector<uint8_t> data(16,1);
+    BitmapView mono(BitmapType::A1,data.data(),8,16,1);
+    CT_CHECK(!SeparableBlur::BoxBlur(mono,2));
+    CT_CHECK(data[0] == 1);
+    }
+
+void TestGaussianBlur()
+    {
+    // The three box blurs have a combined variance close to that of the Gaussian.
+    for (double sigma = 1; sigma <= 40; sigma += 0.5)
+        {
+        int32_t radius[3];
+        SeparableBlur::GaussianBoxRadii(sigma,radius);
+        double variance = 0;
+        for (int32_t r : radius)
+            {
+            CT_CHECK(r >= 0);
+            double w = 2.0 * r + 1;
+            variance += (w * w - 1) / 12;
+            }
+        CT_CHECK(std::fabs(std::sqrt(variance) - sigma) < 0.5);
+        }
+
+    // A bright square spreads out symmetrically, and its total is roughly preserved.
+    const size_t size = 41;
+    std::vector<uint8_t> data(size * size);
+    for (size_t y = 18; y <= 22; y++)
+        for (size_t x = 18; x <= 22; x++)
+            data[y * size + x] = 255;
+    BitmapView bitmap(BitmapType::A8,data.data(),size,size,size);
+    CT_CHECK(SeparableBlur::Blur(bitmap,true,4));
+    uint32_t total = 0;
+    for (size_t y = 0; y < size; y++)
+        for (size_t x = 0; x < size; x++)
+            {
+            total += data[y * size + x];
+            // Each pass rounds its result, and the rows are blurred before the columns, so the result is only nearly symmetrical about the diagonal.
+            CT_CHECK(std::abs(int(data[y * size + x]) - int(data[x * size + y])) <= 2);
+            CT_CHECK(data[y * size + x] == data[y * size + (size - 1 - x)]);
+            }
+    CT_CHECK(total > 25 * 255 * 9 / 10 && total < 25 * 255 * 11 / 10);
+    CT_CHECK(data[20 * size + 20] < 255 && data[20 * size + 20] > data[20 * size + 25]);
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "BoxBlur", TestBoxBlur },
+        { "GaussianBlur", TestGaussianBlur },
+        });
+    }
@@ -0,0 +1,122 @@
+/*
+cartotype_test.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#pragma once
+
+#include <cartotype.h>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+The test programs in this directory are standalone programs linked with the CartoType library.
+Each test is a function which returns normally if it passes; CT_CHECK throws a TestFailure
+if a condition is false, and an uncaught Result also fails the test.
+Run a program with no arguments to run all its tests, or with the name of a test, or the start of a name,
+to run only the tests with names starting with that text.
+
+There is no build file for the test programs. Build each one from its source file, using the headers in
+src/main/base and the CartoType library (here assumed to be libcartotype in the directory <lib>), for example,
+from this directory:
+
+    g++ -std=c++17 -O2 -I../main/base stream_test.cpp -L<lib> -lcartotype -lpthread -o stream_test
+
+compressed_stream_test also needs cartotype_compressed_stream.cpp, which is not part of the library, and zlib:
+
+    g++ -std=c++17 -O2 -I../main/base compressed_stream_test.cpp ../main/base/cartotype_compressed_stream.cpp -L<lib> -lcartotype -lz -lpthread -o compressed_stream_test
+
+Similarly png_test and png_benchmark need cartotype_png.cpp and zlib:
+
+    g++ -std=c++17 -O2 -I../main/base png_test.cpp ../main/base/cartotype_png.cpp -L<lib> -lcartotype -lz -lpthread -o png_test
+*/
+#define CT_CHECK(aCondition) CartoTypeTest::Check((aCondition),#aCondition,__FILE__,__LINE__)
+
+namespace CartoTypeTest
+{
+
+/** The exception thrown by CT_CHECK when a condition is false. */
+class TestFailure
+    {
+    public:
+    std::string Message;
+    };
+
+/** Throws a TestFailure if aCondition is false. Use the CT_CHECK macro rather than calling this function directly. */
+inline void Check(bool aCondition,const char* aText,const char* aFile,int aLine)
+    {
+    if (!aCondition)
+        throw TestFailure { std::string(aFile) + "(" + std::to_string(aLine) + "): " + aText };
+    }
+
+/** A named test or benchmark. */
+class Test
+    {
+    public:
+    const char* Name;
+    std::function<void()> Function;
+    };
+
+/**
+Runs the tests in aTestArray whose names start with the first command-line argument, if any,
+printing the result of each. Returns 0 if all the tests passed, otherwise 1.
+*/
+inline int RunTests(int argc,char** argv,const std::vector<Test>& aTestArray)
+    {
+    std::string prefix = argc > 1 ? argv[1] : "";
+    int failures = 0;
+    for (const auto& test : aTestArray)
+        {
+        if (std::string(test.Name).compare(0,prefix.length(),prefix))
+            continue;
+        std::string message;
+        try
+            {
+            test.Function();
+            }
+        catch (const TestFailure& aFailure)
+            {
+            message = aFailure.Message;
+            }
+        catch (CartoTypeCore::Result aError)
+            {
+            message = "error code " + std::to_string(uint32_t(aError));
+            }
+        if (message.empty())
+            printf("passed: %s\n",test.Name);
+        else
+            {
+            printf("FAILED: %s: %s\n",test.Name,message.c_str());
+            failures++;
+            }
+        }
+    return failures ? 1 : 0;
+    }
+
+/**
+Calls aFunction, which performs aCount operations, repeatedly until at least 200ms have elapsed,
+prints the average time per operation in nanoseconds, and returns it.
+*/
+inline double Benchmark(const char* aName,size_t aCount,const std::function<void()>& aFunction)
+    {
+    aFunction(); // warm up the caches
+    size_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double,std::nano> elapsed { 0 };
+    do
+        {
+        aFunction();
+        calls++;
+        elapsed = std::chrono::steady_clock::now() - start;
+        }
+    while (elapsed.count() < 2e8);
+    double ns = elapsed.count() / double(calls) / double(aCount);
+    printf("%-60s %12.2f ns\n",aName,ns);
+    return ns;
+    }
+
+}
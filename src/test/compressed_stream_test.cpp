@@ -0,0 +1,269 @@
+/*
+compressed_stream_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of CompressedFileInputStream. Link with zlib.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_compressed_stream.h>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <zlib.h>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+void AppendLittleEndian(std::vector<uint8_t>& aData,uint64_t aValue,int aBytes)
+    {
+    for (int i = 0; i < aBytes; i++)
+        aData.push_back(uint8_t(aValue >> (i * 8)));
+    }
+
+/** Compresses aData into BGZF blocks of up to aBlockSize uncompressed bytes, as bgzip does, and creates the .gzi index in aIndex. */
+std::vector<uint8_t> CompressBgzf(const std::vector<uint8_t>& aData,size_t aBlockSize,std::vector<uint8_t>& aIndex)
+    {
+    std::vector<uint8_t> file;
+    std::vector<uint8_t> index_entries;
+    size_t blocks = 0;
+    for (size_t start = 0; start <= aData.size(); start += aBlockSize)
+        {
+        // The last, empty, block is the BGZF end-of-file marker.
+        size_t length = std::min(aBlockSize,aData.size() - start);
+        if (start && length)
+            {
+            AppendLittleEndian(index_entries,file.size(),8);
+            AppendLittleEndian(index_entries,start,8);
+            }
+        if (length)
+            blocks++;
+
+        std::vector<uint8_t> deflated(compressBound(uLong(length)) + 16);
+        z_stream z = { };
+        CT_CHECK(deflateInit2(&z,Z_DEFAULT_COMPRESSION,Z_DEFLATED,-MAX_WBITS,8,Z_DEFAULT_STRATEGY) == Z_OK);
+        z.next_in = (Bytef*)aData.data() + start;
+        z.avail_in = uInt(length);
+        z.next_out = deflated.data();
+        z.avail_out = uInt(deflated.size());
+        CT_CHECK(deflate(&z,Z_FINISH) == Z_STREAM_END);
+        deflated.resize(z.total_out);
+        deflateEnd(&z);
+
+        const uint8_t header[] = { 31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0 };
+        file.insert(file.end(),header,header + sizeof(header));
+        AppendLittleEndian(file,18 + deflated.size() + 8 - 1,2);
+        file.insert(file.end(),deflated.begin(),deflated.end());
+        AppendLittleEndian(file,crc32(crc32(0,nullptr,0),aData.data() + start,uInt(length)),4);
+        AppendLittleEndian(file,length,4);
+        if (!length)
+            break;
+        }
+    aIndex.clear();
+    AppendLittleEndian(aIndex,blocks - 1,8);
+    aIndex.insert(aIndex.end(),index_entries.begin(),index_entries.end());
+    return file;
+    }
+
+void WriteFile(const std::string& aName,const std::vector<uint8_t>& aData)
+    {
+    FILE* file = fopen(aName.c_str(),"wb");
+    CT_CHECK(file != nullptr);
+    CT_CHECK(fwrite(aData.data(),1,aData.size(),file) == aData.size());
+    fclose(file);
+    }
+
+/** A compressed test file and its optional index, deleted by the destructor. */
+class TestFile
+    {
+    public:
+    TestFile(size_t aLength,size_t aBlockSize,bool aWriteIndex)
+        {
+        Name = (std::filesystem::temp_directory_path() / ("cartotype_compressed_test_" + std::to_string(aBlockSize) + ".gz")).string();
+        std::mt19937 random(static_cast<uint32_t>(aLength));
+        Data.resize(aLength);
+        for (size_t i = 0; i < aLength; i++)
+            Data[i] = uint8_t(i % 1000 < 500 ? random() : i / 7);
+        Compressed = CompressBgzf(Data,aBlockSize,Index);
+        WriteFile(Name,Compressed);
+        std::error_code ec;
+        std::filesystem::remove(Name + ".gzi",ec);
+        if (aWriteIndex)
+            WriteFile(Name + ".gzi",Index);
+        }
+    ~TestFile()
+        {
+        std::error_code ec;
+        std::filesystem::remove(Name,ec);
+        std::filesystem::remove(Name + ".gzi",ec);
+        }
+
+    std::string Name;
+    std::vector<uint8_t> Data;
+    std::vector<uint8_t> Compressed;
+    std::vector<uint8_t> Index;
+    };
+
+void CheckContents(FileInputStream& aStream,const std::vector<uint8_t>& aData)
+    {
+    CT_CHECK(aStream.Length() == int64_t(aData.size()));
+    std::vector<uint8_t> data;
+    for (;;)
+        {
+        const uint8_t* p = nullptr;
+        size_t n = 0;
+        aStream.Read(p,n);
+        if (!n)
+            break;
+        data.insert(data.end(),p,p + n);
+        }
+    CT_CHECK(data == aData);
+
+    std::mt19937 random(9);
+    for (int i = 0; i < 1000; i++)
+        {
+        int64_t position = int64_t(random() % aData.size());
+        aStream.Seek(position);
+        const uint8_t* p = nullptr;
+        size_t n = 0;
+        aStream.Read(p,n);
+        CT_CHECK(n > 0 && size_t(position) + n <= aData.size() && !memcmp(p,aData.data() + position,n));
+        }
+    }
+
+void TestRoundTrip()
+    {
+    for (bool index : { false, true })
+        {
+        for (size_t block_size : { size_t(1000), size_t(65536) })
+            {
+            TestFile file(300001,block_size,index);
+            CT_CHECK(CompressedFileInputStream::IsCompressed(file.Name));
+            Result error;
+            auto stream = CompressedFileInputStream::New(error,file.Name,4096,8);
+            CT_CHECK(!error && stream);
+            stream->SetReadAhead(4);    // ignored, because positions are not positions in the file
+            CheckContents(*stream,file.Data);
+            auto copy = stream->Copy();
+            CheckContents(*copy,file.Data);
+            }
+        }
+    }
+
+/** Sets the uncompressed offset in entry aEntry of the .gzi index aIndex to aOffset. */
+void SetIndexOffset(std::vector<uint8_t>& aIndex,size_t aEntry,uint64_t aOffset)
+    {
+    for (int i = 0; i < 8; i++)
+        aIndex[8 + aEntry * 16 + 8 + size_t(i)] = uint8_t(aOffset >> (i * 8));
+    }
+
+/** Reads the whole of aStream and returns the error thrown, if any. */
+Result ReadAll(FileInputStream& aStream)
+    {
+    try
+        {
+        for (;;)
+            {
+            const uint8_t* p = nullptr;
+            size_t n = 0;
+            aStream.Read(p,n);
+            if (!n)
+                return KErrorNone;
+            }
+        }
+    catch (Result aError)
+        {
+        return aError;
+        }
+    }
+
+void TestErrors()
+    {
+    TestFile file(100000,5000,false);
+
+    // An index which is truncated, or refers to blocks beyond the end of the file, is an error.
+    std::vector<uint8_t> index = file.Index;
+    index.resize(index.size() - 3);
+    WriteFile(file.Name + ".gzi",index);
+    Result error;
+    auto stream = CompressedFileInputStream::New(error,file.Name);
+    CT_CHECK(error == KErrorCorrupt && !stream);
+
+    index = file.Index;
+    AppendLittleEndian(index,file.Compressed.size() * 2,8);
+    AppendLittleEndian(index,file.Data.size() * 2,8);
+    index[0]++;
+    WriteFile(file.Name + ".gzi",index);
+    stream = CompressedFileInputStream::New(error,file.Name);
+    CT_CHECK(error == KErrorCorrupt && !stream);
+
+    // An index with an empty block, or a block larger than a BGZF block can be, is an error.
+    // There are 20 blocks of 5000 bytes, and 19 index entries, for the blocks after the first; the last entry is for offset 95000.
+    index = file.Index;
+    SetIndexOffset(index,1,5000);
+    WriteFile(file.Name + ".gzi",index);
+    stream = CompressedFileInputStream::New(error,file.Name);
+    CT_CHECK(error == KErrorCorrupt && !stream);
+    index = file.Index;
+    SetIndexOffset(index,18,95000 + 70000);
+    WriteFile(file.Name + ".gzi",index);
+    stream = CompressedFileInputStream::New(error,file.Name);
+    CT_CHECK(error == KErrorCorrupt && !stream);
+
+    // An index whose offsets do not match the sizes of the blocks is detected when the blocks are read,
+    // including when reading starts in the part of a block that the index claims but the block does not have.
+    for (uint64_t wrong_offset : { 95100, 94900 })
+        {
+        index = file.Index;
+        SetIndexOffset(index,18,wrong_offset);
+        WriteFile(file.Name + ".gzi",index);
+        stream = CompressedFileInputStream::New(error,file.Name,4096,8);
+        CT_CHECK(!error && stream);
+        CT_CHECK(ReadAll(*stream) == KErrorCorrupt);
+        stream = CompressedFileInputStream::New(error,file.Name,64,8);
+        stream->Seek(int64_t(wrong_offset) - 50);
+        CT_CHECK(ReadAll(*stream) == KErrorCorrupt);
+        }
+
+    // Corrupt compressed data is detected when it is read.
+    std::error_code ec;
+    std::filesystem::remove(file.Name + ".gzi",ec);
+    std::vector<uint8_t> corrupt = file.Compressed;
+    corrupt[40] ^= 0x55;
+    WriteFile(file.Name,corrupt);
+    stream = CompressedFileInputStream::New(error,file.Name,4096,8);
+    CT_CHECK(!error && stream);
+    bool thrown = false;
+    try
+        {
+        const uint8_t* p = nullptr;
+        size_t n = 0;
+        stream->Read(p,n);
+        }
+    catch (Result aError)
+        {
+        thrown = aError == KErrorCorrupt;
+        }
+    CT_CHECK(thrown);
+
+    // A file which is not in BGZF format cannot be opened.
+    WriteFile(file.Name,file.Data);
+    CT_CHECK(!CompressedFileInputStream::IsCompressed(file.Name));
+    stream = CompressedFileInputStream::New(error,file.Name);
+    CT_CHECK(error && !stream);
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "RoundTrip", TestRoundTrip },
+        { "Errors", TestErrors },
+        });
+    }
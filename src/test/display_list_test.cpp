@@ -0,0 +1,231 @@
+/*
+display_list_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of DisplayList and DisplayListRecorder in cartotype_display_list.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_display_list.h>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** A drawing operation received by TestGraphicsContext, with the graphics parameters in force when it was received. */
+class TestOperation
+    {
+    public:
+    enum class TType { Shape, Bitmap, MonochromeBitmap, Clear };
+
+    TType Type = TType::Clear;
+    Rect Clip;
+    Color PaintColor;
+    std::vector<OutlinePoint> Point;
+    CartoTypeCore::Point TopLeft;
+    int32_t Width = 0;
+    int32_t Height = 0;
+    };
+
+/** A graphics context which records the operations drawn into it. */
+class TestGraphicsContext: public GraphicsContext
+    {
+    public:
+    TestGraphicsContext(): GraphicsContext(nullptr,Rect(0,0,1000,1000),nullptr) { }
+
+    DrawResult DrawBitmap(const BitmapView& aBitmap,const Point& aTopLeft) override
+        {
+        Add(TestOperation::TType::Bitmap).TopLeft = aTopLeft;
+        Operation.back().Width = aBitmap.Width();
+        Operation.back().Height = aBitmap.Height();
+        return DrawResult::Success;
+        }
+
+    DrawResult DrawBitmapMonochrome(const BitmapView& aBitmap,const Point& aTopLeft) override
+        {
+        DrawBitmap(aBitmap,aTopLeft);
+        Operation.back().Type = TestOperation::TType::MonochromeBitmap;
+        return DrawResult::Success;
+        }
+
+    DrawResult DrawShape(const MPath& aPath) override
+        {
+        auto& op = Add(TestOperation::TType::Shape);
+        for (size_t i = 0; i < aPath.Contours(); i++)
+            {
+            ContourView c = aPath.ContourByIndex(i);
+            for (size_t j = 0; j < c.Points(); j++)
+                op.Point.push_back(c.Point(j));
+            }
+        return DrawResult::Success;
+        }
+
+    DrawResult DrawTexture(const Texture&,const PointFP&,const AffineTransform&) override { return DrawResult::Success; }
+
+    void Clear() override { Add(TestOperation::TType::Clear); }
+
+    std::vector<TestOperation> Operation;
+
+    private:
+    TestOperation& Add(TestOperation::TType aType)
+        {
+        TestOperation op;
+        op.Type = aType;
+        op.Clip = iParam.Clip;
+        op.PaintColor = iParam.Paint.Color;
+        Operation.push_back(op);
+        return Operation.back();
+        }
+    };
+
+/** Returns an outline with a single triangle, in 64ths of pixels. */
+Outline Triangle(int32_t aX,int32_t aY)
+    {
+    Outline outline;
+    Contour& c = outline.AppendContour();
+    c.AppendPoint(OutlinePoint(aX * 64,aY * 64));
+    c.AppendPoint(OutlinePoint(aX * 64 + 640,aY * 64));
+    c.AppendPoint(OutlinePoint(aX * 64,aY * 64 + 640));
+    c.SetClosed(true);
+    return outline;
+    }
+
+/** Checks that replaying a list draws the recorded operations, in order, with the recorded graphics parameters. */
+void TestRecordAndReplay()
+    {
+    DisplayListRecorder recorder(nullptr,Rect(0,0,1000,1000));
+    std::vector<uint8_t> pixel(6 * 4,255);
+    BitmapView bitmap(BitmapType::A8,pixel.data(),6,4,6);
+
+    recorder.SetColor(KRed);
+    recorder.DrawShape(Triangle(10,20));
+    recorder.SetClip(Rect(0,0,500,400));
+    recorder.SetColor(KBlue);
+    recorder.DrawBitmap(bitmap,Point(30,40));
+    recorder.DrawBitmapMonochrome(bitmap,Point(50,60));
+    recorder.DrawShape(Outline());  // empty paths are not recorded
+    auto list = recorder.TakeDisplayList();
+    CT_CHECK(list->IsComplete());
+    CT_CHECK(list->CommandCount() == 5);
+    CT_CHECK(list->MemoryUsed() > 0);
+
+    TestGraphicsContext gc;
+    list->Replay(gc);
+    const auto& op = gc.Operation;
+    CT_CHECK(op.size() == 3);
+    CT_CHECK(op[0].Type == TestOperation::TType::Shape && op[0].PaintColor == KRed);
+    CT_CHECK(op[0].Point.size() == 3 && op[0].Point[0] == OutlinePoint(640,1280) && op[0].Point[2] == OutlinePoint(640,1920));
+    CT_CHECK(op[1].Type == TestOperation::TType::Bitmap && op[1].PaintColor == KBlue && op[1].Clip == Rect(0,0,500,400));
+    CT_CHECK(op[1].TopLeft == Point(30,40) && op[1].Width == 6 && op[1].Height == 4);
+    CT_CHECK(op[2].Type == TestOperation::TType::MonochromeBitmap && op[2].TopLeft == Point(50,60));
+
+    // The recorder starts a new list, which records the current parameters before its first operation.
+    recorder.DrawShape(Triangle(0,0));
+    auto second = recorder.TakeDisplayList();
+    CT_CHECK(second->CommandCount() == 2);
+    TestGraphicsContext gc2;
+    second->Replay(gc2);
+    CT_CHECK(gc2.Operation.size() == 1 && gc2.Operation[0].PaintColor == KBlue && gc2.Operation[0].Clip == Rect(0,0,500,400));
+    }
+
+/** Checks that a clear operation is replayed with the parameters in force when it was recorded. */
+void TestClear()
+    {
+    DisplayListRecorder recorder(nullptr,Rect(0,0,1000,1000));
+    recorder.SetClip(Rect(100,100,200,200));
+    recorder.Clear();
+    recorder.SetClip(Rect(0,0,50,50));
+    recorder.DrawShape(Triangle(1,1));
+    recorder.SetClip(Rect(300,300,400,400));
+    recorder.Clear();
+    auto list = recorder.TakeDisplayList();
+
+    TestGraphicsContext gc;
+    list->Replay(gc);
+    const auto& op = gc.Operation;
+    CT_CHECK(op.size() == 3);
+    CT_CHECK(op[0].Type == TestOperation::TType::Clear && op[0].Clip == Rect(100,100,200,200));
+    CT_CHECK(op[1].Type == TestOperation::TType::Shape && op[1].Clip == Rect(0,0,50,50));
+    CT_CHECK(op[2].Type == TestOperation::TType::Clear && op[2].Clip == Rect(300,300,400,400));
+    }
+
+/** Checks that the scale and offset move paths, bitmaps and clip rectangles, and do not change the size of bitmaps. */
+void TestScaleAndOffset()
+    {
+    DisplayListRecorder recorder(nullptr,Rect(0,0,1000,1000));
+    std::vector<uint8_t> pixel(6 * 4,255);
+    BitmapView bitmap(BitmapType::A8,pixel.data(),6,4,6);
+    recorder.SetClip(Rect(10,20,110,220));
+    recorder.DrawShape(Triangle(10,20));
+    recorder.DrawBitmap(bitmap,Point(30,40));
+    auto list = recorder.TakeDisplayList();
+
+    DisplayListReplayParam param;
+    param.Scale = 2;
+    param.Offset = PointFP(-5,7.5);
+    TestGraphicsContext gc;
+    list->Replay(gc,&param);
+    const auto& op = gc.Operation;
+    CT_CHECK(op.size() == 2);
+    CT_CHECK(op[0].Clip == Rect(15,47,215,448));
+    CT_CHECK(op[0].Point[0] == OutlinePoint(1280 - 320,2560 + 480));
+    CT_CHECK(op[0].Point[1] == OutlinePoint(2560 - 320,2560 + 480));
+    CT_CHECK(op[1].TopLeft == Point(55,88) && op[1].Width == 6 && op[1].Height == 4);
+
+    // Replaying without parameters gives the recorded positions.
+    TestGraphicsContext gc2;
+    list->Replay(gc2);
+    CT_CHECK(gc2.Operation[0].Point[0] == OutlinePoint(640,1280) && gc2.Operation[1].TopLeft == Point(30,40));
+    }
+
+/** Checks that the paints in each group are blended with the color returned by the blend function. */
+void TestGroups()
+    {
+    DisplayListRecorder recorder(nullptr,Rect(0,0,1000,1000));
+    recorder.BeginGroup(1);
+    recorder.SetColor(KRed);
+    recorder.DrawShape(Triangle(0,0));
+    recorder.BeginGroup(2);
+    recorder.DrawShape(Triangle(0,0));
+    auto list = recorder.TakeDisplayList();
+
+    DisplayListReplayParam param;
+    Color night(0,0,64,128);
+    param.BlendColor = [night](uint32_t aGroup) { return aGroup == 2 ? night : KTransparentBlack; };
+    TestGraphicsContext gc;
+    list->Replay(gc,&param);
+    Color blended = KRed;
+    blended.Blend(night);
+    CT_CHECK(gc.Operation.size() == 2);
+    CT_CHECK(gc.Operation[0].PaintColor == KRed);
+    CT_CHECK(gc.Operation[1].PaintColor == blended && blended != KRed);
+    }
+
+/** Checks that textures, which cannot be recorded, mark the list as incomplete. */
+void TestTexture()
+    {
+    DisplayListRecorder recorder(nullptr,Rect(0,0,1000,1000));
+    BitmapTexture texture(nullptr);
+    recorder.DrawTexture(texture,PointFP(),AffineTransform());
+    auto list = recorder.TakeDisplayList();
+    CT_CHECK(!list->IsComplete());
+    CT_CHECK(list->CommandCount() == 0);
+    CT_CHECK(recorder.TakeDisplayList()->IsComplete());
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "RecordAndReplay", TestRecordAndReplay },
+        { "Clear", TestClear },
+        { "ScaleAndOffset", TestScaleAndOffset },
+        { "Groups", TestGroups },
+        { "Texture", TestTexture },
+        });
+    }
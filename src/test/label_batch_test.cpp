@@ -0,0 +1,215 @@
+/*
+label_batch_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of LabelBatcher in cartotype_label_batch.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_label_batch.h>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** An RGBA32 label image whose pixels are all aColor. */
+class TestLabel
+    {
+    public:
+    TestLabel(int32_t aWidth,int32_t aHeight,uint32_t aColor):
+        Data(size_t(aWidth) * aHeight,aColor),
+        View(BitmapType::RGBA32,(uint8_t*)Data.data(),uint32_t(aWidth),uint32_t(aHeight),uint32_t(aWidth) * 4)
+        {
+        }
+
+    std::vector<uint32_t> Data;
+    BitmapView View;
+    };
+
+/** A batch handler which records each batch and checks that every label's pixels are in the atlas. */
+class TestBatchHandler: public MLabelBatchHandler
+    {
+    public:
+    void operator()(const BitmapView& aAtlas,const std::vector<LabelBatchItem>& aItems,bool aAtlasReset) override
+        {
+        Batch.push_back(aItems);
+        AtlasReset.push_back(aAtlasReset);
+        Color.emplace_back();
+        for (const auto& item : aItems)
+            {
+            const uint32_t* p = (const uint32_t*)(aAtlas.Data() + size_t(item.AtlasRect.Min.Y) * aAtlas.RowBytes()) + item.AtlasRect.Min.X;
+            Color.back().push_back(*p);
+            }
+        }
+
+    std::vector<std::vector<LabelBatchItem>> Batch;
+    std::vector<bool> AtlasReset;
+    std::vector<std::vector<uint32_t>> Color;
+    };
+
+/** A label handler which counts the labels passed to it. */
+class TestFallbackHandler: public MLabelHandler
+    {
+    public:
+    void operator()(const BitmapView&,const Point&,const Point&) override { Count++; }
+
+    int Count = 0;
+    };
+
+/** Checks that labels in later frames keep their identifiers and places in the atlas, and are marked as changed only when new. */
+void TestReuse()
+    {
+    TestBatchHandler handler;
+    LabelBatcher batcher(handler,256,256);
+    TestLabel a(40,10,0xFF0000FF);
+    TestLabel b(30,12,0xFF00FF00);
+    batcher(a.View,Point(5,5),Point(0,0));
+    batcher(b.View,Point(50,5),Point(0,0));
+    batcher.Flush();
+    batcher(b.View,Point(60,6),Point(1,1));
+    batcher(a.View,Point(15,6),Point(0,0));
+    TestLabel c(20,10,0xFFFF0000);
+    batcher(c.View,Point(100,100),Point(0,0));
+    batcher.Flush();
+
+    CT_CHECK(handler.Batch.size() == 2);
+    CT_CHECK(handler.AtlasReset[0] && !handler.AtlasReset[1]);
+    const auto& first = handler.Batch[0];
+    const auto& second = handler.Batch[1];
+    CT_CHECK(first.size() == 2 && second.size() == 3);
+    CT_CHECK(first[0].Changed && first[1].Changed);
+    CT_CHECK(first[0].Id != first[1].Id);
+    CT_CHECK(second[0].Id == first[1].Id && second[0].AtlasRect == first[1].AtlasRect && !second[0].Changed);
+    CT_CHECK(second[1].Id == first[0].Id && second[1].AtlasRect == first[0].AtlasRect && !second[1].Changed);
+    CT_CHECK(second[2].Changed && second[2].Id != first[0].Id && second[2].Id != first[1].Id);
+    CT_CHECK(second[0].TopLeft == Point(60,6) && second[0].HotSpot == Point(1,1));
+    CT_CHECK(handler.Color[1][0] == 0xFF00FF00 && handler.Color[1][1] == 0xFF0000FF && handler.Color[1][2] == 0xFFFF0000);
+    }
+
+/**
+Checks that labels with the same pixels but different sizes, and labels differing in a single pixel, get different
+identifiers and places in the atlas.
+*/
+void TestDistinctImages()
+    {
+    TestBatchHandler handler;
+    LabelBatcher batcher(handler,256,256);
+    TestLabel a(20,10,0xFF000000);
+    TestLabel b(10,20,0xFF000000);
+    TestLabel c(20,10,0xFF000000);
+    c.Data[199] = 0xFF000001;
+    batcher(a.View,Point(0,0),Point(0,0));
+    batcher(b.View,Point(0,0),Point(0,0));
+    batcher(c.View,Point(0,0),Point(0,0));
+    batcher(a.View,Point(0,0),Point(0,0));
+    batcher.Flush();
+    const auto& item = handler.Batch[0];
+    CT_CHECK(item[0].Id != item[1].Id && item[0].Id != item[2].Id && item[1].Id != item[2].Id);
+    CT_CHECK(item[0].AtlasRect != item[2].AtlasRect);
+    CT_CHECK(item[3].Id == item[0].Id && !item[3].Changed);
+    }
+
+/** Checks that when the atlas is full the labels so far are passed on and the atlas is cleared, and that identifiers are not reused. */
+void TestAtlasFull()
+    {
+    TestBatchHandler handler;
+    LabelBatcher batcher(handler,64,64);
+    std::vector<TestLabel> label;
+    for (uint32_t i = 0; i < 10; i++)
+        label.emplace_back(60,20,0xFF000000 | i);
+    for (const auto& l : label)
+        batcher(l.View,Point(0,0),Point(0,0));
+    batcher.Flush();
+
+    // Three labels fit the atlas, so there are four batches, each after the first with a cleared atlas.
+    CT_CHECK(handler.Batch.size() == 4);
+    std::vector<uint64_t> id;
+    for (size_t i = 0; i < handler.Batch.size(); i++)
+        {
+        CT_CHECK(handler.AtlasReset[i]);
+        CT_CHECK(handler.Batch[i].size() == (i < 3 ? 3 : 1));
+        for (size_t j = 0; j < handler.Batch[i].size(); j++)
+            {
+            CT_CHECK(handler.Batch[i][j].Changed);
+            CT_CHECK(handler.Color[i][j] == (0xFF000000 | uint32_t(i * 3 + j)));
+            id.push_back(handler.Batch[i][j].Id);
+            }
+        }
+    std::sort(id.begin(),id.end());
+    CT_CHECK(std::unique(id.begin(),id.end()) == id.end() && id.size() == 10);
+
+    // The first label was removed from the atlas, so it is copied again with a new identifier.
+    batcher(label[0].View,Point(0,0),Point(0,0));
+    batcher.Flush();
+    CT_CHECK(handler.Batch.back()[0].Changed);
+    CT_CHECK(handler.Batch.back()[0].Id > id.back());
+    }
+
+/** Checks that labels too large for the atlas are passed to the fallback handler, or ignored if there is none. */
+void TestFallback()
+    {
+    TestBatchHandler handler;
+    TestFallbackHandler fallback;
+    LabelBatcher batcher(handler,64,64,&fallback);
+    TestLabel wide(65,10,0xFF000000);
+    TestLabel tall(10,65,0xFF000000);
+    TestLabel small(10,10,0xFF000000);
+    batcher(small.View,Point(0,0),Point(0,0));
+    batcher(wide.View,Point(0,0),Point(0,0));
+    batcher(tall.View,Point(0,0),Point(0,0));
+    batcher.Flush();
+    CT_CHECK(fallback.Count == 2);
+    CT_CHECK(handler.Batch.size() == 1 && handler.Batch[0].size() == 1);
+
+    // A large label does not clear the atlas.
+    batcher(small.View,Point(0,0),Point(0,0));
+    batcher.Flush();
+    CT_CHECK(!handler.AtlasReset.back() && !handler.Batch.back()[0].Changed);
+
+    LabelBatcher no_fallback(handler,64,64);
+    no_fallback(tall.View,Point(0,0),Point(0,0));
+    no_fallback.Flush();
+    CT_CHECK(handler.Batch.back().empty());
+    }
+
+/** Checks that labels which are not RGBA32 are converted when copied and compared. */
+void TestConversion()
+    {
+    TestBatchHandler handler;
+    LabelBatcher batcher(handler,64,64);
+    std::vector<uint8_t> data(8 * 8,255);
+    BitmapView mono(BitmapType::A8,data.data(),8,8,8);
+    batcher(mono,Point(0,0),Point(0,0));
+    batcher(mono,Point(0,0),Point(0,0));
+    batcher.Flush();
+    const auto& item = handler.Batch[0];
+    CT_CHECK(item.size() == 2 && item[0].Changed && !item[1].Changed && item[0].Id == item[1].Id);
+    CT_CHECK(handler.Color[0][0] != 0);
+
+    // A1 labels cannot be converted a row at a time, so each pixel is converted using the bitmap's color function.
+    std::vector<uint8_t> mask_data(8,0xFF);
+    BitmapView mask(BitmapType::A1,mask_data.data(),8,8,1);
+    batcher(mask,Point(0,0),Point(0,0));
+    batcher.Flush();
+    uint32_t expected[8];
+    mask.ReadRow(0,expected);
+    CT_CHECK(handler.Batch[1].size() == 1 && handler.Batch[1][0].Changed && handler.Batch[1][0].Id != handler.Batch[0][0].Id);
+    CT_CHECK(handler.Color[1][0] == expected[0]);
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "Reuse", TestReuse },
+        { "DistinctImages", TestDistinctImages },
+        { "AtlasFull", TestAtlasFull },
+        { "Fallback", TestFallback },
+        { "Conversion", TestConversion },
+        });
+    }
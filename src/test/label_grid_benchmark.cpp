@@ -0,0 +1,109 @@
+/*
+label_grid_benchmark.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Benchmarks of LabelCollisionGrid and LabelPlacer in cartotype_label_grid.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_label_grid.h>
+#include <random>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+const int32_t KMapSize = 4096;
+const size_t KCandidates = 50000;
+
+/** Returns KCandidates random label boxes of 20...139 x 10...23 pixels on a map of KMapSize x KMapSize pixels. */
+std::vector<Rect> MakeBoxes()
+    {
+    std::mt19937 random(1);
+    std::vector<Rect> box(KCandidates);
+    for (auto& b : box)
+        {
+        int32_t x = int32_t(random() % KMapSize);
+        int32_t y = int32_t(random() % KMapSize);
+        b = Rect(x,y,x + 20 + int32_t(random() % 120),y + 10 + int32_t(random() % 14));
+        }
+    return box;
+    }
+
+/** Compares placing the candidates by testing every placed box with placing them using LabelCollisionGrid with several cell sizes. */
+void BenchmarkPlacement()
+    {
+    auto box = MakeBoxes();
+    size_t placed_count = 0;
+    std::vector<Rect> placed;
+    Benchmark("linear scan of placed boxes, per candidate",KCandidates,[&]
+        {
+        placed.clear();
+        for (const auto& b : box)
+            {
+            bool clear = true;
+            for (const auto& p : placed)
+                if (p.Min.X < b.Max.X && b.Min.X < p.Max.X && p.Min.Y < b.Max.Y && b.Min.Y < p.Max.Y)
+                    {
+                    clear = false;
+                    break;
+                    }
+            if (clear)
+                placed.push_back(b);
+            }
+        });
+    printf("    placed: %zu\n",placed.size());
+
+    for (int32_t cell_size : { 32, 64, 128 })
+        {
+        LabelCollisionGrid grid(KMapSize,KMapSize,cell_size);
+        std::string name = "LabelCollisionGrid, " + std::to_string(cell_size) + " pixel cells, per candidate";
+        Benchmark(name.c_str(),KCandidates,[&]
+            {
+            grid.Clear();
+            placed_count = 0;
+            for (const auto& b : box)
+                if (grid.InsertIfClear(b))
+                    placed_count++;
+            });
+        printf("    placed: %zu\n",placed_count);
+        }
+    }
+
+/** Compares placing the candidates again after a pan, using LabelPlacer with and without incremental placement. */
+void BenchmarkIncremental()
+    {
+    auto box = MakeBoxes();
+    for (bool incremental : { false, true })
+        {
+        LabelPlacer placer(KMapSize,KMapSize);
+        Point pan(7,-3);
+        Point offset;
+        std::string name = std::string(incremental ? "incremental" : "full") + " placement after a pan, per candidate";
+        Benchmark(name.c_str(),KCandidates,[&]
+            {
+            // Alternate the direction of the pan so that the labels stay in the same area.
+            pan = Point(-pan.X,-pan.Y);
+            offset += pan;
+            placer.BeginFrame(KMapSize,KMapSize,incremental,pan);
+            for (size_t i = 0; i < box.size(); i++)
+                placer.Place(i,Rect(box[i].Min.X + offset.X,box[i].Min.Y + offset.Y,box[i].Max.X + offset.X,box[i].Max.Y + offset.Y));
+            });
+        const auto& s = placer.FrameStatistics();
+        printf("    placed: %zu, retained: %zu\n",s.Placed,s.Retained);
+        }
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "Placement", BenchmarkPlacement },
+        { "Incremental", BenchmarkIncremental },
+        });
+    }
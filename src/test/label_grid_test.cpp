@@ -0,0 +1,199 @@
+/*
+label_grid_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of LabelCollisionGrid and LabelPlacer in cartotype_label_grid.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_label_grid.h>
+#include <random>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** Returns true if aA and aB overlap within the area of aWidth x aHeight pixels covered by a grid. */
+bool Overlaps(const Rect& aA,const Rect& aB,int32_t aWidth,int32_t aHeight)
+    {
+    int32_t min_x = std::max({ aA.Min.X,aB.Min.X,0 });
+    int32_t min_y = std::max({ aA.Min.Y,aB.Min.Y,0 });
+    int32_t max_x = std::min({ aA.Max.X,aB.Max.X,aWidth });
+    int32_t max_y = std::min({ aA.Max.Y,aB.Max.Y,aHeight });
+    return min_x < max_x && min_y < max_y;
+    }
+
+/** Returns a random label box, some of which are partly or wholly outside a map of aWidth x aHeight pixels. */
+Rect RandomBox(std::mt19937& aRandom,int32_t aWidth,int32_t aHeight)
+    {
+    int32_t x = int32_t(aRandom() % uint32_t(aWidth + 200)) - 100;
+    int32_t y = int32_t(aRandom() % uint32_t(aHeight + 200)) - 100;
+    int32_t w = 20 + int32_t(aRandom() % 120);
+    int32_t h = 10 + int32_t(aRandom() % 14);
+    return Rect(x,y,x + w,y + h);
+    }
+
+void TestEdges()
+    {
+    LabelCollisionGrid grid(256,256,64);
+    grid.Insert(Rect(10,10,50,30));
+    CT_CHECK(grid.Count() == 1);
+    CT_CHECK(grid.Intersects(Rect(49,29,60,40)));
+    CT_CHECK(!grid.Intersects(Rect(50,10,60,30)));   // touching on the right
+    CT_CHECK(!grid.Intersects(Rect(10,30,50,40)));   // touching below
+    CT_CHECK(!grid.Intersects(Rect(20,20,20,25)));   // empty
+    CT_CHECK(!grid.InsertIfClear(Rect(0,0,11,11)));
+    CT_CHECK(grid.InsertIfClear(Rect(0,0,10,10)));
+    CT_CHECK(grid.Count() == 2);
+
+    // Boxes partly outside the grid are clipped to it; boxes wholly outside are ignored.
+    grid.Insert(Rect(-20,200,5,300));
+    CT_CHECK(grid.Count() == 3);
+    CT_CHECK(grid.Intersects(Rect(0,250,3,252)));
+    grid.Insert(Rect(-20,-20,0,0));
+    grid.Insert(Rect(256,0,300,10));
+    CT_CHECK(grid.Count() == 3);
+    CT_CHECK(!grid.Intersects(Rect(-50,-50,300,0)));
+
+    // A box crossing cell boundaries is found from every cell.
+    grid.Insert(Rect(60,60,200,70));
+    CT_CHECK(grid.Intersects(Rect(63,69,64,70)));
+    CT_CHECK(grid.Intersects(Rect(128,60,129,61)));
+    CT_CHECK(grid.Intersects(Rect(199,65,250,66)));
+    CT_CHECK(!grid.Intersects(Rect(200,65,250,66)));
+
+    grid.Clear();
+    CT_CHECK(grid.Count() == 0);
+    CT_CHECK(!grid.Intersects(Rect(0,0,256,256)));
+    }
+
+/**
+Compares the grid with testing every box, for several cell sizes, including ones which are not powers of two.
+Overlaps outside the area covered by the grid are not detected.
+*/
+void TestAgainstLinearScan()
+    {
+    const int32_t width = 1000;
+    const int32_t height = 700;
+    for (int32_t cell_size : { 1, 8, 50, 64, 256 })
+        {
+        std::mt19937 random { uint32_t(cell_size) };
+        LabelCollisionGrid grid(width,height,cell_size);
+        for (int frame = 0; frame < 3; frame++)
+            {
+            std::vector<Rect> placed;
+            for (int i = 0; i < 3000; i++)
+                {
+                Rect box = RandomBox(random,width,height);
+                bool clipped_away = box.Max.X <= 0 || box.Max.Y <= 0 || box.Min.X >= width || box.Min.Y >= height;
+                bool expected = false;
+                for (const auto& p : placed)
+                    if (Overlaps(p,box,width,height))
+                        expected = true;
+                CT_CHECK(grid.Intersects(box) == expected);
+                if (!expected && !clipped_away)
+                    {
+                    CT_CHECK(grid.InsertIfClear(box));
+                    placed.push_back(box);
+                    }
+                }
+            CT_CHECK(grid.Count() == placed.size());
+            grid.Clear();
+            }
+        }
+    }
+
+/**
+Places aBox in turn, moved by aOffset, using incremental and non-incremental placers, and checks that they agree.
+aPan is the movement since the previous frame.
+*/
+void PlaceFrame(LabelPlacer& aIncremental,LabelPlacer& aFull,const std::vector<Rect>& aBox,Point aOffset,Point aPan,int32_t aWidth,int32_t aHeight)
+    {
+    aIncremental.BeginFrame(aWidth,aHeight,true,aPan);
+    aFull.BeginFrame(aWidth,aHeight,false);
+    for (size_t i = 0; i < aBox.size(); i++)
+        {
+        Rect box(aBox[i].Min.X + aOffset.X,aBox[i].Min.Y + aOffset.Y,aBox[i].Max.X + aOffset.X,aBox[i].Max.Y + aOffset.Y);
+        CT_CHECK(aIncremental.Place(i,box) == aFull.Place(i,box));
+        }
+    CT_CHECK(aIncremental.FrameStatistics().Placed == aFull.FrameStatistics().Placed);
+    CT_CHECK(aIncremental.FrameStatistics().Candidates == aBox.size());
+    CT_CHECK(aFull.FrameStatistics().Retained == 0);
+    }
+
+/**
+Checks that incremental placement places the same labels as non-incremental placement: after a pan,
+when most labels are retained; after a zoom, when none are; and after a change of size, which discards the previous frame.
+Some labels overlap only outside the map, and are not retained, because after a pan the overlap may come into view.
+*/
+void TestIncrementalPlacement()
+    {
+    const int32_t width = 1000;
+    const int32_t height = 700;
+    std::mt19937 random(1);
+    std::vector<Rect> box(4000);
+    for (auto& b : box)
+        b = RandomBox(random,width,height);
+
+    LabelPlacer incremental(width,height);
+    LabelPlacer full(width,height);
+    PlaceFrame(incremental,full,box,Point(0,0),Point(0,0),width,height);
+    CT_CHECK(incremental.FrameStatistics().Retained == 0);
+
+    Point offset(0,0);
+    for (Point pan : { Point(10,-5), Point(-200,30), Point(3,400) })
+        {
+        offset += pan;
+        PlaceFrame(incremental,full,box,offset,pan,width,height);
+        CT_CHECK(incremental.FrameStatistics().Retained > 0);
+        CT_CHECK(incremental.FrameStatistics().Retained <= incremental.FrameStatistics().Placed);
+        }
+    PlaceFrame(incremental,full,box,offset,Point(0,0),width,height);
+    CT_CHECK(incremental.FrameStatistics().Retained > 0);
+
+    // A zoom changes the boxes, so none are retained.
+    for (auto& b : box)
+        b = Rect(b.Min.X * 2,b.Min.Y * 2,b.Max.X * 2,b.Max.Y * 2);
+    PlaceFrame(incremental,full,box,offset,Point(0,0),width,height);
+    CT_CHECK(incremental.FrameStatistics().Retained == 0);
+
+    // A change of size discards the previous frame.
+    PlaceFrame(incremental,full,box,offset,Point(0,0),width + 1,height);
+    CT_CHECK(incremental.FrameStatistics().Retained == 0);
+
+    // BeginFrame with aIncremental false discards the previous frame.
+    incremental.BeginFrame(width + 1,height,false,Point(0,0));
+    for (size_t i = 0; i < box.size(); i++)
+        incremental.Place(i,box[i]);
+    CT_CHECK(incremental.FrameStatistics().Retained == 0);
+    }
+
+void TestIsClear()
+    {
+    LabelPlacer placer(500,500);
+    placer.BeginFrame(500,500,true);
+    CT_CHECK(placer.Place(1,Rect(0,0,100,20)));
+    placer.BeginFrame(500,500,true,Point(5,5));
+    CT_CHECK(placer.Place(2,Rect(200,200,260,220)));
+    CT_CHECK(placer.Place(1,Rect(5,5,105,25)));
+    CT_CHECK(placer.FrameStatistics().Retained == 1);
+    CT_CHECK(!placer.IsClear(Rect(100,20,110,30)));   // overlaps the retained label
+    CT_CHECK(!placer.IsClear(Rect(250,210,300,230))); // overlaps the new label
+    CT_CHECK(placer.IsClear(Rect(105,25,200,200)));
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "Edges", TestEdges },
+        { "AgainstLinearScan", TestAgainstLinearScan },
+        { "IncrementalPlacement", TestIncrementalPlacement },
+        { "IsClear", TestIsClear },
+        });
+    }
@@ -0,0 +1,97 @@
+/*
+png_benchmark.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Benchmarks of PngEncoder in cartotype_png.h. Link with zlib.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_png.h>
+#include <thread>
+#include <zlib.h>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** Fills aData, a 1024 x 1024 RGBA32 bitmap, with something like a map tile: flat areas of color crossed by roads and gradients. */
+void MakeMapImage(std::vector<uint32_t>& aData,int32_t aSize)
+    {
+    aData.resize(size_t(aSize) * aSize);
+    for (int32_t y = 0; y < aSize; y++)
+        for (int32_t x = 0; x < aSize; x++)
+            {
+            uint32_t color = ((x / 97 + y / 61) % 4) ? 0xFFE0F0F0 : 0xFFB0D8A0;
+            if ((x + 2 * y) % 150 < 6 || (3 * x - y + 4096) % 233 < 4)
+                color = 0xFF4080FF;
+            if (x % 256 < 64)
+                color = 0xFF000000 | uint32_t(x % 64 * 4) << 16 | uint32_t(y % 256) << 8 | 0x80;
+            aData[size_t(y) * aSize + x] = color;
+            }
+    }
+
+/**
+Measures the time taken to encode a 1024 x 1024 map-like image at compression levels 1 and 6, and with the fast palette,
+using one thread and the hardware threads, and prints the size of the output for comparison with the
+size given by compressing the unfiltered pixels as a single zlib stream.
+*/
+void BenchmarkEncode()
+    {
+    const int32_t size = 1024;
+    const size_t pixels = size_t(size) * size;
+    std::vector<uint32_t> data;
+    MakeMapImage(data,size);
+    BitmapView bitmap(BitmapType::RGBA32,(uint8_t*)data.data(),size,size,size * 4);
+
+    size_t hardware_threads = std::max(std::thread::hardware_concurrency(),1U);
+    ThreadPool pool(hardware_threads);
+    for (bool palettize : { false, true })
+        for (int32_t level : { 1, 6 })
+            for (size_t threads : { size_t(1), hardware_threads })
+                {
+                PngEncoderParam param;
+                param.CompressionLevel = level;
+                param.FastPalettize = palettize;
+                param.ThreadCount = 1;
+                if (threads > 1)
+                    param.Pool = &pool;
+                size_t output_size = 0;
+                std::string name = std::string(palettize ? "fast palette" : "RGB") + ", level " + std::to_string(level) +
+                                   ", " + std::to_string(threads) + (threads > 1 ? " threads" : " thread") + ", per pixel";
+                Benchmark(name.c_str(),pixels,[&]
+                    {
+                    MemoryOutputStream output;
+                    PngEncoder::Write(output,bitmap,param);
+                    output_size = output.Length();
+                    });
+                printf("    output: %zu bytes\n",output_size);
+                if (threads == hardware_threads)
+                    break;
+                }
+
+    for (int32_t level : { 1, 6 })
+        {
+        std::vector<uint8_t> compressed(compressBound(uLong(pixels * 4)));
+        uLongf length = 0;
+        std::string name = "unfiltered RGBA as one zlib stream, level " + std::to_string(level) + ", per pixel";
+        Benchmark(name.c_str(),pixels,[&]
+            {
+            length = uLongf(compressed.size());
+            compress2(compressed.data(),&length,(const uint8_t*)data.data(),uLong(pixels * 4),level);
+            });
+        printf("    output: %zu bytes\n",size_t(length));
+        }
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "Encode", BenchmarkEncode },
+        });
+    }
@@ -0,0 +1,317 @@
+/*
+png_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of PngEncoder in cartotype_png.h. The images written are decoded by a simple decoder here,
+which checks the chunk CRCs and uses zlib to decompress and check the image data.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_png.h>
+#include <random>
+#include <zlib.h>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** An image decoded from a PNG file, with the pixels as RGBA values, red in the low byte. */
+class DecodedImage
+    {
+    public:
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint8_t ColorType = 0;
+    bool HasTransparencyChunk = false;
+    size_t DataChunks = 0;
+    std::vector<uint32_t> Pixel;
+    };
+
+uint32_t ReadBigEndian32(const uint8_t* aP)
+    {
+    return uint32_t(aP[0]) << 24 | uint32_t(aP[1]) << 16 | uint32_t(aP[2]) << 8 | aP[3];
+    }
+
+DecodedImage Decode(const std::vector<uint8_t>& aPng)
+    {
+    static const uint8_t signature[8] = { 0x89,'P','N','G','\r','\n',0x1A,'\n' };
+    CT_CHECK(aPng.size() >= 8 && !memcmp(aPng.data(),signature,8));
+
+    DecodedImage image;
+    std::vector<uint8_t> palette;
+    std::vector<uint8_t> transparency;
+    std::vector<uint8_t> compressed;
+    bool end = false;
+    for (size_t pos = 8; !end; )
+        {
+        CT_CHECK(pos + 12 <= aPng.size());
+        size_t length = ReadBigEndian32(aPng.data() + pos);
+        CT_CHECK(pos + 12 + length <= aPng.size());
+        const uint8_t* type = aPng.data() + pos + 4;
+        const uint8_t* data = type + 4;
+        CT_CHECK(ReadBigEndian32(data + length) == uint32_t(crc32(crc32(0,nullptr,0),type,uInt(length + 4))));
+        if (!memcmp(type,"IHDR",4))
+            {
+            CT_CHECK(length == 13);
+            image.Width = ReadBigEndian32(data);
+            image.Height = ReadBigEndian32(data + 4);
+            CT_CHECK(data[8] == 8);
+            image.ColorType = data[9];
+            }
+        else if (!memcmp(type,"PLTE",4))
+            palette.assign(data,data + length);
+        else if (!memcmp(type,"tRNS",4))
+            {
+            transparency.assign(data,data + length);
+            image.HasTransparencyChunk = true;
+            }
+        else if (!memcmp(type,"IDAT",4))
+            {
+            compressed.insert(compressed.end(),data,data + length);
+            image.DataChunks++;
+            }
+        else if (!memcmp(type,"IEND",4))
+            end = true;
+        pos += 12 + length;
+        if (end)
+            CT_CHECK(pos == aPng.size());
+        }
+
+    size_t bytes_per_pixel = image.ColorType == 6 ? 4 : (image.ColorType == 2 ? 3 : 1);
+    CT_CHECK(bytes_per_pixel > 1 || image.ColorType == 3);
+    size_t row_bytes = image.Width * bytes_per_pixel;
+    std::vector<uint8_t> filtered(image.Height * (row_bytes + 1));
+    uLongf filtered_length = uLongf(filtered.size());
+    CT_CHECK(uncompress(filtered.data(),&filtered_length,compressed.data(),uLong(compressed.size())) == Z_OK);
+    CT_CHECK(filtered_length == filtered.size());
+
+    std::vector<uint8_t> prev(row_bytes);
+    std::vector<uint8_t> row(row_bytes);
+    image.Pixel.resize(size_t(image.Width) * image.Height);
+    for (size_t y = 0; y < image.Height; y++)
+        {
+        const uint8_t* p = filtered.data() + y * (row_bytes + 1);
+        uint8_t filter = *p++;
+        for (size_t i = 0; i < row_bytes; i++)
+            {
+            int a = i >= bytes_per_pixel ? row[i - bytes_per_pixel] : 0;
+            int b = prev[i];
+            int c = i >= bytes_per_pixel ? prev[i - bytes_per_pixel] : 0;
+            int predictor = 0;
+            switch (filter)
+                {
+                case 0: break;
+                case 1: predictor = a; break;
+                case 2: predictor = b; break;
+                case 3: predictor = (a + b) / 2; break;
+                case 4:
+                    {
+                    int pa = std::abs(b - c);
+                    int pb = std::abs(a - c);
+                    int pc = std::abs(a + b - 2 * c);
+                    predictor = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                    break;
+                    }
+                default: CT_CHECK(false);
+                }
+            row[i] = uint8_t(p[i] + predictor);
+            }
+        for (size_t x = 0; x < image.Width; x++)
+            {
+            const uint8_t* q = row.data() + x * bytes_per_pixel;
+            uint32_t pixel;
+            if (image.ColorType == 3)
+                {
+                CT_CHECK(size_t(*q) * 3 + 3 <= palette.size());
+                const uint8_t* c = palette.data() + *q * 3;
+                uint32_t alpha = *q < transparency.size() ? transparency[*q] : 0xFF;
+                pixel = c[0] | uint32_t(c[1]) << 8 | uint32_t(c[2]) << 16 | alpha << 24;
+                }
+            else
+                pixel = q[0] | uint32_t(q[1]) << 8 | uint32_t(q[2]) << 16 | uint32_t(bytes_per_pixel == 4 ? q[3] : 0xFF) << 24;
+            image.Pixel[y * image.Width + x] = pixel;
+            }
+        std::swap(row,prev);
+        }
+    return image;
+    }
+
+/** A premultiplied RGBA32 bitmap with smooth gradients, noise, and, unless aOpaque is true, transparent areas. */
+class TestImage
+    {
+    public:
+    TestImage(uint32_t aWidth,uint32_t aHeight,bool aOpaque,uint32_t aSeed = 1):
+        Data(size_t(aWidth) * aHeight),
+        View(BitmapType::RGBA32,(uint8_t*)Data.data(),aWidth,aHeight,aWidth * 4)
+        {
+        std::mt19937 random(aSeed);
+        for (uint32_t y = 0; y < aHeight; y++)
+            for (uint32_t x = 0; x < aWidth; x++)
+                {
+                uint32_t alpha = aOpaque ? 255 : ((x / 8 + y / 8) % 3 ? 255 : random() % 256);
+                uint32_t r = (x * 255 / std::max(aWidth,1U) + random() % 4) % 256;
+                uint32_t g = (y * 255 / std::max(aHeight,1U)) % 256;
+                uint32_t b = random() % 8 ? 128 : random() % 256;
+                r = r * alpha / 255;
+                g = g * alpha / 255;
+                b = b * alpha / 255;
+                Data[size_t(y) * aWidth + x] = r | g << 8 | b << 16 | alpha << 24;
+                }
+        }
+
+    /** Returns the straight (not premultiplied) pixels which the encoder should write. */
+    std::vector<uint32_t> StraightPixels() const
+        {
+        std::vector<uint32_t> pixel(Data.size());
+        for (int32_t y = 0; y < View.Height(); y++)
+            View.ReadRow(uint32_t(y),pixel.data() + size_t(y) * View.Width());
+        BitmapView::Unpremultiply(pixel.data(),pixel.size());
+        return pixel;
+        }
+
+    std::vector<uint32_t> Data;
+    BitmapView View;
+    };
+
+std::vector<uint8_t> Encode(const BitmapView& aBitmap,const PngEncoderParam& aParam)
+    {
+    MemoryOutputStream output;
+    CT_CHECK(PngEncoder::Write(output,aBitmap,aParam) == KErrorNone);
+    return output.RemoveData();
+    }
+
+void TestRoundTrip()
+    {
+    for (bool opaque : { false, true })
+        for (uint32_t width : { 1, 2, 7, 100 })
+            for (uint32_t height : { 1, 3, 60 })
+                for (int32_t level : { 0, 1, 6, 9 })
+                    {
+                    TestImage image(width,height,opaque,width * height);
+                    PngEncoderParam param;
+                    param.CompressionLevel = level;
+                    param.ThreadCount = 1;
+                    DecodedImage decoded = Decode(Encode(image.View,param));
+                    CT_CHECK(decoded.Width == width && decoded.Height == height);
+                    CT_CHECK(decoded.ColorType == (opaque ? 2 : 6));
+                    CT_CHECK(decoded.Pixel == image.StraightPixels());
+                    }
+    }
+
+/** Checks the fast palette: colors are rounded to the 6 x 7 x 6 cube, and pixels less than half opaque become transparent. */
+void TestFastPalettize()
+    {
+    for (bool opaque : { false, true })
+        {
+        TestImage image(50,40,opaque);
+        PngEncoderParam param;
+        param.FastPalettize = true;
+        param.ChunkSize = 256;
+        DecodedImage decoded = Decode(Encode(image.View,param));
+        CT_CHECK(decoded.ColorType == 3);
+        CT_CHECK(decoded.HasTransparencyChunk == !opaque);
+        auto expected = image.StraightPixels();
+        for (size_t i = 0; i < expected.size(); i++)
+            {
+            uint32_t p = expected[i];
+            uint32_t q = decoded.Pixel[i];
+            if ((p >> 24) < 128)
+                {
+                CT_CHECK((q >> 24) == 0);
+                continue;
+                }
+            CT_CHECK((q >> 24) == 0xFF);
+            uint32_t r = ((p & 0xFF) * 5 + 127) / 255 * 255 / 5;
+            uint32_t g = (((p >> 8) & 0xFF) * 6 + 127) / 255 * 255 / 6;
+            uint32_t b = (((p >> 16) & 0xFF) * 5 + 127) / 255 * 255 / 5;
+            CT_CHECK((q & 0xFFFFFF) == (r | g << 8 | b << 16));
+            }
+        }
+    }
+
+/**
+Checks that the output does not depend on the number of threads or on whether a shared pool is used,
+and that images compressed in many chunks, including chunks smaller than the 32Kb dictionary
+and chunks of a single row, decode correctly.
+*/
+void TestChunks()
+    {
+    TestImage image(300,200,false);
+    auto expected = image.StraightPixels();
+    ThreadPool pool(3);
+    for (size_t chunk_size : { size_t(1), size_t(5000), size_t(40000), size_t(128 * 1024), size_t(1) << 30 })
+        {
+        PngEncoderParam param;
+        param.ChunkSize = chunk_size;
+        param.ThreadCount = 1;
+        auto single_thread = Encode(image.View,param);
+        DecodedImage decoded = Decode(single_thread);
+        CT_CHECK(decoded.Pixel == expected);
+        size_t rows_per_chunk = std::max(size_t(1),chunk_size / (300 * 4 + 1));
+        CT_CHECK(decoded.DataChunks == (200 + rows_per_chunk - 1) / rows_per_chunk);
+
+        param.ThreadCount = 4;
+        CT_CHECK(Encode(image.View,param) == single_thread);
+        param.Pool = &pool;
+        CT_CHECK(Encode(image.View,param) == single_thread);
+        }
+    }
+
+/** Checks that a task running on a thread pool can encode an image using the same pool, and that several can encode at once. */
+void TestSharedPool()
+    {
+    TestImage image(120,100,false);
+    PngEncoderParam param;
+    param.ChunkSize = 2000;
+    param.ThreadCount = 1;
+    auto expected = Encode(image.View,param);
+
+    ThreadPool pool(2);
+    param.Pool = &pool;
+    std::vector<std::vector<uint8_t>> output(6);
+    std::vector<Result> error(6,KErrorGeneral);
+    TaskGroup group(pool);
+    for (size_t i = 0; i < output.size(); i++)
+        group.Submit([&,i](size_t)
+            {
+            MemoryOutputStream stream;
+            error[i] = PngEncoder::Write(stream,image.View,param);
+            output[i] = stream.RemoveData();
+            });
+    std::vector<uint8_t> outside;
+    for (int i = 0; i < 3; i++)
+        outside = Encode(image.View,param);
+    group.Wait();
+    CT_CHECK(outside == expected);
+    for (size_t i = 0; i < output.size(); i++)
+        {
+        CT_CHECK(error[i] == KErrorNone);
+        CT_CHECK(output[i] == expected);
+        }
+    }
+
+void TestEmptyBitmap()
+    {
+    uint32_t data = 0;
+    MemoryOutputStream output;
+    CT_CHECK(PngEncoder::Write(output,BitmapView(BitmapType::RGBA32,(uint8_t*)&data,0,1,4)) == KErrorInvalidArgument);
+    CT_CHECK(PngEncoder::Write(output,BitmapView(BitmapType::RGBA32,(uint8_t*)&data,1,0,4)) == KErrorInvalidArgument);
+    CT_CHECK(output.Length() == 0);
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "RoundTrip", TestRoundTrip },
+        { "FastPalettize", TestFastPalettize },
+        { "Chunks", TestChunks },
+        { "SharedPool", TestSharedPool },
+        { "EmptyBitmap", TestEmptyBitmap },
+        });
+    }
@@ -0,0 +1,81 @@
+/*
+span_benchmark.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Benchmarks of SpanBlender in cartotype_span.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_span.h>
+#include <random>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/**
+Compares the time taken to composite spans using SpanBlender with a loop calling the scalar functions for each pixel,
+for short spans, like those of glyphs, and long spans, like those of filled areas. The coverage is like that of
+anti-aliased shapes and glyphs: runs of zero, full and partial coverage.
+*/
+void BenchmarkSpans()
+    {
+    std::mt19937 random(1);
+    for (size_t count : { 16, 1024 })
+        {
+        std::vector<uint32_t> dest(count);
+        std::vector<uint32_t> source(count);
+        std::vector<uint8_t> coverage(count);
+        for (size_t i = 0; i < count; i++)
+            {
+            dest[i] = 0xFF000000 | (random() & 0xFFFFFF);
+            uint32_t a = random() & 0xFF;
+            source[i] = (a << 24) | (a * 0x010101U & 0x7F7F7F);
+            coverage[i] = i % 32 < 8 ? 0 : i % 32 < 20 ? 255 : uint8_t(random());
+            }
+        const uint32_t color = 0x80402010;
+        std::string prefix = std::to_string(count) + " pixels: ";
+
+        Benchmark((prefix + "BlendColor with coverage: per-pixel loop, per pixel").c_str(),count,[&]
+            {
+            for (size_t i = 0; i < count; i++)
+                if (coverage[i])
+                    dest[i] = SpanBlender::Over(dest[i],SpanBlender::Multiply(color,coverage[i]));
+            });
+        Benchmark((prefix + "BlendColor with coverage: SpanBlender, per pixel").c_str(),count,[&]
+            {
+            SpanBlender::BlendColor(dest.data(),count,color,coverage.data());
+            });
+        Benchmark((prefix + "FillColor translucent: per-pixel loop, per pixel").c_str(),count,[&]
+            {
+            for (size_t i = 0; i < count; i++)
+                dest[i] = SpanBlender::Over(dest[i],color);
+            });
+        Benchmark((prefix + "FillColor translucent: SpanBlender, per pixel").c_str(),count,[&]
+            {
+            SpanBlender::FillColor(dest.data(),count,color,255);
+            });
+        Benchmark((prefix + "BlendPixels with alpha: per-pixel loop, per pixel").c_str(),count,[&]
+            {
+            for (size_t i = 0; i < count; i++)
+                dest[i] = SpanBlender::Over(dest[i],SpanBlender::Multiply(source[i],200));
+            });
+        Benchmark((prefix + "BlendPixels with alpha: SpanBlender, per pixel").c_str(),count,[&]
+            {
+            SpanBlender::BlendPixels(dest.data(),source.data(),count,nullptr,200);
+            });
+        }
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "Spans", BenchmarkSpans },
+        });
+    }
@@ -0,0 +1,146 @@
+/*
+span_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of SpanBlender in cartotype_span.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_span.h>
+#include <random>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** Returns a random premultiplied pixel, often opaque or transparent. */
+uint32_t RandomPixel(std::mt19937& aRandom)
+    {
+    uint32_t a;
+    switch (aRandom() % 4)
+        {
+        case 0: a = 0; break;
+        case 1: a = 255; break;
+        default: a = aRandom() & 0xFF; break;
+        }
+    uint32_t p = a << 24;
+    for (int shift = 0; shift < 24; shift += 8)
+        p |= (a ? aRandom() % (a + 1) : 0) << shift;
+    return p;
+    }
+
+/** Returns aCount random coverage values, with runs of zeros long enough to be skipped. */
+std::vector<uint8_t> RandomCoverage(std::mt19937& aRandom,size_t aCount)
+    {
+    std::vector<uint8_t> coverage(aCount);
+    for (size_t i = 0; i < aCount; i++)
+        {
+        if (i % 16 < 6)
+            coverage[i] = 0;
+        else if (i % 16 < 9)
+            coverage[i] = 255;
+        else
+            coverage[i] = uint8_t(aRandom());
+        }
+    return coverage;
+    }
+
+std::vector<uint32_t> RandomPixels(std::mt19937& aRandom,size_t aCount)
+    {
+    std::vector<uint32_t> pixel(aCount);
+    for (auto& p : pixel)
+        p = RandomPixel(aRandom);
+    return pixel;
+    }
+
+/** Compares each SIMD kernel with a per-pixel calculation using the scalar functions, for many span lengths. */
+void TestKernels()
+    {
+    std::mt19937 random(1);
+    for (size_t count = 0; count < 70; count++)
+        {
+        for (int repeat = 0; repeat < 20; repeat++)
+            {
+            auto dest = RandomPixels(random,count);
+            auto source = RandomPixels(random,count);
+            auto coverage = RandomCoverage(random,count);
+            uint32_t color = RandomPixel(random);
+            uint8_t alpha = repeat % 3 ? uint8_t(random()) : 255;
+
+            auto result = dest;
+            SpanBlender::BlendColor(result.data(),count,color,coverage.data());
+            for (size_t i = 0; i < count; i++)
+                CT_CHECK(result[i] == (coverage[i] ? SpanBlender::Over(dest[i],SpanBlender::Multiply(color,coverage[i])) : dest[i]));
+
+            result = dest;
+            SpanBlender::FillColor(result.data(),count,color,alpha);
+            for (size_t i = 0; i < count; i++)
+                CT_CHECK(result[i] == (alpha ? SpanBlender::Over(dest[i],SpanBlender::Multiply(color,alpha)) : dest[i]));
+
+            for (bool use_coverage : { false, true })
+                {
+                result = dest;
+                SpanBlender::BlendPixels(result.data(),source.data(),count,use_coverage ? coverage.data() : nullptr,alpha);
+                for (size_t i = 0; i < count; i++)
+                    {
+                    uint8_t c = use_coverage ? SpanBlender::MultiplyIntensities(coverage[i],alpha) : alpha;
+                    CT_CHECK(result[i] == (c ? SpanBlender::Over(dest[i],SpanBlender::Multiply(source[i],c)) : dest[i]));
+                    }
+                }
+
+            if (count)
+                {
+                size_t pattern_length = 1 + random() % 9;
+                size_t pattern_offset = random() % 20;
+                auto pattern = RandomPixels(random,pattern_length);
+                result = dest;
+                SpanBlender::BlendPattern(result.data(),count,pattern.data(),pattern_length,pattern_offset,coverage.data(),alpha);
+                for (size_t i = 0; i < count; i++)
+                    {
+                    uint32_t p = pattern[(pattern_offset + i) % pattern_length];
+                    uint8_t c = SpanBlender::MultiplyIntensities(coverage[i],alpha);
+                    CT_CHECK(result[i] == (c ? SpanBlender::Over(dest[i],SpanBlender::Multiply(p,c)) : dest[i]));
+                    }
+                }
+            }
+        }
+    }
+
+void TestScalarFunctions()
+    {
+    // Full intensity leaves values unchanged, and zero intensity makes them zero.
+    for (uint32_t i = 0; i < 256; i++)
+        {
+        CT_CHECK(SpanBlender::MultiplyIntensities(i,255) == i);
+        CT_CHECK(SpanBlender::MultiplyIntensities(i,0) == 0);
+        }
+
+    // An opaque source replaces the destination, and a transparent one leaves it unchanged.
+    CT_CHECK(SpanBlender::Over(0xFF123456,0xFF654321) == 0xFF654321);
+    CT_CHECK(SpanBlender::Over(0x80402010,0) == 0x80402010);
+
+    // A half-transparent white over opaque black gives mid grey.
+    CT_CHECK(SpanBlender::Over(0xFF000000,0x80808080) == 0xFF808080);
+
+    // An opaque fill is stored directly, and a zero-coverage fill does nothing.
+    uint32_t pixel[5] = { 1, 2, 3, 4, 5 };
+    SpanBlender::FillColor(pixel,5,0xFF0000FF,0);
+    CT_CHECK(pixel[4] == 5);
+    SpanBlender::FillColor(pixel,5,0xFF0000FF,255);
+    for (uint32_t p : pixel)
+        CT_CHECK(p == 0xFF0000FF);
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "Kernels", TestKernels },
+        { "ScalarFunctions", TestScalarFunctions },
+        });
+    }
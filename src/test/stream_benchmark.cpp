@@ -0,0 +1,250 @@
+/*
+stream_benchmark.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Benchmarks of the data streams and file streams in cartotype_stream.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_stream.h>
+#include <filesystem>
+#include <random>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** A temporary file of aLength bytes, deleted by the destructor. */
+class TestFile
+    {
+    public:
+    explicit TestFile(size_t aLength)
+        {
+        Name = (std::filesystem::temp_directory_path() / "cartotype_stream_benchmark.bin").string();
+        std::vector<uint8_t> data(aLength);
+        for (size_t i = 0; i < aLength; i++)
+            data[i] = uint8_t(i * 7 + (i >> 12));
+        FILE* file = fopen(Name.c_str(),"wb");
+        CT_CHECK(file != nullptr);
+        CT_CHECK(fwrite(data.data(),1,data.size(),file) == data.size());
+        fclose(file);
+        }
+    ~TestFile()
+        {
+        std::error_code ec;
+        std::filesystem::remove(Name,ec);
+        }
+
+    std::string Name;
+    };
+
+/**
+Compares the time taken to find a buffer by FileInputStream, which searches its list of buffers,
+and CachedFileInputStream, which uses an index. The positions read are all in the cache,
+so the time measured is the time taken to find a buffer, not to read the file.
+*/
+void BenchmarkBufferLookup()
+    {
+    const size_t buffer_size = 4096;
+    const size_t reads = 100000;
+    TestFile file(4096 * buffer_size);
+    for (size_t max_buffers : { 32, 256, 4096 })
+        {
+        std::vector<int64_t> position(reads);
+        std::mt19937 random(1);
+        for (auto& p : position)
+            p = int64_t(random() % (max_buffers * buffer_size));
+
+        auto run = [&](FileInputStream& aStream)
+            {
+            const uint8_t* p;
+            size_t n;
+            for (int64_t pos : position)
+                {
+                aStream.Seek(pos);
+                aStream.Read(p,n);
+                }
+            };
+
+        FileInputStream list_stream(file.Name,buffer_size,max_buffers);
+        CachedFileInputStream indexed_stream(file.Name,buffer_size,max_buffers);
+        std::string name = std::to_string(max_buffers) + " buffers: ";
+        Benchmark((name + "FileInputStream, per read").c_str(),reads,[&] { run(list_stream); });
+        Benchmark((name + "CachedFileInputStream, per read").c_str(),reads,[&] { run(indexed_stream); });
+        }
+    }
+
+/**
+Compares the time taken to decode arrays of variable-length integers by a loop calling DataInputStream::ReadUint or ReadInt,
+by a loop calling the inline functions, by ReadUintArray and ReadIntDeltaArray, and by each decoder supported by the processor.
+The signed data is like the coordinate differences in map objects: mostly one or two bytes.
+*/
+void BenchmarkVariableLengthIntegers()
+    {
+    const size_t count = 1000000;
+    std::mt19937 random(2);
+    MemoryOutputStream uint_memory;
+    MemoryOutputStream int_memory;
+        {
+        DataOutputStream uint_output(uint_memory);
+        DataOutputStream int_output(int_memory);
+        for (size_t i = 0; i < count; i++)
+            {
+            uint_output.WriteUint(random() % 8 ? random() % 100 : random() % 100000);
+            int_output.WriteInt(random() % 4 ? int32_t(random() % 100) - 50 : int32_t(random() % 10000) - 5000);
+            }
+        }
+    std::vector<uint64_t> uint_array(count);
+    std::vector<int32_t> int_array(count);
+
+    Benchmark("unsigned: ReadUint loop, per value",count,[&]
+        {
+        ContiguousDataInputStream input(uint_memory.Data(),uint_memory.Length());
+        for (auto& v : uint_array)
+            v = input.ReadUint();
+        });
+    Benchmark("unsigned: ReadUintInline loop, per value",count,[&]
+        {
+        ContiguousDataInputStream input(uint_memory.Data(),uint_memory.Length());
+        for (auto& v : uint_array)
+            v = input.ReadUintInline();
+        });
+    Benchmark("unsigned: ReadUintArray, per value",count,[&]
+        {
+        ContiguousDataInputStream input(uint_memory.Data(),uint_memory.Length());
+        input.ReadUintArray(uint_array.data(),count);
+        });
+    Benchmark("signed differences: ReadInt loop, per value",count,[&]
+        {
+        ContiguousDataInputStream input(int_memory.Data(),int_memory.Length());
+        uint32_t value = 0;
+        for (auto& v : int_array)
+            v = int32_t(value += uint32_t(input.ReadInt()));
+        });
+    Benchmark("signed differences: ReadIntInline loop, per value",count,[&]
+        {
+        ContiguousDataInputStream input(int_memory.Data(),int_memory.Length());
+        uint32_t value = 0;
+        for (auto& v : int_array)
+            v = int32_t(value += uint32_t(input.ReadIntInline()));
+        });
+    Benchmark("signed differences: ReadIntDeltaArray, per value",count,[&]
+        {
+        ContiguousDataInputStream input(int_memory.Data(),int_memory.Length());
+        input.ReadIntDeltaArray(int_array.data(),count);
+        });
+
+    const char* name[] = { "scalar", "SSE4.1", "AVX2" };
+    for (auto type : { VariableLengthIntegerDecoderType::Scalar, VariableLengthIntegerDecoderType::Sse41, VariableLengthIntegerDecoderType::Avx2 })
+        {
+        auto decoder = VariableLengthIntegerDecoder::Get(type);
+        if (!decoder)
+            continue;
+        std::string uint_name = std::string("unsigned: ") + name[int(type)] + " decoder, per value";
+        Benchmark(uint_name.c_str(),count,[&]
+            {
+            uint64_t* p = uint_array.data();
+            size_t n = count;
+            decoder->ReadUintArray(uint_memory.Data(),uint_memory.Data() + uint_memory.Length(),p,n);
+            });
+        std::string int_name = std::string("signed differences: ") + name[int(type)] + " decoder, per value";
+        Benchmark(int_name.c_str(),count,[&]
+            {
+            int32_t* p = int_array.data();
+            size_t n = count;
+            uint32_t value = 0;
+            decoder->ReadIntDeltaArray(int_memory.Data(),int_memory.Data() + int_memory.Length(),p,n,value);
+            });
+        }
+    }
+
+/**
+Writes aCount records like the map objects in a writable map: an id, a layer, feature info, a string attribute
+and the differences between successive points, which are mostly small.
+*/
+template<class T> void WriteObjects(T& aOutput,size_t aCount)
+    {
+    // Use a table of random numbers so that the time taken to generate them is not measured.
+    static std::vector<uint32_t> random_table;
+    if (random_table.empty())
+        {
+        std::mt19937 random(3);
+        random_table.resize(65536);
+        for (auto& r : random_table)
+            r = random();
+        }
+    size_t r = 0;
+    auto random = [&r]() { return random_table[r++ & 0xFFFF]; };
+
+    for (size_t i = 0; i < aCount; i++)
+        {
+        aOutput.WriteUint(i + 1);
+        aOutput.WriteUint8(uint8_t(i % 40));
+        aOutput.WriteUint32(random());
+        aOutput.WriteString("name=Main Street");
+        aOutput.WriteUint8(0);
+        size_t points = 4 + random() % 12;
+        aOutput.WriteUint(points);
+        for (size_t j = 0; j < points; j++)
+            {
+            aOutput.WriteInt(int32_t(random() % 2000) - 1000);
+            aOutput.WriteInt(int32_t(random() % 2000) - 1000);
+            }
+        }
+    }
+
+/**
+Compares the time taken to write a million map-object records using DataOutputStream, which makes a virtual call
+to the sink for each item, and BufferedDataOutputStream, writing to memory and to a file using VectoredFileOutputStream.
+*/
+void BenchmarkWriteObjects()
+    {
+    const size_t count = 1000000;
+    Benchmark("DataOutputStream to memory, per object",count,[&]
+        {
+        MemoryOutputStream memory;
+        DataOutputStream output(memory);
+        WriteObjects(output,count);
+        });
+    Benchmark("BufferedDataOutputStream to memory, per object",count,[&]
+        {
+        MemoryOutputStream memory;
+        BufferedDataOutputStream output(memory);
+        WriteObjects(output,count);
+        output.Flush();
+        });
+#ifdef CARTOTYPE_VECTORED_FILE_IO
+    std::string name = (std::filesystem::temp_directory_path() / "cartotype_write_benchmark.bin").string();
+    Benchmark("DataOutputStream to file, per object",count,[&]
+        {
+        VectoredFileOutputStream file(name);
+        DataOutputStream output(file);
+        WriteObjects(output,count);
+        });
+    Benchmark("BufferedDataOutputStream to file, per object",count,[&]
+        {
+        VectoredFileOutputStream file(name);
+        BufferedDataOutputStream output(file);
+        WriteObjects(output,count);
+        output.Flush();
+        file.Flush();
+        });
+    std::error_code ec;
+    std::filesystem::remove(name,ec);
+#endif
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "BufferLookup", BenchmarkBufferLookup },
+        { "VariableLengthIntegers", BenchmarkVariableLengthIntegers },
+        { "WriteObjects", BenchmarkWriteObjects },
+        });
+    }
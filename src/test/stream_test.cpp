@@ -0,0 +1,572 @@
+/*
+stream_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of the data streams and file streams in cartotype_stream.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_stream.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** A temporary file of pseudo-random data, deleted by the destructor. */
+class TestFile
+    {
+    public:
+    TestFile(size_t aLength,uint32_t aSeed = 1)
+        {
+        static int count = 0;
+        Name = (std::filesystem::temp_directory_path() / ("cartotype_stream_test_" + std::to_string(aSeed) + "_" + std::to_string(++count) + ".bin")).string();
+        std::mt19937 random(aSeed);
+        Data.resize(aLength);
+        for (auto& p : Data)
+            p = uint8_t(random());
+        Write();
+        }
+    ~TestFile()
+        {
+        std::error_code ec;
+        std::filesystem::remove(Name,ec);
+        }
+
+    /** Writes Data to the file. */
+    void Write()
+        {
+        FILE* file = fopen(Name.c_str(),"wb");
+        CT_CHECK(file != nullptr);
+        CT_CHECK(fwrite(Data.data(),1,Data.size(),file) == Data.size());
+        fclose(file);
+        }
+
+    std::string Name;
+    std::vector<uint8_t> Data;
+    };
+
+/** Reads all the remaining data from aStream. */
+std::vector<uint8_t> ReadAll(MInputStream& aStream)
+    {
+    std::vector<uint8_t> data;
+    for (;;)
+        {
+        const uint8_t* p = nullptr;
+        size_t n = 0;
+        aStream.Read(p,n);
+        if (!n)
+            break;
+        data.insert(data.end(),p,p + n);
+        }
+    return data;
+    }
+
+/** Checks that random seeks and reads of aStream return the contents of aFile. */
+void CheckRandomReads(FileInputStream& aStream,const TestFile& aFile,size_t aReads,uint32_t aSeed)
+    {
+    std::mt19937 random(aSeed);
+    for (size_t i = 0; i < aReads; i++)
+        {
+        int64_t position = int64_t(random() % aFile.Data.size());
+        aStream.Seek(position);
+        CT_CHECK(aStream.Position() == position);
+        const uint8_t* p = nullptr;
+        size_t n = 0;
+        aStream.Read(p,n);
+        CT_CHECK(n > 0 && size_t(position) + n <= aFile.Data.size());
+        CT_CHECK(!memcmp(p,aFile.Data.data() + position,n));
+        }
+    }
+
+/** A data source which returns at most aChunkSize bytes from each call to Read, so that values are split between reads. */
+class ChunkedInputStream: public MInputStream
+    {
+    public:
+    ChunkedInputStream(const std::vector<uint8_t>& aData,size_t aChunkSize):
+        iData(aData),
+        iChunkSize(aChunkSize)
+        {
+        }
+
+    void Read(const uint8_t*& aPointer,size_t& aLength) override
+        {
+        aPointer = iData.data() + iPosition;
+        aLength = std::min(iChunkSize,iData.size() - iPosition);
+        iPosition += aLength;
+        }
+    bool EndOfStream() const override { return iPosition >= iData.size(); }
+    void Seek(int64_t aPosition) override { iPosition = size_t(aPosition); }
+    int64_t Position() override { return int64_t(iPosition); }
+    int64_t Length() override { return int64_t(iData.size()); }
+
+    private:
+    const std::vector<uint8_t>& iData;
+    size_t iChunkSize;
+    size_t iPosition = 0;
+    };
+
+/** Returns a pseudo-random number with a random number of significant bits, so that encoded values have all lengths. */
+uint64_t RandomValue(std::mt19937_64& aRandom)
+    {
+    int bits = int(aRandom() % 65);
+    return bits ? aRandom() >> (64 - bits) : 0;
+    }
+
+void TestCachedFileInputStream()
+    {
+    TestFile file(1000003);
+    for (size_t max_buffers : { 1, 3, 64 })
+        {
+        Result error;
+        auto stream = CachedFileInputStream::New(error,file.Name,4096,max_buffers);
+        CT_CHECK(!error && stream);
+        CT_CHECK(stream->Length() == int64_t(file.Data.size()));
+        CT_CHECK(stream->MaxBuffers() == max_buffers);
+        CT_CHECK(ReadAll(*stream) == file.Data);
+        CT_CHECK(stream->EndOfStream());
+        CheckRandomReads(*stream,file,2000,uint32_t(max_buffers));
+        CT_CHECK(stream->BufferCount() <= max_buffers);
+
+        auto copy = stream->Copy();
+        CT_CHECK(copy->Position() == 0);
+        CT_CHECK(ReadAll(*copy) == file.Data);
+        }
+
+    CachedFileInputStream stream(file.Name,4096,4);
+    stream.Seek(int64_t(file.Data.size()));
+    const uint8_t* p = nullptr;
+    size_t n = 1;
+    stream.Read(p,n);
+    CT_CHECK(n == 0 && stream.EndOfStream());
+    bool thrown = false;
+    try
+        {
+        stream.Seek(int64_t(file.Data.size()) + 1);
+        }
+    catch (Result aError)
+        {
+        thrown = aError == KErrorEndOfData;
+        }
+    CT_CHECK(thrown);
+
+    Result error;
+    auto missing = CachedFileInputStream::New(error,file.Name + ".missing");
+    CT_CHECK(error && !missing);
+    }
+
+void TestCachedFileInputStreamWithDataInputStream()
+    {
+    TestFile file(300000,2);
+    CachedFileInputStream stream(file.Name,1000,8);
+    DataInputStream input(stream);
+    for (size_t i = 0; i < file.Data.size(); i++)
+        CT_CHECK(input.ReadUint8() == file.Data[i]);
+    CT_CHECK(input.EndOfData());
+    input.Seek(123457);
+    CT_CHECK(input.ReadUint32BigEndian() == (uint32_t(file.Data[123457]) << 24 | uint32_t(file.Data[123458]) << 16 | uint32_t(file.Data[123459]) << 8 | file.Data[123460]));
+    }
+
+/**
+Writes numbers using DataOutputStream::WriteUint and WriteInt, as when CTM1 map files are created,
+and checks that the inline decoding functions of DataInputStream read them back, both from a
+ContiguousDataInputStream and from streams which split the data into small pieces.
+*/
+void TestVariableLengthIntegers()
+    {
+    CT_CHECK(VariableLengthIntegerFormatVerified());
+
+    std::mt19937_64 random(5);
+    std::vector<uint64_t> uint_value(20000);
+    std::vector<int64_t> int_value(uint_value.size());
+    for (size_t i = 0; i < uint_value.size(); i++)
+        {
+        uint_value[i] = i % 3 ? random() % 100 : RandomValue(random);
+        int_value[i] = i % 5 ? int64_t(random() % 120) - 60 : int64_t(RandomValue(random));
+        }
+    std::vector<int32_t> point(5000);
+    int32_t value = 0;
+    for (auto& p : point)
+        {
+        int32_t delta = random() % 8 ? int32_t(random() % 100) - 50 : int32_t(random() % 200000) - 100000;
+        p = value = int32_t(uint32_t(value) + uint32_t(delta));
+        }
+
+    MemoryOutputStream memory;
+        {
+        DataOutputStream output(memory);
+        for (size_t i = 0; i < uint_value.size(); i++)
+            {
+            output.WriteUint(uint_value[i]);
+            output.WriteInt(int_value[i]);
+            }
+        for (auto v : uint_value)
+            output.WriteUint(v);
+        int32_t prev = 1000;
+        for (auto p : point)
+            {
+            output.WriteInt(int32_t(uint32_t(p) - uint32_t(prev)));
+            prev = p;
+            }
+        output.WriteUint8(0xAB);
+        }
+    std::vector<uint8_t> data(memory.Data(),memory.Data() + memory.Length());
+
+    auto check = [&](DataInputStream& aInput)
+        {
+        for (size_t i = 0; i < uint_value.size(); i++)
+            {
+            CT_CHECK(aInput.ReadUintInline() == uint_value[i]);
+            CT_CHECK(aInput.ReadIntInline() == int_value[i]);
+            }
+        std::vector<uint64_t> uint_array(uint_value.size());
+        aInput.ReadUintArray(uint_array.data(),uint_array.size());
+        CT_CHECK(uint_array == uint_value);
+        std::vector<int32_t> point_array(point.size());
+        CT_CHECK(aInput.ReadIntDeltaArray(point_array.data(),point_array.size(),1000) == point.back());
+        CT_CHECK(point_array == point);
+        CT_CHECK(aInput.ReadUint8() == 0xAB);
+        CT_CHECK(aInput.EndOfData());
+        };
+
+    ContiguousDataInputStream contiguous(data.data(),data.size());
+    CT_CHECK(contiguous.Length() == data.size());
+    check(contiguous);
+    contiguous.Seek(0);
+    CT_CHECK(contiguous.Position() == 0 && contiguous.ReadUint() == uint_value[0]);
+
+    for (size_t chunk_size : { 1, 3, 7, 9, 17, 1000 })
+        {
+        ChunkedInputStream chunked(data,chunk_size);
+        DataInputStream input(chunked);
+        check(input);
+        }
+
+    // A truncated value throws KErrorEndOfData.
+    uint8_t truncated[] = { 0x80, 0x80 };
+    ContiguousDataInputStream input(truncated,sizeof(truncated));
+    bool thrown = false;
+    try
+        {
+        input.ReadUintInline();
+        }
+    catch (Result aError)
+        {
+        thrown = aError == KErrorEndOfData;
+        }
+    CT_CHECK(thrown);
+    }
+
+/**
+Checks each variable-length integer decoder supported by this processor against DataInputStream::ReadUint and ReadInt,
+using data with runs of single-byte values, one-byte and two-byte values, longer values, and mixtures of them.
+*/
+void TestVariableLengthIntegerDecoders()
+    {
+    std::mt19937_64 random(6);
+    for (int mix = 0; mix < 5; mix++)
+        {
+        std::vector<uint64_t> value(3001);
+        for (size_t i = 0; i < value.size(); i++)
+            {
+            switch (mix)
+                {
+                case 0: value[i] = random() % 128; break;
+                case 1: value[i] = random() % 16384; break;
+                case 2: value[i] = random() % 4 ? random() % 128 : random() % 16384; break;
+                case 3: value[i] = (i / 50) % 2 ? random() % 128 : RandomValue(random); break;
+                default: value[i] = RandomValue(random); break;
+                }
+            }
+        MemoryOutputStream memory;
+            {
+            DataOutputStream output(memory);
+            for (auto v : value)
+                output.WriteUint(v);
+            }
+        const uint8_t* data = memory.Data();
+        const uint8_t* end = data + memory.Length();
+
+        std::vector<uint64_t> expected_uint;
+        std::vector<int32_t> expected_int;
+        ContiguousDataInputStream input(data,memory.Length());
+        uint32_t total = 77;
+        while (!input.EndOfData())
+            {
+            int64_t pos = input.Position();
+            expected_uint.push_back(input.ReadUint());
+            input.Seek(pos);
+            total += uint32_t(input.ReadInt());
+            expected_int.push_back(int32_t(total));
+            }
+
+        for (auto type : { VariableLengthIntegerDecoderType::Scalar, VariableLengthIntegerDecoderType::Sse41, VariableLengthIntegerDecoderType::Avx2 })
+            {
+            auto decoder = VariableLengthIntegerDecoder::Get(type);
+            if (!decoder)
+                {
+                printf("    decoder %d is not supported by this processor\n",int(type));
+                continue;
+                }
+            for (size_t count : { size_t(0), size_t(1), size_t(7), size_t(8), size_t(31), size_t(1000), value.size() })
+                {
+                std::vector<uint64_t> uint_array(count + 1,12345);
+                uint64_t* array = uint_array.data();
+                size_t n = count;
+                const uint8_t* p = decoder->ReadUintArray(data,end,array,n);
+                size_t decoded = count - n;
+                CT_CHECK(array == uint_array.data() + decoded);
+                CT_CHECK(std::equal(uint_array.begin(),uint_array.begin() + decoded,expected_uint.begin()));
+                CT_CHECK(uint_array[count] == 12345);
+                CT_CHECK(n == 0 || end - p < ptrdiff_t(VariableLengthIntegerDecoder::KMinDataBytes));
+
+                std::vector<int32_t> int_array(count + 1,12345);
+                int32_t* int_pointer = int_array.data();
+                n = count;
+                uint32_t last = 77;
+                const uint8_t* q = decoder->ReadIntDeltaArray(data,end,int_pointer,n,last);
+                CT_CHECK(q == p && count - n == decoded);
+                CT_CHECK(std::equal(int_array.begin(),int_array.begin() + decoded,expected_int.begin()));
+                CT_CHECK(last == (decoded ? uint32_t(expected_int[decoded - 1]) : 77));
+                CT_CHECK(int_array[count] == 12345);
+                }
+            }
+        }
+
+    // A value longer than 10 bytes stops the decoders.
+    std::vector<uint8_t> corrupt(32,0x80);
+    for (auto type : { VariableLengthIntegerDecoderType::Scalar, VariableLengthIntegerDecoderType::Sse41, VariableLengthIntegerDecoderType::Avx2 })
+        {
+        auto decoder = VariableLengthIntegerDecoder::Get(type);
+        if (!decoder)
+            continue;
+        uint64_t array[4];
+        uint64_t* p = array;
+        size_t n = 4;
+        CT_CHECK(decoder->ReadUintArray(corrupt.data(),corrupt.data() + corrupt.size(),p,n) == corrupt.data() && n == 4);
+        }
+    }
+
+/** A data sink which records the size of each write, and can be made to throw KErrorIo. */
+class RecordingOutputStream: public MemoryOutputStream
+    {
+    public:
+    void Write(const uint8_t* aBuffer,size_t aBytes) override
+        {
+        if (Fail)
+            throw KErrorIo;
+        WriteSize.push_back(aBytes);
+        MemoryOutputStream::Write(aBuffer,aBytes);
+        }
+
+    std::vector<size_t> WriteSize;
+    bool Fail = false;
+    };
+
+/** Writes a mixture of items, some through the DataOutputStream base class, to aOutput. */
+template<class T> void WriteItems(T& aOutput,const std::vector<uint8_t>& aBlock)
+    {
+    DataOutputStream& base = aOutput;
+    for (int i = 0; i < 3000; i++)
+        {
+        aOutput.WriteUint8(uint8_t(i));
+        aOutput.WriteUint16(uint16_t(i * 3));
+        base.WriteUint16(uint16_t(i * 5));
+        aOutput.WriteUint32(uint32_t(i) * 100003);
+        aOutput.WriteUint(uint64_t(i) << (i % 60));
+        aOutput.WriteInt(-int64_t(i) * 999);
+        base.WriteUint(uint64_t(i) * 77);
+        base.WriteFloat(float(i) / 7);
+        aOutput.WriteUint(uint32_t(i),3);
+        if (i % 500 == 0)
+            aOutput.WriteBytes(aBlock.data(),aBlock.size() - size_t(i));
+        if (i == 1000)
+            aOutput.SetEndianness(StreamEndianness::Little);
+        }
+    aOutput.WriteString("end");
+    }
+
+void TestBufferedDataOutputStream()
+    {
+    std::vector<uint8_t> block(BufferedDataOutputStream::KBufferSize * 2 + 1000);
+    for (size_t i = 0; i < block.size(); i++)
+        block[i] = uint8_t(i * 13);
+
+    MemoryOutputStream expected;
+        {
+        DataOutputStream output(expected);
+        WriteItems(output,block);
+        }
+
+    RecordingOutputStream sink;
+        {
+        BufferedDataOutputStream output(sink);
+        output.WriteUint32(1);
+        CT_CHECK(sink.WriteSize.empty() && output.BufferedBytes() == 4);
+        output.Flush();
+        CT_CHECK(sink.WriteSize.size() == 1 && output.BufferedBytes() == 0);
+        sink.RemoveData();
+        sink.WriteSize.clear();
+
+        WriteItems(output,block);
+        output.Flush();
+        }
+    CT_CHECK(sink.Length() == expected.Length() && !memcmp(sink.Data(),expected.Data(),expected.Length()));
+    for (size_t n : sink.WriteSize)
+        CT_CHECK(n <= BufferedDataOutputStream::KBufferSize || n >= block.size() - 3000);
+
+    // An error from the sink is reported by Flush, and the failed data is not written again.
+    RecordingOutputStream failing_sink;
+    BufferedDataOutputStream output(failing_sink);
+    output.WriteUint(12345);
+    failing_sink.Fail = true;
+    bool thrown = false;
+    try
+        {
+        output.Flush();
+        }
+    catch (Result aError)
+        {
+        thrown = aError == KErrorIo;
+        }
+    CT_CHECK(thrown && output.BufferedBytes() == 0);
+    failing_sink.Fail = false;
+    output.WriteUint8(9);
+    output.Flush();
+    CT_CHECK(failing_sink.Length() == 1 && failing_sink.Data()[0] == 9);
+    }
+
+/** Reads the whole of aStream sequentially, then seeks to and reads aSeeks random positions. */
+void ReadForStatistics(FileInputStream& aStream,int aSeeks)
+    {
+    ReadAll(aStream);
+    std::mt19937 random(8);
+    const uint8_t* p = nullptr;
+    size_t n = 0;
+    for (int i = 0; i < aSeeks; i++)
+        {
+        aStream.Seek(int64_t(random() % uint32_t(aStream.Length())));
+        aStream.Read(p,n);
+        }
+    }
+
+void TestStatistics()
+    {
+    TestFile file(100000,4);
+    CachedFileInputStream cached(file.Name,10000,4);
+    ReadForStatistics(cached,50);
+    FileStatistics s = cached.Statistics();
+    CT_CHECK(s.SeekCount == 50);
+    CT_CHECK(s.ReadCount == 10 + 1 + 50);
+    CT_CHECK(s.BufferHits + s.BufferMisses == 10 + 50);
+    CT_CHECK(s.BufferMisses >= 10 && s.BufferEvictions == s.BufferMisses - 4);
+    CT_CHECK(s.BytesRead >= file.Data.size() && s.BytesRead == (s.BytesRead / 10000) * 10000);
+    cached.ResetStatistics();
+    s = cached.Statistics();
+    CT_CHECK(!s.ReadCount && !s.SeekCount && !s.BufferHits && !s.BufferMisses && !s.BytesRead);
+
+#ifdef CARTOTYPE_MAPPED_FILE_IO
+    MappedFileInputStream mapped(file.Name);
+    ReadForStatistics(mapped,50);
+    s = mapped.Statistics();
+    CT_CHECK(s.SeekCount == 50 && s.ReadCount == 1 + 1 + 50 && !s.BufferMisses);
+#endif
+
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+    Result error;
+    auto shared = SharedFileInputStream::New(error,file.Name,10000,4);
+    CT_CHECK(!error);
+    ReadForStatistics(*shared,50);
+    s = shared->Statistics();
+    CT_CHECK(s.SeekCount == 50 && s.ReadCount == 10 + 1 + 50);
+    CT_CHECK(s.BufferHits + s.BufferMisses == 10 + 50 && s.BufferMisses >= 10);
+#endif
+    }
+
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+void TestReadAhead()
+    {
+    TestFile file(1000000,3);
+    BinaryInputFile input;
+    CT_CHECK(!input.Open(file.Name.c_str()));
+    FileReadAhead read_ahead(input.Descriptor(),4096,8);
+    read_ahead.OnRead(0);
+    read_ahead.OnRead(4096);
+    CT_CHECK(read_ahead.PrefetchEnd() == 0);
+    read_ahead.OnRead(8192);
+    CT_CHECK(read_ahead.PrefetchEnd() == 12288 + 8 * 4096);
+    read_ahead.OnRead(500000);
+    CT_CHECK(read_ahead.PrefetchEnd() == 12288 + 8 * 4096);
+
+    CachedFileInputStream stream(file.Name,4096,4);
+    stream.SetReadAhead(8);
+    CT_CHECK(ReadAll(stream) == file.Data);
+    CheckRandomReads(stream,file,500,3);
+    auto copy = stream.Copy();
+    CT_CHECK(ReadAll(*copy) == file.Data);
+
+    FileInputStreamParam param;
+    param.ReadAheadBufferCount = 8;
+    Result error;
+    auto opened = OpenFileInputStream(error,file.Name,param);
+    CT_CHECK(!error && ReadAll(*opened) == file.Data);
+    }
+#endif
+
+#ifdef CARTOTYPE_DIRECT_FILE_IO
+void TestDirectFileReader()
+    {
+    // The length is not a multiple of the alignment so that the last read stops short.
+    TestFile file(3 * DirectFileReader::KAlignment + 1234,4);
+    Result error;
+    auto reader = DirectFileReader::New(error,file.Name);
+    CT_CHECK(!error && reader && reader->Length() == int64_t(file.Data.size()));
+
+    std::mt19937 random(4);
+    for (bool huge_pages : { false, true })
+        {
+        for (int i = 0; i < 100; i++)
+            {
+            size_t position = random() % file.Data.size();
+            size_t length = random() % (file.Data.size() + 100);
+            auto buffer = reader->Read(error,int64_t(position),length,huge_pages);
+            CT_CHECK(!error && buffer);
+            size_t expected = std::min(length,file.Data.size() - position);
+            CT_CHECK(buffer->Size() == expected);
+            CT_CHECK(!memcmp(buffer->Data(),file.Data.data() + position,expected));
+            }
+        }
+
+    auto buffer = reader->Read(error,-1,10);
+    CT_CHECK(error == KErrorIo && !buffer);
+    reader = DirectFileReader::New(error,file.Name + ".missing");
+    CT_CHECK(error == KErrorNotFound && !reader);
+    }
+#endif
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "CachedFileInputStream", TestCachedFileInputStream },
+        { "CachedFileInputStreamWithDataInputStream", TestCachedFileInputStreamWithDataInputStream },
+        { "Statistics", TestStatistics },
+        { "VariableLengthIntegers", TestVariableLengthIntegers },
+        { "VariableLengthIntegerDecoders", TestVariableLengthIntegerDecoders },
+        { "BufferedDataOutputStream", TestBufferedDataOutputStream },
+#ifdef CARTOTYPE_POSITIONAL_FILE_IO
+        { "ReadAhead", TestReadAhead },
+#endif
+#ifdef CARTOTYPE_DIRECT_FILE_IO
+        { "DirectFileReader", TestDirectFileReader },
+#endif
+        });
+    }
@@ -0,0 +1,127 @@
+/*
+style_cache_benchmark.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Benchmarks of StyleResolutionCache in cartotype_style_cache.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_style_cache.h>
+#include <random>
+#include <thread>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+const size_t KObjects = 50000;
+const uint32_t KConditions = 20;
+
+/** An object as seen by the style sheet: its layer, type and feature info. */
+class TestObject
+    {
+    public:
+    uint32_t Layer;
+    MapObjectType Type;
+    FeatureInfo Info;
+    };
+
+/**
+Returns KObjects objects like those drawn in a frame of a map: they are in 30 layers, each containing
+objects of a single type with up to 16 different feature infos.
+*/
+std::vector<TestObject> MakeObjects()
+    {
+    std::mt19937 random(1);
+    std::vector<TestObject> object(KObjects);
+    for (auto& o : object)
+        {
+        o.Layer = random() % 30;
+        o.Type = MapObjectType(o.Layer % 3);
+        o.Info = FeatureInfo::FromRawValue((o.Layer * 16 + random() % 16) * 0x101);
+        }
+    return object;
+    }
+
+/** Looks up the outcome of every condition for every object, inserting it if it is not found, and returns the number found. */
+size_t Resolve(StyleResolutionCache& aCache,const std::vector<TestObject>& aObject,size_t aBegin,size_t aEnd)
+    {
+    size_t found = 0;
+    for (size_t i = aBegin; i < aEnd; i++)
+        {
+        const auto& o = aObject[i];
+        for (uint32_t c = 0; c < KConditions; c++)
+            {
+            uint32_t outcome = 0;
+            if (aCache.Find(c,o.Layer,o.Type,o.Info,3,outcome))
+                found++;
+            else
+                aCache.Insert(c,o.Layer,o.Type,o.Info,3,c & 1);
+            }
+        }
+    return found;
+    }
+
+/**
+Measures the cost of resolving KConditions conditions for each of KObjects objects: in a frame after the style sheet
+has changed, when the cache has been invalidated and most lookups miss; in later frames, when they hit; and in
+later frames with the objects divided between the hardware threads, which contend for the cache's mutex.
+*/
+void BenchmarkResolve()
+    {
+    auto object = MakeObjects();
+    StyleResolutionCache cache;
+    Benchmark("first frame after invalidation, per lookup",KObjects * KConditions,[&]
+        {
+        cache.Invalidate();
+        Resolve(cache,object,0,object.size());
+        });
+    printf("    entries: %zu\n",cache.CacheStatistics().EntryCount);
+
+    size_t found = 0;
+    Benchmark("later frames, per lookup",KObjects * KConditions,[&]
+        {
+        found = Resolve(cache,object,0,object.size());
+        });
+    printf("    hit rate: %.4f\n",double(found) / double(KObjects * KConditions));
+
+    size_t thread_count = std::max(std::thread::hardware_concurrency(),2u);
+    std::string name = "later frames, " + std::to_string(thread_count) + " threads, per lookup";
+    Benchmark(name.c_str(),KObjects * KConditions,[&]
+        {
+        std::vector<std::thread> thread;
+        for (size_t t = 0; t < thread_count; t++)
+            thread.emplace_back([&,t] { Resolve(cache,object,object.size() * t / thread_count,object.size() * (t + 1) / thread_count); });
+        for (auto& t : thread)
+            t.join();
+        });
+    }
+
+/** Measures the cost of deciding whether a typical condition can be cached, which is done once for each condition in a style sheet. */
+void BenchmarkIsCacheable()
+    {
+    RpnExpression condition;
+    for (const char* name : { "@feature_type","@sub_type","_night","@layer" })
+        {
+        condition.Append(ExpressionOpType::Variable,String(name));
+        condition.Append(ExpressionOpType::Number);
+        }
+    auto is_variable = [](const MString& aName) { return aName == "_night"; };
+    bool cacheable = false;
+    Benchmark("IsCacheable, per condition",1,[&] { cacheable = StyleResolutionCache::IsCacheable(condition,is_variable); });
+    printf("    cacheable: %s\n",cacheable ? "yes" : "no");
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "Resolve", BenchmarkResolve },
+        { "IsCacheable", BenchmarkIsCacheable },
+        });
+    }
@@ -0,0 +1,152 @@
+/*
+style_cache_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of StyleResolutionCache in cartotype_style_cache.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_style_cache.h>
+#include <thread>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** Returns an expression testing the variables in aName, as compiled from a condition like 'aName[0] and aName[1] ...'. */
+RpnExpression Condition(std::initializer_list<const char*> aName)
+    {
+    RpnExpression e;
+    for (const char* name : aName)
+        {
+        e.Append(ExpressionOpType::Variable,String(name));
+        e.Append(ExpressionOpType::Number);
+        }
+    return e;
+    }
+
+void TestIsCacheable()
+    {
+    auto is_variable = [](const MString& aName) { return aName == "_night"; };
+    CT_CHECK(StyleResolutionCache::IsCacheable(Condition({ "@feature_type","@sub_type" }),is_variable));
+    CT_CHECK(StyleResolutionCache::IsCacheable(Condition({ "@","@layer","_night" }),is_variable));
+    CT_CHECK(StyleResolutionCache::IsCacheable(RpnExpression(),is_variable));
+    CT_CHECK(!StyleResolutionCache::IsCacheable(Condition({ "@feature_type","name" }),is_variable));
+    CT_CHECK(!StyleResolutionCache::IsCacheable(Condition({ "@name" }),is_variable));
+    CT_CHECK(!StyleResolutionCache::IsCacheable(Condition({ "" }),is_variable));
+    }
+
+/** Checks that each part of the key keeps outcomes apart. */
+void TestKey()
+    {
+    StyleResolutionCache cache;
+    const FeatureInfo road = FeatureInfo::FromRawValue(0x12345);
+    const FeatureInfo river = FeatureInfo::FromRawValue(0x54321);
+    uint32_t outcome = 0;
+    CT_CHECK(!cache.Find(1,2,MapObjectType::Line,road,3,outcome));
+    cache.Insert(1,2,MapObjectType::Line,road,3,100);
+    cache.Insert(9,2,MapObjectType::Line,road,3,101);
+    cache.Insert(1,9,MapObjectType::Line,road,3,102);
+    cache.Insert(1,2,MapObjectType::Polygon,road,3,103);
+    cache.Insert(1,2,MapObjectType::Line,river,3,104);
+    cache.Insert(1,2,MapObjectType::Line,road,9,105);
+    cache.Insert(2,1,MapObjectType::Line,road,3,106);
+    CT_CHECK(cache.Find(1,2,MapObjectType::Line,road,3,outcome) && outcome == 100);
+    CT_CHECK(cache.Find(9,2,MapObjectType::Line,road,3,outcome) && outcome == 101);
+    CT_CHECK(cache.Find(1,9,MapObjectType::Line,road,3,outcome) && outcome == 102);
+    CT_CHECK(cache.Find(1,2,MapObjectType::Polygon,road,3,outcome) && outcome == 103);
+    CT_CHECK(cache.Find(1,2,MapObjectType::Line,river,3,outcome) && outcome == 104);
+    CT_CHECK(cache.Find(1,2,MapObjectType::Line,road,9,outcome) && outcome == 105);
+    CT_CHECK(cache.Find(2,1,MapObjectType::Line,road,3,outcome) && outcome == 106);
+    CT_CHECK(!cache.Find(1,2,MapObjectType::Point,road,3,outcome));
+
+    // Inserting an existing key replaces the outcome.
+    cache.Insert(1,2,MapObjectType::Line,road,3,200);
+    CT_CHECK(cache.Find(1,2,MapObjectType::Line,road,3,outcome) && outcome == 200);
+
+    auto s = cache.CacheStatistics();
+    CT_CHECK(s.EntryCount == 7 && s.Hits == 8 && s.Misses == 2);
+    CT_CHECK(s.HitRate() == 0.8);
+    }
+
+/** Checks that Invalidate and SetScaleLimits remove all outcomes, and that a full cache is emptied. */
+void TestInvalidation()
+    {
+    StyleResolutionCache cache(4);
+    const FeatureInfo f = FeatureInfo::FromRawValue(7);
+    uint32_t outcome = 0;
+    for (uint32_t i = 0; i < 4; i++)
+        cache.Insert(i,0,MapObjectType::Point,f,0,i);
+    CT_CHECK(cache.CacheStatistics().EntryCount == 4);
+    cache.Insert(4,0,MapObjectType::Point,f,0,4);
+    CT_CHECK(cache.CacheStatistics().EntryCount == 1);
+    CT_CHECK(cache.Find(4,0,MapObjectType::Point,f,0,outcome) && outcome == 4);
+
+    cache.Invalidate();
+    CT_CHECK(!cache.Find(4,0,MapObjectType::Point,f,0,outcome));
+    CT_CHECK(cache.CacheStatistics().EntryCount == 0);
+    CT_CHECK(cache.CacheStatistics().Invalidations == 1);
+
+    cache.Insert(4,0,MapObjectType::Point,f,0,4);
+    cache.SetScaleLimits({ 50000,10000,50000,1000000 });
+    CT_CHECK(!cache.Find(4,0,MapObjectType::Point,f,0,outcome));
+    CT_CHECK(cache.CacheStatistics().Invalidations == 2);
+
+    // The limits are sorted and duplicates removed.
+    CT_CHECK(cache.ScaleBand(5000) == 0);
+    CT_CHECK(cache.ScaleBand(10000) == 1);
+    CT_CHECK(cache.ScaleBand(20000) == 1);
+    CT_CHECK(cache.ScaleBand(50000) == 2);
+    CT_CHECK(cache.ScaleBand(2000000) == 3);
+    }
+
+/** Checks that the cache can be used from several threads, and that every outcome found is the one inserted. */
+void TestThreads()
+    {
+    StyleResolutionCache cache(1000);
+    std::vector<std::thread> thread;
+    std::atomic<int> failures { 0 };
+    for (uint32_t t = 0; t < 4; t++)
+        thread.emplace_back([&cache,&failures,t]
+            {
+            for (uint32_t i = 0; i < 20000; i++)
+                {
+                uint32_t condition = (i * 7 + t) % 50;
+                uint32_t layer = i % 13;
+                FeatureInfo f = FeatureInfo::FromRawValue(i % 31);
+                uint32_t expected = condition * 10000 + layer * 100 + i % 31;
+                uint32_t outcome = 0;
+                if (cache.Find(condition,layer,MapObjectType::Line,f,1,outcome))
+                    {
+                    if (outcome != expected)
+                        failures++;
+                    }
+                else
+                    cache.Insert(condition,layer,MapObjectType::Line,f,1,expected);
+                if (i % 5000 == 4999)
+                    cache.Invalidate();
+                }
+            });
+    for (auto& t : thread)
+        t.join();
+    CT_CHECK(failures == 0);
+    auto s = cache.CacheStatistics();
+    CT_CHECK(s.Hits + s.Misses == 80000);
+    CT_CHECK(s.Invalidations == 16);
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "IsCacheable", TestIsCacheable },
+        { "Key", TestKey },
+        { "Invalidation", TestInvalidation },
+        { "Threads", TestThreads },
+        });
+    }
@@ -0,0 +1,267 @@
+/*
+text_cache_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of LruCache, TextRunKey and GlyphAtlas in cartotype_text_cache.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_text_cache.h>
+#include <thread>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+void TestLruCache()
+    {
+    LruCache<int,std::string> cache(100);
+    CT_CHECK(cache.Find(1) == nullptr);
+    cache.Insert(1,std::make_shared<std::string>("one"),40);
+    cache.Insert(2,std::make_shared<std::string>("two"),40);
+    CT_CHECK(*cache.Find(1) == "one");   // 1 is now the most recently used
+
+    // Inserting 3 exceeds the limit, so the least recently used entry, 2, is evicted.
+    auto three = std::make_shared<std::string>("three");
+    cache.Insert(3,three,40);
+    CT_CHECK(cache.Find(2) == nullptr);
+    CT_CHECK(*cache.Find(1) == "one");
+    CT_CHECK(*cache.Find(3) == "three");
+    auto s = cache.Statistics();
+    CT_CHECK(s.Hits == 3 && s.Misses == 2 && s.Evictions == 1);
+    CT_CHECK(s.EntryCount == 2 && s.Bytes == 80);
+
+    // Replacing an entry updates its size and does not count as an eviction.
+    cache.Insert(3,std::make_shared<std::string>("THREE"),10);
+    CT_CHECK(*cache.Find(3) == "THREE");
+    CT_CHECK(cache.Statistics().Bytes == 50);
+    CT_CHECK(cache.Statistics().Evictions == 1);
+
+    // An entry larger than the limit is kept if it is the only one.
+    cache.Insert(4,std::make_shared<std::string>("four"),1000);
+    CT_CHECK(*cache.Find(4) == "four");
+    CT_CHECK(cache.Statistics().EntryCount == 1);
+
+    // Evicted values remain usable by their holders.
+    CT_CHECK(*three == "three");
+
+    cache.SetMaxBytes(10);
+    CT_CHECK(cache.Statistics().EntryCount == 1);
+    cache.Clear();
+    CT_CHECK(cache.Find(4) == nullptr);
+    s = cache.Statistics();
+    CT_CHECK(s.EntryCount == 0 && s.Bytes == 0);
+    cache.ResetStatistics();
+    s = cache.Statistics();
+    CT_CHECK(s.Hits == 0 && s.Misses == 0 && s.Evictions == 0);
+    CT_CHECK(s.HitRate() == 0);
+    }
+
+void TestTextRunKey()
+    {
+    String text;
+    const uint16_t text_data[] = { 'M','a','i','n',' ','S','t' };
+    text.Set(text_data,7);
+    FontSpec font_spec;
+    const uint16_t name[] = { 'S','a','n','s' };
+    font_spec.Attrib.Name.Set(name,4);
+    font_spec.Instance.Size = 14;
+    TextParam param;
+
+    TextRunKey key(text,font_spec,param);
+    CT_CHECK(key.Text == u"Main St");
+    CT_CHECK(key.Typeface == u"Sans");
+    CT_CHECK(key.Size == 14);
+    CT_CHECK(key.Transform[0] == 1 && key.Transform[3] == 1);
+    TextRunKey same(text,font_spec,param);
+    CT_CHECK(key == same);
+    CT_CHECK(key.Hash() == same.Hash());
+
+    // The color does not affect shaping, so it is not part of the key.
+    FontSpec red_font_spec = font_spec;
+    red_font_spec.Color = CartoTypeCore::Color(0xFF0000FF);
+    TextRunKey red(text,red_font_spec,param);
+    CT_CHECK(red == key);
+    CT_CHECK(red.Hash() == key.Hash());
+
+    // Each part of the key distinguishes keys.
+    std::vector<TextRunKey> different(9,key);
+    different[0].Text = u"Main Rd";
+    different[1].Typeface = u"Serif";
+    different[2].Style = 1;
+    different[3].Flags = 0;
+    different[4].Scripts = 1;
+    different[5].Size = 15;
+    different[6].Transform[1] = 0.2;
+    different[7].LetterSpacing = 1;
+    different[8].Baseline = TextBaseline::Hanging;
+    for (const auto& d : different)
+        CT_CHECK(d != key);
+
+    LruCache<TextRunKey,int,TextRunKeyHash> cache(1000);
+    cache.Insert(key,std::make_shared<int>(1),10);
+    for (size_t i = 0; i < different.size(); i++)
+        cache.Insert(different[i],std::make_shared<int>(int(i) + 2),10);
+    CT_CHECK(*cache.Find(same) == 1 && *cache.Find(red) == 1);
+    for (size_t i = 0; i < different.size(); i++)
+        CT_CHECK(*cache.Find(different[i]) == int(i) + 2);
+    }
+
+/** An A8 glyph image whose pixels are all aValue. */
+class TestGlyph
+    {
+    public:
+    TestGlyph(int32_t aWidth,int32_t aHeight,uint8_t aValue):
+        Data(size_t(aWidth) * aHeight + 1,aValue),
+        View(BitmapType::A8,Data.data(),uint32_t(aWidth),uint32_t(aHeight),uint32_t(aWidth))
+        {
+        }
+
+    std::vector<uint8_t> Data;
+    BitmapView View;
+    };
+
+bool HasValue(const GlyphAtlas<int>::Entry& aEntry,int32_t aWidth,int32_t aHeight,uint8_t aValue)
+    {
+    BitmapView view = aEntry.View();
+    if (view.Width() != aWidth || view.Height() != aHeight)
+        return false;
+    for (int32_t y = 0; y < aHeight; y++)
+        for (int32_t x = 0; x < aWidth; x++)
+            if (view.Data()[size_t(y) * view.RowBytes() + size_t(x)] != aValue)
+                return false;
+    return true;
+    }
+
+void TestGlyphAtlas()
+    {
+    GlyphAtlas<int> atlas(64,2);
+    GlyphAtlas<int>::Entry entry;
+    CT_CHECK(!atlas.Find(1,entry));
+
+    std::vector<GlyphAtlas<int>::Entry> entry_array;
+    // A page holds 20 glyphs of this size, in four shelves of five, so these use two pages.
+    for (int i = 0; i < 30; i++)
+        {
+        TestGlyph glyph(10,12,uint8_t(i + 1));
+        CT_CHECK(atlas.Insert(i,glyph.View,entry));
+        CT_CHECK(HasValue(entry,10,12,uint8_t(i + 1)));
+        entry_array.push_back(entry);
+        }
+    // Glyphs do not overlap and are separated by a gap, so each still has its own value.
+    CT_CHECK(entry_array[0].Page != entry_array[29].Page);
+    for (int i = 0; i < 30; i++)
+        {
+        CT_CHECK(atlas.Find(i,entry));
+        CT_CHECK(entry.Bounds == entry_array[size_t(i)].Bounds);
+        CT_CHECK(HasValue(entry,10,12,uint8_t(i + 1)));
+        }
+    for (size_t i = 0; i < entry_array.size(); i++)
+        for (size_t j = i + 1; j < entry_array.size(); j++)
+            if (entry_array[i].Page == entry_array[j].Page)
+                {
+                Rect a = entry_array[i].Bounds;
+                Rect b = entry_array[j].Bounds;
+                CT_CHECK(a.MaxX() < b.MinX() || b.MaxX() < a.MinX() || a.MaxY() < b.MinY() || b.MaxY() < a.MinY());
+                }
+
+    // Inserting an existing key returns the existing entry.
+    TestGlyph other(10,12,99);
+    CT_CHECK(atlas.Insert(3,other.View,entry));
+    CT_CHECK(HasValue(entry,10,12,4));
+
+    auto s = atlas.Statistics();
+    CT_CHECK(s.EntryCount == 30 && s.Evictions == 0);
+    CT_CHECK(s.Bytes == 2 * 64 * 64);
+    }
+
+/** Checks that glyphs too large for a page, or not A8, are rejected without changing the atlas. */
+void TestGlyphAtlasLimits()
+    {
+    GlyphAtlas<int> atlas(64,1);
+    GlyphAtlas<int>::Entry entry;
+    TestGlyph full_width(64,10,1);
+    TestGlyph full_height(10,64,1);
+    CT_CHECK(!atlas.Insert(1,full_width.View,entry));
+    CT_CHECK(!atlas.Insert(2,full_height.View,entry));
+    CT_CHECK(atlas.Statistics().Bytes == 0);
+
+    uint32_t rgba[4] = { };
+    BitmapView color_glyph(BitmapType::RGBA32,(uint8_t*)rgba,2,2,8);
+    CT_CHECK(!atlas.Insert(3,color_glyph,entry));
+
+    // The largest glyph that fits, with its gap, fills a page.
+    TestGlyph largest(63,63,7);
+    CT_CHECK(atlas.Insert(4,largest.View,entry));
+    CT_CHECK(HasValue(entry,63,63,7));
+    CT_CHECK(atlas.Statistics().EntryCount == 1);
+    }
+
+/** Checks that when the pages are full the least recently used page is reused, and that entries in it remain valid. */
+void TestGlyphAtlasEviction()
+    {
+    GlyphAtlas<int> atlas(32,2);
+    GlyphAtlas<int>::Entry entry;
+    TestGlyph glyph_a(31,31,1);
+    TestGlyph glyph_b(31,31,2);
+    TestGlyph glyph_c(31,31,3);
+    CT_CHECK(atlas.Insert(1,glyph_a.View,entry));
+    GlyphAtlas<int>::Entry held = entry;
+    CT_CHECK(atlas.Insert(2,glyph_b.View,entry));
+
+    // Use glyph 1 so that page 2 is the least recently used.
+    CT_CHECK(atlas.Find(1,entry));
+    CT_CHECK(atlas.Insert(3,glyph_c.View,entry));
+    CT_CHECK(atlas.Find(1,entry));
+    CT_CHECK(!atlas.Find(2,entry));
+    CT_CHECK(atlas.Find(3,entry));
+    CT_CHECK(HasValue(entry,31,31,3));
+    CT_CHECK(atlas.Statistics().Evictions == 1);
+
+    // Now page 1 is the least recently used; reusing it makes a new bitmap, so the held entry is unchanged.
+    CT_CHECK(atlas.Insert(2,glyph_b.View,entry));
+    CT_CHECK(!atlas.Find(1,entry));
+    CT_CHECK(HasValue(held,31,31,1));
+    }
+
+void TestGlyphAtlasThreads()
+    {
+    GlyphAtlas<int> atlas(128,2);
+    std::vector<std::thread> thread;
+    std::atomic<int> failures { 0 };
+    for (int t = 0; t < 4; t++)
+        thread.emplace_back([&atlas,&failures,t]
+            {
+            GlyphAtlas<int>::Entry entry;
+            for (int i = 0; i < 2000; i++)
+                {
+                int key = (i * 7 + t) % 300;
+                TestGlyph glyph(8 + key % 9,9 + key % 5,uint8_t(key));
+                if (!atlas.Find(key,entry) && !atlas.Insert(key,glyph.View,entry))
+                    failures++;
+                else if (!HasValue(entry,8 + key % 9,9 + key % 5,uint8_t(key)))
+                    failures++;
+                }
+            });
+    for (auto& t : thread)
+        t.join();
+    CT_CHECK(failures == 0);
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "LruCache", TestLruCache },
+        { "TextRunKey", TestTextRunKey },
+        { "GlyphAtlas", TestGlyphAtlas },
+        { "GlyphAtlasLimits", TestGlyphAtlasLimits },
+        { "GlyphAtlasEviction", TestGlyphAtlasEviction },
+        { "GlyphAtlasThreads", TestGlyphAtlasThreads },
+        });
+    }
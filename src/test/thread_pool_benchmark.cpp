@@ -0,0 +1,87 @@
+/*
+thread_pool_benchmark.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Benchmarks of ThreadPool in cartotype_thread_pool.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_thread_pool.h>
+#include <cmath>
+#include <random>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** Does an amount of arithmetic proportional to aUnits and returns a value depending on it, so that it is not optimized away. */
+double Work(size_t aUnits)
+    {
+    double x = 1;
+    for (size_t i = 0; i < aUnits * 1000; i++)
+        x = std::sqrt(x + double(i));
+    return x;
+    }
+
+/** Measures the time taken to submit a task which does nothing and wait for it, divided between the tasks of a batch. */
+void BenchmarkTaskOverhead()
+    {
+    ThreadPool pool;
+    for (size_t batch : { 1, 64, 4096 })
+        {
+        std::string name = "empty tasks in batches of " + std::to_string(batch) + ", per task";
+        Benchmark(name.c_str(),batch,[&]
+            {
+            for (size_t i = 0; i < batch; i++)
+                pool.Submit([](size_t) { });
+            pool.Wait();
+            });
+        }
+    }
+
+/**
+Compares the time taken to run tasks of uneven size, like tiles some of which have much more detail than others,
+on the calling thread and on pools of increasing size. The slow tasks are grouped together, so that without
+work stealing the queues holding them would finish long after the others.
+*/
+void BenchmarkUnevenTasks()
+    {
+    const size_t count = 256;
+    std::vector<size_t> units(count);
+    std::mt19937 random(1);
+    for (size_t i = 0; i < count; i++)
+        units[i] = i % 16 < 2 ? 20 + random() % 20 : 1 + random() % 3;
+    std::vector<double> result(count);
+
+    Benchmark("uneven tasks on calling thread, per task",count,[&]
+        {
+        for (size_t i = 0; i < count; i++)
+            result[i] = Work(units[i]);
+        });
+    size_t max_threads = std::max(std::thread::hardware_concurrency(),1U);
+    for (size_t threads = 2; threads <= max_threads; threads *= 2)
+        {
+        ThreadPool pool(threads);
+        std::string name = "uneven tasks on " + std::to_string(threads) + " threads, per task";
+        Benchmark(name.c_str(),count,[&]
+            {
+            for (size_t i = 0; i < count; i++)
+                pool.Submit([&,i](size_t) { result[i] = Work(units[i]); });
+            pool.Wait();
+            });
+        }
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "TaskOverhead", BenchmarkTaskOverhead },
+        { "UnevenTasks", BenchmarkUnevenTasks },
+        });
+    }
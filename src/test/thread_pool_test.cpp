@@ -0,0 +1,180 @@
+/*
+thread_pool_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of ThreadPool and TaskGroup in cartotype_thread_pool.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_thread_pool.h>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+void TestRunTasks()
+    {
+    ThreadPool pool(4);
+    CT_CHECK(pool.ThreadCount() == 4);
+    CT_CHECK(!pool.IsWorkerThread() && pool.WorkerIndex() == pool.ThreadCount());
+    const size_t count = 10000;
+    std::vector<std::atomic<int>> run(count);
+    std::atomic<bool> bad_worker { false };
+    for (size_t i = 0; i < count; i++)
+        pool.Submit([&,i](size_t aWorker)
+            {
+            if (aWorker >= 4)
+                bad_worker = true;
+            run[i]++;
+            });
+    pool.Wait();
+    CT_CHECK(!bad_worker);
+    for (const auto& r : run)
+        CT_CHECK(r == 1);
+
+    // The pool can be used again after Wait.
+    std::atomic<size_t> total { 0 };
+    for (size_t i = 0; i < 100; i++)
+        pool.Submit([&](size_t) { total++; });
+    pool.Wait();
+    CT_CHECK(total == 100);
+    }
+
+void TestExceptions()
+    {
+    ThreadPool pool(3);
+    std::atomic<size_t> finished { 0 };
+    for (size_t i = 0; i < 100; i++)
+        pool.Submit([&,i](size_t)
+            {
+            if (i == 50)
+                throw KErrorCorrupt;
+            finished++;
+            });
+    Result error;
+    try
+        {
+        pool.Wait();
+        }
+    catch (Result e)
+        {
+        error = e;
+        }
+    CT_CHECK(error == KErrorCorrupt);
+    CT_CHECK(finished == 99);
+
+    // The exception is thrown only once.
+    pool.Submit([](size_t) { });
+    pool.Wait();
+
+    // Other exception types are passed on unchanged.
+    pool.Submit([](size_t) { throw std::bad_alloc(); });
+    bool bad_alloc = false;
+    try
+        {
+        pool.Wait();
+        }
+    catch (const std::bad_alloc&)
+        {
+        bad_alloc = true;
+        }
+    CT_CHECK(bad_alloc);
+
+    // An exception not waited for is discarded by the destructor.
+    pool.Submit([](size_t) { throw KErrorGeneral; });
+    }
+
+void TestInvalidUse()
+    {
+    ThreadPool pool(2);
+    Result error;
+    try
+        {
+        pool.Submit(ThreadPool::Task());
+        }
+    catch (Result e)
+        {
+        error = e;
+        }
+    CT_CHECK(error == KErrorInvalidArgument);
+
+    // Waiting from a worker of the same pool would never finish, so it throws.
+    std::atomic<bool> is_worker { false };
+    pool.Submit([&](size_t aWorker)
+        {
+        is_worker = pool.IsWorkerThread() && pool.WorkerIndex() == aWorker;
+        pool.Wait();
+        });
+    error = KErrorNone;
+    try
+        {
+        pool.Wait();
+        }
+    catch (Result e)
+        {
+        error = e;
+        }
+    CT_CHECK(is_worker);
+    CT_CHECK(error == KErrorGeneral);
+    }
+
+void TestTaskGroups()
+    {
+    ThreadPool pool(2);
+
+    // A slow task in one group does not delay waiting for another group.
+    std::mutex mutex;
+    std::condition_variable released;
+    bool release = false;
+    TaskGroup slow_group(pool);
+    slow_group.Submit([&](size_t)
+        {
+        std::unique_lock<std::mutex> lock(mutex);
+        released.wait(lock,[&] { return release; });
+        });
+
+    std::atomic<size_t> total { 0 };
+    TaskGroup group(pool);
+    for (size_t i = 0; i < 1000; i++)
+        group.Submit([&](size_t) { total++; });
+    group.Wait();
+    CT_CHECK(total == 1000);
+
+    // Exceptions are thrown by the Wait function of the group they occurred in.
+    group.Submit([](size_t) { throw KErrorNoMemory; });
+    pool.Submit([](size_t) { });
+    pool.Wait();
+    Result error;
+    try
+        {
+        group.Wait();
+        }
+    catch (Result e)
+        {
+        error = e;
+        }
+    CT_CHECK(error == KErrorNoMemory);
+
+        {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+        }
+    released.notify_all();
+    slow_group.Wait();
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "RunTasks", TestRunTasks },
+        { "Exceptions", TestExceptions },
+        { "InvalidUse", TestInvalidUse },
+        { "TaskGroups", TestTaskGroups },
+        });
+    }
@@ -0,0 +1,220 @@
+/*
+tile_cache_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of DiskTileCache in cartotype_tile_cache.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_tile_cache.h>
+#include <fstream>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** A temporary directory, deleted with its contents by the destructor. */
+class TestDirectory
+    {
+    public:
+    TestDirectory()
+        {
+        Name = (std::filesystem::temp_directory_path() / "cartotype_tile_cache_test").string();
+        std::error_code ec;
+        std::filesystem::remove_all(Name,ec);
+        }
+    ~TestDirectory()
+        {
+        std::error_code ec;
+        std::filesystem::remove_all(Name,ec);
+        }
+
+    std::string Name;
+    };
+
+Bitmap TestTile(BitmapType aType,int32_t aSize,uint8_t aSeed)
+    {
+    std::shared_ptr<Palette> palette;
+    if (aType == BitmapType::P8)
+        palette = std::make_shared<Palette>(std::vector<Color> { Color(0xFF0000FF), Color(0xFF00FF00), Color(0xFFFF0000) });
+    Bitmap bitmap(aType,aSize,aSize,0,palette);
+    size_t row_bytes = (size_t(aSize) * bitmap.BitsPerPixel() + 7) / 8;
+    for (int32_t y = 0; y < aSize; y++)
+        for (size_t x = 0; x < row_bytes; x++)
+            bitmap.Data()[size_t(y) * bitmap.RowBytes() + x] = uint8_t(aSeed + y * 31 + x);
+    return bitmap;
+    }
+
+bool SamePixels(const BitmapView& aA,const BitmapView& aB)
+    {
+    if (aA.Type() != aB.Type() || aA.Width() != aB.Width() || aA.Height() != aB.Height())
+        return false;
+    size_t row_bytes = (size_t(aA.Width()) * aA.BitsPerPixel() + 7) / 8;
+    for (int32_t y = 0; y < aA.Height(); y++)
+        if (memcmp(aA.Data() + size_t(y) * aA.RowBytes(),aB.Data() + size_t(y) * aB.RowBytes(),row_bytes))
+            return false;
+    return true;
+    }
+
+void TestInsertAndFind()
+    {
+    TestDirectory directory;
+    Result error;
+    auto cache = DiskTileCache::New(error,directory.Name);
+    CT_CHECK(!error && cache);
+
+    // Nothing is stored or found until the generation is set.
+    Bitmap tile = TestTile(BitmapType::RGBA32,256,1);
+    CT_CHECK(cache->Insert("0123",256,tile) == KErrorNotFound);
+    cache->SetGeneration(1,2);
+    CT_CHECK(cache->GenerationValid());
+    cache->Find(error,"0123",256);
+    CT_CHECK(error == KErrorNotFound);
+
+    for (BitmapType type : { BitmapType::RGBA32, BitmapType::RGB24, BitmapType::A8, BitmapType::A1, BitmapType::P8 })
+        {
+        std::string quad_key = "0123" + std::to_string(int(type));
+        tile = TestTile(type,100,uint8_t(type));
+        CT_CHECK(cache->Insert(quad_key,100,tile) == KErrorNone);
+        Bitmap found = cache->Find(error,quad_key,100);
+        CT_CHECK(!error && SamePixels(found,tile));
+        CT_CHECK((found.Palette() != nullptr) == (type == BitmapType::P8));
+        if (found.Palette())
+            CT_CHECK(found.Palette()->ColorCount() == 3 && found.Palette()->Color()[2].Value == 0xFFFF0000);
+        }
+
+    // The empty quadkey of zoom level 0 is allowed, and tiles of different sizes are different.
+    tile = TestTile(BitmapType::RGBA32,256,2);
+    CT_CHECK(cache->Insert("",256,tile) == KErrorNone);
+    CT_CHECK(SamePixels(cache->Find(error,"",256),tile));
+    cache->Find(error,"",512);
+    CT_CHECK(error == KErrorNotFound);
+
+    // No temporary files are left behind.
+    for (auto& entry : std::filesystem::recursive_directory_iterator(directory.Name))
+        CT_CHECK(entry.path().extension() != ".tmp");
+    }
+
+void TestGenerations()
+    {
+    TestDirectory directory;
+    Result error;
+    auto cache = DiskTileCache::New(error,directory.Name);
+    Bitmap tile = TestTile(BitmapType::RGBA32,64,3);
+    cache->SetGeneration(1,2);
+    CT_CHECK(cache->Insert("3",64,tile) == KErrorNone);
+
+    // A style change makes the generation invalid.
+    cache->OnStyleChange();
+    CT_CHECK(!cache->GenerationValid());
+    cache->Find(error,"3",64);
+    CT_CHECK(error == KErrorNotFound);
+
+    // Tiles from another generation are not found, and can be deleted.
+    cache->SetGeneration(1,3);
+    cache->Find(error,"3",64);
+    CT_CHECK(error == KErrorNotFound);
+    cache->SetGeneration(1,2);
+    CT_CHECK(SamePixels(cache->Find(error,"3",64),tile));
+    cache->SetGeneration(1,3,true);
+    cache->SetGeneration(1,2);
+    cache->Find(error,"3",64);
+    CT_CHECK(error == KErrorNotFound);
+
+    // The hash of a map file changes when the file is rebuilt, even with the same name and metadata.
+    std::string map_name = directory.Name + "/map.ctm1";
+        {
+        std::ofstream map(map_name);
+        map << "version 1";
+        }
+    uint64_t hash1 = DiskTileCache::HashFile(DiskTileCache::KHashStart,map_name);
+        {
+        std::ofstream map(map_name);
+        map << "version 1.1";
+        }
+    uint64_t hash2 = DiskTileCache::HashFile(DiskTileCache::KHashStart,map_name);
+    CT_CHECK(hash1 != hash2);
+    CT_CHECK(hash2 == DiskTileCache::HashFile(DiskTileCache::KHashStart,map_name));
+    }
+
+/** Checks that the style hash changes when any of the style sheets, the style sheet variables or the blend style change. */
+void TestStyleHash()
+    {
+    const char* text1 = "<CartoTypeStyleSheet><layer name='road'/></CartoTypeStyleSheet>";
+    const char* text2 = "<CartoTypeStyleSheet><layer name='river'/></CartoTypeStyleSheet>";
+    StyleSheetDataArray style_sheets { StyleSheetData((const uint8_t*)text1,strlen(text1)) };
+    VariableDictionary variables;
+    BlendStyleSet blend_style;
+    uint64_t hash = DiskTileCache::StyleHash(style_sheets,variables,nullptr);
+    CT_CHECK(hash == DiskTileCache::StyleHash(style_sheets,variables,nullptr));
+    CT_CHECK(hash == DiskTileCache::StyleHash(style_sheets,variables,&blend_style));
+
+    std::vector<uint64_t> different;
+    StyleSheetDataArray other_style_sheets { StyleSheetData((const uint8_t*)text2,strlen(text2)) };
+    different.push_back(DiskTileCache::StyleHash(other_style_sheets,variables,nullptr));
+    other_style_sheets.insert(other_style_sheets.begin(),style_sheets[0]);
+    different.push_back(DiskTileCache::StyleHash(other_style_sheets,variables,nullptr));
+    variables.Set(String("_night"),String("1"));
+    different.push_back(DiskTileCache::StyleHash(style_sheets,variables,nullptr));
+    variables.Set(String("_night"),String("2"));
+    different.push_back(DiskTileCache::StyleHash(style_sheets,variables,nullptr));
+    variables.Set(String("_night"),String());
+    CT_CHECK(DiskTileCache::StyleHash(style_sheets,variables,nullptr) == hash);
+    blend_style.emplace_back();
+    blend_style[0].Styles = String("*");
+    blend_style[0].MainColor = Color(0x80000000);
+    different.push_back(DiskTileCache::StyleHash(style_sheets,variables,&blend_style));
+    blend_style[0].TextColor = Color(0x80FFFFFF);
+    different.push_back(DiskTileCache::StyleHash(style_sheets,variables,&blend_style));
+    blend_style[0].Styles = String("road*");
+    different.push_back(DiskTileCache::StyleHash(style_sheets,variables,&blend_style));
+
+    different.push_back(hash);
+    std::sort(different.begin(),different.end());
+    CT_CHECK(std::unique(different.begin(),different.end()) == different.end());
+    }
+
+void TestCorruptFiles()
+    {
+    TestDirectory directory;
+    Result error;
+    auto cache = DiskTileCache::New(error,directory.Name);
+    cache->SetGeneration(5,6);
+    Bitmap tile = TestTile(BitmapType::RGBA32,64,4);
+    CT_CHECK(cache->Insert("21",64,tile) == KErrorNone);
+    std::filesystem::path path;
+    for (auto& entry : std::filesystem::recursive_directory_iterator(directory.Name))
+        if (entry.path().extension() == ".ctt")
+            path = entry.path();
+    CT_CHECK(!path.empty());
+
+    // A truncated file is reported as corrupt.
+    std::filesystem::resize_file(path,std::filesystem::file_size(path) - 1);
+    cache->Find(error,"21",64);
+    CT_CHECK(error == KErrorCorrupt);
+
+    // So is a file with an implausible size.
+        {
+        std::ofstream file(path,std::ios::binary);
+        const char header[] = { 'C','T','T','C',0,0,0,2, 32 | 64,0,0,0, 0,0,0,1, 0,0,0,1, 0,0,0,0 };
+        file.write(header,sizeof(header));
+        }
+    cache->Find(error,"21",64);
+    CT_CHECK(error == KErrorCorrupt);
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "InsertAndFind", TestInsertAndFind },
+        { "Generations", TestGenerations },
+        { "StyleHash", TestStyleHash },
+        { "CorruptFiles", TestCorruptFiles },
+        });
+    }
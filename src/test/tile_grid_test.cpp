@@ -0,0 +1,246 @@
+/*
+tile_grid_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests of RasterTileGrid in cartotype_tile_grid.h.
+*/
+
+#include "cartotype_test.h"
+#include <cartotype_tile_grid.h>
+#include <random>
+#include <thread>
+
+using namespace CartoTypeCore;
+using namespace CartoTypeTest;
+
+namespace
+{
+
+/** A rectangle of translucent premultiplied color, standing for an item in a draw list. */
+class TestItem
+    {
+    public:
+    Rect Bounds;
+    uint32_t Color = 0;
+    };
+
+std::vector<TestItem> MakeItems(size_t aCount,int32_t aWidth,int32_t aHeight)
+    {
+    std::mt19937 random(1);
+    std::vector<TestItem> item(aCount);
+    for (auto& i : item)
+        {
+        int32_t x = int32_t(random() % uint32_t(aWidth + 100)) - 50;
+        int32_t y = int32_t(random() % uint32_t(aHeight + 100)) - 50;
+        int32_t w = int32_t(random() % 300);
+        int32_t h = int32_t(random() % 300);
+        i.Bounds = Rect(x,y,x + w,y + h);
+        uint32_t alpha = 64 + random() % 192;
+        uint32_t r = random() % (alpha + 1);
+        uint32_t g = random() % (alpha + 1);
+        uint32_t b = random() % (alpha + 1);
+        i.Color = r | g << 8 | b << 16 | alpha << 24;
+        }
+    return item;
+    }
+
+/**
+Blends aItem over the part of aBitmap, an RGBA32 bitmap whose top left corner is at aOrigin, that it covers.
+The result depends on the order in which items are drawn.
+*/
+void DrawItem(BitmapView& aBitmap,Point aOrigin,const TestItem& aItem)
+    {
+    int32_t min_x = std::max(aItem.Bounds.MinX() - aOrigin.X,0);
+    int32_t min_y = std::max(aItem.Bounds.MinY() - aOrigin.Y,0);
+    int32_t max_x = std::min(aItem.Bounds.MaxX() - aOrigin.X,aBitmap.Width());
+    int32_t max_y = std::min(aItem.Bounds.MaxY() - aOrigin.Y,aBitmap.Height());
+    uint32_t inverse_alpha = 255 - (aItem.Color >> 24);
+    for (int32_t y = min_y; y < max_y; y++)
+        {
+        uint32_t* p = (uint32_t*)(aBitmap.Data() + size_t(y) * aBitmap.RowBytes());
+        for (int32_t x = min_x; x < max_x; x++)
+            {
+            uint32_t result = 0;
+            for (int shift = 0; shift < 32; shift += 8)
+                {
+                uint32_t dest = (p[x] >> shift) & 0xFF;
+                uint32_t source = (aItem.Color >> shift) & 0xFF;
+                result |= (source + (dest * inverse_alpha + 127) / 255) << shift;
+                }
+            p[x] = result;
+            }
+        }
+    }
+
+void TestBin()
+    {
+    RasterTileGrid grid(1000,700,128);
+    CT_CHECK(grid.TileCount() == 8 * 6);
+    CT_CHECK(grid.TileBounds(0) == Rect(0,0,128,128));
+    CT_CHECK(grid.TileBounds(7) == Rect(896,0,1000,128));
+    CT_CHECK(grid.TileBounds(47) == Rect(896,640,1000,700));
+
+    grid.Bin(1,Rect(100,100,300,140));      // columns 0...2, rows 0...1
+    grid.Bin(2,Rect(127,127,129,129));      // the corners of four tiles
+    grid.Bin(3,Rect(-50,-50,0,10));         // wholly outside the grid
+    grid.Bin(4,Rect(990,690,2000,2000));    // overlaps the last tile
+    grid.Bin(5,Rect(10,10,10,20));          // empty
+    grid.Bin(6,Rect(1000,0,1100,100));      // just outside the right edge
+    grid.Bin(7,Rect(-100,-100,2000,2000));  // covers everything
+
+    for (size_t i = 0; i < grid.TileCount(); i++)
+        {
+        size_t column = i % 8;
+        size_t row = i / 8;
+        std::vector<uint32_t> expected;
+        if (column <= 2 && row <= 1)
+            expected.push_back(1);
+        if (column <= 1 && row <= 1)
+            expected.push_back(2);
+        if (i == 47)
+            expected.push_back(4);
+        expected.push_back(7);
+        CT_CHECK(grid.Items(i) == expected);
+        }
+
+    grid.Clear();
+    for (size_t i = 0; i < grid.TileCount(); i++)
+        CT_CHECK(grid.Items(i).empty());
+    }
+
+/**
+Checks that drawing overlapping translucent items through the grid gives exactly the same pixels as drawing them
+directly into the whole bitmap, with and without a thread pool, and from a task running on the pool.
+*/
+void TestDraw()
+    {
+    const int32_t width = 1000;
+    const int32_t height = 700;
+    auto item = MakeItems(500,width,height);
+
+    std::vector<uint32_t> expected(size_t(width) * height,0xFF808080);
+    BitmapView expected_bitmap(BitmapType::RGBA32,(uint8_t*)expected.data(),width,height,width * 4);
+    for (const auto& i : item)
+        DrawItem(expected_bitmap,Point(0,0),i);
+
+    ThreadPool pool(3);
+    for (int32_t tile_size : { 1000, 128, 100, 37 })
+        {
+        RasterTileGrid grid(width,height,tile_size);
+        for (size_t i = 0; i < item.size(); i++)
+            grid.Bin(uint32_t(i),item[i].Bounds);
+
+        std::vector<uint32_t> pixel;
+        BitmapView bitmap(BitmapType::RGBA32,nullptr,0,0,0);
+        auto reset = [&]()
+            {
+            pixel.assign(expected.size(),0xFF808080);
+            bitmap = BitmapView(BitmapType::RGBA32,(uint8_t*)pixel.data(),width,height,width * 4);
+            };
+        auto draw = [&](size_t aWorker,BitmapView& aTile,const Rect& aTileBounds,const std::vector<uint32_t>& aItems)
+            {
+            CT_CHECK(aWorker <= pool.ThreadCount());
+            CT_CHECK(aTile.Width() == aTileBounds.Width() && aTile.Height() == aTileBounds.Height());
+            for (uint32_t i : aItems)
+                DrawItem(aTile,aTileBounds.Min,item[i]);
+            };
+
+        reset();
+        grid.Draw(nullptr,bitmap,draw);
+        CT_CHECK(pixel == expected);
+
+        reset();
+        grid.Draw(&pool,bitmap,draw);
+        CT_CHECK(pixel == expected);
+
+        reset();
+        TaskGroup group(pool);
+        group.Submit([&](size_t) { grid.Draw(&pool,bitmap,draw); });
+        group.Wait();
+        CT_CHECK(pixel == expected);
+        }
+    }
+
+/**
+Checks that the worker indexes passed to the draw function are in range and are not used by two tiles at once,
+including when several tasks on the pool draw at the same time, each drawing its tiles on its own thread.
+*/
+void TestWorkerIndex()
+    {
+    RasterTileGrid grid(400,400,50);
+    grid.Bin(0,Rect(0,0,400,400));
+    std::vector<uint32_t> pixel(400 * 400);
+    BitmapView bitmap(BitmapType::RGBA32,(uint8_t*)pixel.data(),400,400,1600);
+    ThreadPool pool(3);
+    std::vector<std::atomic<int>> busy(pool.ThreadCount() + 1);
+    std::atomic<int> tiles_drawn { 0 };
+    auto draw = [&](size_t aWorker,BitmapView&,const Rect&,const std::vector<uint32_t>&)
+        {
+        CT_CHECK(aWorker <= pool.ThreadCount());
+        CT_CHECK(busy[aWorker]++ == 0);
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        busy[aWorker]--;
+        tiles_drawn++;
+        };
+
+    grid.Draw(&pool,bitmap,draw);
+    CT_CHECK(tiles_drawn == 64);
+
+    // Tasks on the pool draw their tiles with their own worker indexes, while other tiles are drawn on the pool's workers.
+    tiles_drawn = 0;
+    TaskGroup group(pool);
+    for (int i = 0; i < 6; i++)
+        group.Submit([&](size_t aWorker)
+            {
+            CT_CHECK(pool.WorkerIndex() == aWorker);
+            grid.Draw(&pool,bitmap,[&](size_t aTileWorker,BitmapView& aTile,const Rect& aTileBounds,const std::vector<uint32_t>& aItems)
+                {
+                CT_CHECK(aTileWorker == aWorker);
+                draw(aTileWorker,aTile,aTileBounds,aItems);
+                });
+            });
+    grid.Draw(&pool,bitmap,draw);
+    group.Wait();
+    CT_CHECK(tiles_drawn == 7 * 64);
+    }
+
+/** Checks that an exception thrown while drawing a tile is thrown by Draw, after the other tiles have been drawn. */
+void TestDrawException()
+    {
+    RasterTileGrid grid(400,400,100);
+    grid.Bin(0,Rect(0,0,400,400));
+    std::vector<uint32_t> pixel(400 * 400);
+    BitmapView bitmap(BitmapType::RGBA32,(uint8_t*)pixel.data(),400,400,1600);
+    ThreadPool pool(2);
+    std::atomic<int> tiles_drawn { 0 };
+    Result error = KErrorNone;
+    try
+        {
+        grid.Draw(&pool,bitmap,[&](size_t,BitmapView&,const Rect& aTileBounds,const std::vector<uint32_t>&)
+            {
+            if (aTileBounds.Min == Point(100,200))
+                throw KErrorCorrupt;
+            tiles_drawn++;
+            });
+        }
+    catch (Result e)
+        {
+        error = e;
+        }
+    CT_CHECK(error == KErrorCorrupt);
+    CT_CHECK(tiles_drawn == 15);
+    }
+
+}
+
+int main(int argc,char** argv)
+    {
+    return RunTests(argc,argv,
+        {
+        { "Bin", TestBin },
+        { "Draw", TestDraw },
+        { "WorkerIndex", TestWorkerIndex },
+        { "DrawException", TestDrawException },
+        });
+    }